@@ -1,8 +1,100 @@
+#define _GNU_SOURCE
+
 #include "grep.h"
+#include "grep_ac.h"
+#include "grep_arena.h"
+#include "grep_internal.h"
+#include "grep_output.h"
+#include "grep_regex.h"
+#include "grep_scan.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
-#include <ctype.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// read() size for inputs that cannot be mapped
+#define GREP_READ_CHUNK (1024 * 1024)
+
+// Arena chunk size for a result's matches and filename
+#define GREP_ARENA_CHUNK (64 * 1024)
+
+// Files at least this large are searched on several threads
+#define GREP_PARALLEL_MIN (16 * 1024 * 1024)
+
+// Smallest chunk one thread claims when a file is split
+#define GREP_PARALLEL_CHUNK (4 * 1024 * 1024)
+
+// Buffers a stream is read ahead into (GREP_READ_CHUNK bytes each)
+#define GREP_PREFETCH_DEPTH 4
+
+// Mapped files are scanned in windows of this size, the next one being read
+// ahead while the current one is scanned
+#define GREP_PREFETCH_WINDOW (8 * 1024 * 1024)
+
+// Leading bytes checked for a NUL to tell binary files from text
+#define GREP_BINARY_PROBE (32 * 1024)
+
+// read() size for compressed input; at most GREP_READ_CHUNK
+#define GREP_INFLATE_CHUNK (256 * 1024)
+
+struct GrepPattern {
+    char** sources;             // Patterns as given, to detect changes
+    size_t source_count;
+    bool case_insensitive;
+    bool has_newline;           // Some pattern spans lines, so whole-buffer search is unsafe
+    bool has_empty;             // Some pattern is empty and matches every line
+    bool extended;              // Patterns are regular expressions (-E)
+    GrepAc* ac;                 // Several patterns: searched with this instead of needle
+    GrepRegex* regex;           // -E: searched with this instead of needle
+
+    // A single pattern
+    unsigned char* needle;      // Pattern, case-folded when case_insensitive
+    size_t length;
+    unsigned char fold[256];    // Byte -> byte compared against needle (ASCII fold)
+    size_t shift[256];          // Horspool shift for the byte under the window's last position
+};
+
+// Create GrepOptions with every flag off and no pattern or paths
+GrepOptions* grep_options_create(void) {
+    GrepOptions* opts = (GrepOptions*)malloc(sizeof(GrepOptions));
+    if (opts == NULL) {
+        return NULL;
+    }
+
+    opts->pattern = NULL;
+    opts->patterns = NULL;
+    opts->pattern_count = 0;
+    opts->recursive = false;
+    opts->case_insensitive = false;
+    opts->line_number = false;
+    opts->invert_match = false;
+    opts->extended = false;
+    opts->count = false;
+    opts->files_with_matches = false;
+    opts->files_without_match = false;
+    opts->quiet = false;
+    opts->max_count = -1;
+    opts->binary_files = GREP_BINARY_MATCHES;
+    opts->excludes = NULL;
+    opts->exclude_count = 0;
+    opts->max_file_size = 0;
+    opts->physical_order = false;
+    opts->decompress = false;
+    opts->paths = NULL;
+    opts->path_count = 0;
+    opts->threads = 0;
+    opts->compiled = NULL;
+
+    return opts;
+}
 
 // Destroy GrepOptions and free memory
 void grep_options_destroy(GrepOptions* opts) {
@@ -13,6 +105,16 @@ void grep_options_destroy(GrepOptions* opts) {
     if (opts->pattern != NULL) {
         free(opts->pattern);
     }
+
+    for (size_t i = 0; i < opts->pattern_count; ++i) {
+        free(opts->patterns[i]);
+    }
+    free(opts->patterns);
+
+    for (size_t i = 0; i < opts->exclude_count; ++i) {
+        free(opts->excludes[i]);
+    }
+    free(opts->excludes);
     
     if (opts->paths != NULL) {
         for (size_t i = 0; i < opts->path_count; ++i) {
@@ -22,85 +124,1381 @@ void grep_options_destroy(GrepOptions* opts) {
         }
         free(opts->paths);
     }
+
+    grep_pattern_destroy(opts->compiled);
     
     free(opts);
 }
 
-// Pattern matching function
+// Add a -e pattern
+bool grep_options_add_pattern(GrepOptions* opts, const char* pattern) {
+    if (opts == NULL || pattern == NULL) {
+        return false;
+    }
+
+    char** patterns = (char**)realloc(opts->patterns, (opts->pattern_count + 1) * sizeof(char*));
+    if (patterns == NULL) {
+        return false;
+    }
+    opts->patterns = patterns;
+
+    opts->patterns[opts->pattern_count] = strdup(pattern);
+    if (opts->patterns[opts->pattern_count] == NULL) {
+        return false;
+    }
+    opts->pattern_count++;
+    return true;
+}
+
+// Add an --exclude glob
+bool grep_options_add_exclude(GrepOptions* opts, const char* glob) {
+    if (opts == NULL || glob == NULL) {
+        return false;
+    }
+
+    char** excludes = (char**)realloc(opts->excludes, (opts->exclude_count + 1) * sizeof(char*));
+    if (excludes == NULL) {
+        return false;
+    }
+    opts->excludes = excludes;
+
+    opts->excludes[opts->exclude_count] = strdup(glob);
+    if (opts->excludes[opts->exclude_count] == NULL) {
+        return false;
+    }
+    opts->exclude_count++;
+    return true;
+}
+
+// Add every line of filename as a pattern (-f)
+bool grep_options_load_patterns(GrepOptions* opts, const char* filename) {
+    if (opts == NULL || filename == NULL) {
+        return false;
+    }
+
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        return false;
+    }
+
+    char* line = NULL;
+    size_t line_capacity = 0;
+    ssize_t len;
+    bool ok = true;
+
+    while (ok && (len = getline(&line, &line_capacity, file)) != -1) {
+        if (len > 0 && line[len - 1] == '\n') {
+            line[len - 1] = '\0';
+        }
+        ok = grep_options_add_pattern(opts, line);
+    }
+    ok = ok && !ferror(file);
+
+    free(line);
+    fclose(file);
+    return ok;
+}
+
+// Fill in the single-pattern fields: fold table, folded needle and Horspool shifts
+static bool grep_pattern_compile_literal(GrepPattern* compiled, const char* pattern) {
+    compiled->length = strlen(pattern);
+    compiled->needle = (unsigned char*)malloc(compiled->length + 1);
+    if (compiled->needle == NULL) {
+        return false;
+    }
+
+    for (int c = 0; c < 256; c++) {
+        compiled->fold[c] = compiled->case_insensitive ? grep_scan_fold((unsigned char)c) : (unsigned char)c;
+    }
+    for (size_t i = 0; i <= compiled->length; i++) {
+        compiled->needle[i] = compiled->fold[(unsigned char)pattern[i]];
+    }
+
+    // A byte not in needle[0, length - 1) lets the window skip its full width;
+    // every byte that folds to the same needle byte gets the same shift, so
+    // the search never folds the byte it shifts on
+    for (int c = 0; c < 256; c++) {
+        compiled->shift[c] = compiled->length;
+    }
+    for (size_t i = 0; i + 1 < compiled->length; i++) {
+        for (int c = 0; c < 256; c++) {
+            if (compiled->fold[c] == compiled->needle[i]) {
+                compiled->shift[c] = compiled->length - 1 - i;
+            }
+        }
+    }
+
+    return true;
+}
+
+// GrepPattern holding copies of patterns, with no engine yet
+static GrepPattern* grep_pattern_create(const char* const* patterns, size_t count,
+                                        bool case_insensitive, bool extended) {
+    if (patterns == NULL || count == 0) {
+        return NULL;
+    }
+
+    GrepPattern* compiled = (GrepPattern*)calloc(1, sizeof(GrepPattern));
+    if (compiled == NULL) {
+        return NULL;
+    }
+
+    compiled->case_insensitive = case_insensitive;
+    compiled->extended = extended;
+    compiled->sources = (char**)calloc(count, sizeof(char*));
+    if (compiled->sources == NULL) {
+        grep_pattern_destroy(compiled);
+        return NULL;
+    }
+    for (size_t i = 0; i < count; ++i) {
+        compiled->sources[i] = strdup(patterns[i]);
+        if (compiled->sources[i] == NULL) {
+            grep_pattern_destroy(compiled);
+            return NULL;
+        }
+        compiled->source_count++;
+        // A regex handles both itself
+        if (!extended) {
+            compiled->has_newline = compiled->has_newline || strchr(patterns[i], '\n') != NULL;
+            compiled->has_empty = compiled->has_empty || patterns[i][0] == '\0';
+        }
+    }
+
+    return compiled;
+}
+
+// Compile a set of patterns; a line matches if any of them occurs in it
+GrepPattern* grep_pattern_compile_set(const char* const* patterns, size_t count, bool case_insensitive) {
+    GrepPattern* compiled = grep_pattern_create(patterns, count, case_insensitive, false);
+    if (compiled == NULL) {
+        return NULL;
+    }
+
+    bool ok;
+    if (count == 1) {
+        ok = grep_pattern_compile_literal(compiled, patterns[0]);
+    } else {
+        // One pass over the text for any number of patterns
+        ok = (compiled->ac = grep_ac_create(patterns, count, case_insensitive)) != NULL;
+    }
+    if (!ok) {
+        grep_pattern_destroy(compiled);
+        return NULL;
+    }
+
+    return compiled;
+}
+
+// Compile extended regular expressions; a line matches if any of them does
+GrepPattern* grep_pattern_compile_regex(const char* const* patterns, size_t count, bool case_insensitive,
+                                        const char** error) {
+    GrepPattern* compiled = grep_pattern_create(patterns, count, case_insensitive, true);
+    if (compiled == NULL) {
+        if (error != NULL) {
+            *error = "out of memory";
+        }
+        return NULL;
+    }
+
+    compiled->regex = grep_regex_compile(patterns, count, case_insensitive, error);
+    if (compiled->regex == NULL) {
+        grep_pattern_destroy(compiled);
+        return NULL;
+    }
+
+    return compiled;
+}
+
+// Compile pattern once: fold table, folded needle and Horspool shifts
+GrepPattern* grep_pattern_compile(const char* pattern, bool case_insensitive) {
+    if (pattern == NULL) {
+        return NULL;
+    }
+    return grep_pattern_compile_set(&pattern, 1, case_insensitive);
+}
+
+// Destroy a compiled pattern
+void grep_pattern_destroy(GrepPattern* compiled) {
+    if (compiled == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < compiled->source_count; ++i) {
+        free(compiled->sources[i]);
+    }
+    free(compiled->sources);
+    grep_ac_destroy(compiled->ac);
+    grep_regex_destroy(compiled->regex);
+    free(compiled->needle);
+    free(compiled);
+}
+
+// Number of literals one of which every selected line contains, or 0
+size_t grep_pattern_literal_count(const GrepPattern* compiled) {
+    if (compiled->regex != NULL) {
+        size_t len;
+        return grep_regex_literal(compiled->regex, &len) != NULL ? 1 : 0;
+    }
+    return compiled->has_empty ? 0 : compiled->source_count;
+}
+
+// Literal i of grep_pattern_literal_count's set
+const char* grep_pattern_literal(const GrepPattern* compiled, size_t i, size_t* len) {
+    if (compiled->regex != NULL) {
+        return (const char*)grep_regex_literal(compiled->regex, len);
+    }
+    *len = strlen(compiled->sources[i]);
+    return compiled->sources[i];
+}
+
+// First occurrence of the pattern in text[0, len), or NULL
+const char* grep_pattern_search(const GrepPattern* compiled, const char* text, size_t len) {
+    if (compiled == NULL || text == NULL) {
+        return NULL;
+    }
+
+    if (compiled->regex != NULL) {
+        return grep_regex_search(compiled->regex, text, len);
+    }
+    if (compiled->has_empty) {
+        return text;
+    }
+    if (compiled->ac != NULL) {
+        return grep_ac_search(compiled->ac, text, len);
+    }
+
+    size_t m = compiled->length;
+    if (m > len) {
+        return NULL;
+    }
+    if (grep_scan_level() != GREP_SCAN_SCALAR || (m == 1 && !compiled->case_insensitive)) {
+        return grep_scan_find(compiled->needle, m, compiled->case_insensitive, text, len);
+    }
+
+    // Scalar fallback: Horspool
+    const unsigned char* t = (const unsigned char*)text;
+    const unsigned char* needle = compiled->needle;
+    const unsigned char* fold = compiled->fold;
+    unsigned char last = needle[m - 1];
+
+    for (size_t pos = 0; pos <= len - m; pos += compiled->shift[t[pos + m - 1]]) {
+        if (fold[t[pos + m - 1]] != last) {
+            continue;
+        }
+        size_t j = 0;
+        while (j < m - 1 && fold[t[pos + j]] == needle[j]) {
+            j++;
+        }
+        if (j == m - 1) {
+            return text + pos;
+        }
+    }
+    return NULL;
+}
+
+// Whether compiled was built from exactly opts' patterns and -i
+static bool grep_pattern_current(const GrepPattern* compiled, const GrepOptions* opts) {
+    size_t first = opts->pattern != NULL ? 1 : 0;
+    if (compiled->case_insensitive != opts->case_insensitive || compiled->extended != opts->extended ||
+        compiled->source_count != first + opts->pattern_count) {
+        return false;
+    }
+    if (first && strcmp(compiled->sources[0], opts->pattern) != 0) {
+        return false;
+    }
+    for (size_t i = 0; i < opts->pattern_count; ++i) {
+        if (strcmp(compiled->sources[first + i], opts->patterns[i]) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Compiled form of opts' patterns, rebuilt only when they or -i change
+const GrepPattern* grep_options_pattern(GrepOptions* opts) {
+    if (opts == NULL || (opts->pattern == NULL && opts->pattern_count == 0)) {
+        return NULL;
+    }
+
+    GrepPattern* compiled = opts->compiled;
+    if (compiled != NULL && grep_pattern_current(compiled, opts)) {
+        return compiled;
+    }
+
+    grep_pattern_destroy(compiled);
+    opts->compiled = NULL;
+
+    // opts->pattern first, then the -e/-f patterns
+    const char** patterns = (const char**)malloc((opts->pattern_count + 1) * sizeof(char*));
+    if (patterns == NULL) {
+        return NULL;
+    }
+    size_t count = 0;
+    if (opts->pattern != NULL) {
+        patterns[count++] = opts->pattern;
+    }
+    for (size_t i = 0; i < opts->pattern_count; ++i) {
+        patterns[count++] = opts->patterns[i];
+    }
+
+    if (opts->extended) {
+        const char* error = NULL;
+        opts->compiled = grep_pattern_compile_regex(patterns, count, opts->case_insensitive, &error);
+        if (opts->compiled == NULL) {
+            fprintf(stderr, "grep: %s\n", error);
+        }
+    } else {
+        opts->compiled = grep_pattern_compile_set(patterns, count, opts->case_insensitive);
+    }
+    free(patterns);
+    return opts->compiled;
+}
+
+// Pattern matching function. Callers test one line at a time, so nothing is
+// compiled: the scan kernels search for the folded needle directly.
 bool grep_match_pattern(const char* pattern, const char* text, bool case_insensitive) {
     if (pattern == NULL || text == NULL) {
         return false;
     }
-    
-    if (case_insensitive) {
-        // Case-insensitive matching: convert both strings to lowercase for comparison
-        size_t pattern_len = strlen(pattern);
-        size_t text_len = strlen(text);
-        
-        if (pattern_len > text_len) {
+
+    size_t m = strlen(pattern);
+    unsigned char stack_needle[256];
+    unsigned char* needle = m <= sizeof(stack_needle) ? stack_needle : (unsigned char*)malloc(m);
+    if (needle == NULL) {
+        return false;
+    }
+    for (size_t i = 0; i < m; i++) {
+        unsigned char c = (unsigned char)pattern[i];
+        needle[i] = case_insensitive ? grep_scan_fold(c) : c;
+    }
+
+    bool found = grep_scan_find(needle, m, case_insensitive, text, strlen(text)) != NULL;
+    if (needle != stack_needle) {
+        free(needle);
+    }
+    return found;
+}
+
+// Append one matching line, by position in result->data
+static bool grep_result_add(GrepResult* result, const GrepMatch* added) {
+    if (result->count == result->capacity) {
+        size_t capacity = result->capacity == 0 ? 16 : result->capacity * 2;
+        GrepMatch* matches = (GrepMatch*)grep_arena_grow(result->arena, result->matches,
+                                                         result->capacity * sizeof(GrepMatch),
+                                                         capacity * sizeof(GrepMatch));
+        if (matches == NULL) {
+            return false;
+        }
+        result->matches = matches;
+        result->capacity = capacity;
+    }
+
+    GrepMatch* match = &result->matches[result->count];
+    *match = *added;
+    match->filename = result->filename;
+    result->count++;
+    return true;
+}
+
+// GrepMatchCallback that appends to the GrepResult in ctx; stops the scan
+// only when out of memory
+static bool grep_result_collect(const GrepMatch* match, const char* line, void* ctx) {
+    (void)line;
+    return grep_result_add((GrepResult*)ctx, match);
+}
+
+// Read an unmappable file (pipe, tty, procfs) into an arena buffer
+static char* grep_read_fd(GrepArena* arena, int fd, size_t* len) {
+    size_t capacity = GREP_READ_CHUNK, used = 0;
+    char* buf = (char*)grep_arena_alloc(arena, capacity);
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    for (;;) {
+        if (used == capacity) {
+            char* grown = (char*)grep_arena_grow(arena, buf, used, capacity * 2);
+            if (grown == NULL) {
+                return NULL;
+            }
+            buf = grown;
+            capacity *= 2;
+        }
+        ssize_t n = read(fd, buf + used, capacity - used);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return NULL;
+        }
+        if (n == 0) {
+            break;
+        }
+        used += (size_t)n;
+    }
+
+    *len = used;
+    return buf;
+}
+
+// Point result->data at the contents of the file open on fd, which is
+// closed: mmap for regular files, read() otherwise
+static bool grep_load_file(GrepResult* result, int fd) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        void* map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            madvise(map, (size_t)st.st_size, MADV_SEQUENTIAL);
+            close(fd);
+            result->data = (const char*)map;
+            result->data_len = (size_t)st.st_size;
+            result->mapped = true;
+            return true;
+        }
+    }
+
+    size_t len = 0;
+    char* buf = grep_read_fd(result->arena, fd, &len);
+    close(fd);
+    if (buf == NULL) {
+        return false;
+    }
+    result->data = buf;
+    result->data_len = len;
+    return true;
+}
+
+// State of one scan over a file's lines, fed one buffer at a time
+typedef struct {
+    GrepOptions* opts;
+    const GrepPattern* compiled;
+    GrepMatchCallback emit;     // Receives each selected line; false stops the scan
+    void* ctx;
+    const char* filename;       // Reported in each match
+    const char* base;           // Buffer being scanned, at file offset base_offset
+    size_t base_offset;
+    size_t lines;               // Newlines before the buffer (counted only with -n)
+    size_t selected;            // Lines passed to emit so far
+    size_t limit;               // Stop once selected reaches this
+    bool stopped;               // emit returned false
+    bool binary;                // The input holds a NUL byte near its start
+} GrepScan;
+
+// True when the options only need a per-file count or yes/no answer
+static bool grep_options_summary(const GrepOptions* opts) {
+    return opts->count || opts->files_with_matches || opts->files_without_match || opts->quiet;
+}
+
+// Selected lines after which a file's answer is known
+static size_t grep_options_limit(const GrepOptions* opts) {
+    if (opts->files_with_matches || opts->files_without_match || opts->quiet) {
+        return 1;
+    }
+    return opts->max_count >= 0 ? (size_t)opts->max_count : SIZE_MAX;
+}
+
+// Pass the selected lines of [begin, end) to scan->emit; begin is a line
+// start inside scan->base. Without -v the pattern is searched across the
+// whole range and only the lines holding a hit are delimited; line numbers
+// come from counting newlines between hits, and with -n scan->lines is
+// advanced past the range. Stops at scan->limit selected lines. Returns false
+// once emit has stopped the scan.
+static bool grep_scan_buffer(GrepScan* scan, const char* begin, const char* end) {
+    GrepOptions* opts = scan->opts;
+    const GrepPattern* compiled = scan->compiled;
+    const char* pos = begin;        // Always at a line start
+    const char* counted = begin;    // Newlines before here are in scan->lines
+
+    while (pos < end && scan->selected < scan->limit) {
+        const char* line = pos;
+        const char* hit = NULL;
+
+        if (!opts->invert_match && !compiled->has_newline) {
+            hit = grep_pattern_search(compiled, pos, (size_t)(end - pos));
+            if (hit == NULL) {
+                break;
+            }
+            const char* prev = (const char*)memrchr(pos, '\n', (size_t)(hit - pos));
+            line = prev == NULL ? pos : prev + 1;
+        }
+
+        const char* from = hit != NULL ? hit : line;
+        const char* eol = grep_scan_byte(from, (size_t)(end - from), '\n');
+        if (eol == NULL) {
+            eol = end;
+        }
+        pos = eol + 1;
+
+        if (hit == NULL) {
+            bool found = grep_pattern_search(compiled, line, (size_t)(eol - line)) != NULL;
+            if (found == opts->invert_match) {
+                continue;
+            }
+        }
+
+        GrepMatch match;
+        match.filename = scan->filename;
+        match.line_number = 0;
+        match.binary = scan->binary;
+        match.offset = scan->base_offset + (size_t)(line - scan->base);
+        match.length = (size_t)(eol - line);
+        if (opts->line_number) {
+            scan->lines += grep_scan_count(counted, (size_t)(line - counted), '\n');
+            counted = line;
+            match.line_number = (int)(scan->lines + 1);
+        }
+        scan->selected++;
+        if (!scan->emit(&match, line, scan->ctx)) {
+            scan->stopped = true;
+            return false;
+        }
+    }
+
+    if (opts->line_number && scan->selected < scan->limit) {
+        scan->lines += grep_scan_count(counted, (size_t)(end - counted), '\n');
+    }
+    return true;
+}
+
+// Scan for opts over the whole of [data, data + len), the file at filename
+static void grep_scan_init(GrepScan* scan, GrepOptions* opts, const GrepPattern* compiled,
+                           const char* filename, const char* data, GrepMatchCallback emit, void* ctx) {
+    scan->opts = opts;
+    scan->compiled = compiled;
+    scan->emit = emit;
+    scan->ctx = ctx;
+    scan->filename = filename;
+    scan->base = data;
+    scan->base_offset = 0;
+    scan->lines = 0;
+    scan->selected = 0;
+    scan->limit = grep_options_limit(opts);
+    scan->stopped = false;
+    scan->binary = false;
+}
+
+// True once nothing more will be selected
+static bool grep_scan_done(const GrepScan* scan) {
+    return scan->stopped || scan->selected >= scan->limit;
+}
+
+// Check the start of the input for a NUL byte. In a binary file only the
+// first selected line is reported, or none with GREP_BINARY_SKIP; the
+// summary modes count as usual unless binary files are skipped.
+static void grep_scan_probe(GrepScan* scan, const char* data, size_t len) {
+    GrepBinaryFiles mode = scan->opts->binary_files;
+    size_t probe = len < GREP_BINARY_PROBE ? len : GREP_BINARY_PROBE;
+    if (mode == GREP_BINARY_TEXT || grep_scan_byte(data, probe, '\0') == NULL) {
+        return;
+    }
+
+    scan->binary = true;
+    if (mode == GREP_BINARY_SKIP) {
+        scan->limit = 0;
+    } else if (!grep_options_summary(scan->opts) && scan->limit > 1) {
+        scan->limit = 1;
+    }
+}
+
+// Scan data[0, len) in newline-aligned windows. For a mapping, the kernel is
+// asked to read the next window in while the current one is scanned, so a
+// cold file is not read only as page faults demand it.
+static bool grep_scan_mapped(GrepScan* scan, const char* data, size_t len, bool mapped) {
+    const char* pos = data;
+    const char* end = data + len;
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+
+    while (pos < end && !grep_scan_done(scan)) {
+        const char* cut = end;
+        if ((size_t)(end - pos) > GREP_PREFETCH_WINDOW) {
+            const char* eol = grep_scan_byte(pos + GREP_PREFETCH_WINDOW,
+                                             (size_t)(end - pos) - GREP_PREFETCH_WINDOW, '\n');
+            cut = eol != NULL ? eol + 1 : end;
+        }
+        if (mapped && cut < end) {
+            uintptr_t from = (uintptr_t)cut & ~(uintptr_t)(page - 1);
+            size_t ahead = (size_t)(end - cut) < GREP_PREFETCH_WINDOW ? (size_t)(end - cut) : GREP_PREFETCH_WINDOW;
+            madvise((void*)from, (size_t)((uintptr_t)cut + ahead - from), MADV_WILLNEED);
+        }
+        if (!grep_scan_buffer(scan, pos, cut)) {
             return false;
         }
-        
-        for (size_t i = 0; i <= text_len - pattern_len; i++) {
-            bool match = true;
-            for (size_t j = 0; j < pattern_len; j++) {
-                if (tolower((unsigned char)text[i + j]) != tolower((unsigned char)pattern[j])) {
-                    match = false;
-                    break;
-                }
+        pos = cut;
+    }
+    return true;
+}
+
+// GrepMatchCallback for counting: scan->selected is the answer
+static bool grep_count_emit(const GrepMatch* match, const char* line, void* ctx) {
+    (void)match;
+    (void)line;
+    (void)ctx;
+    return true;
+}
+
+// A file split into newline-aligned chunks for grep_search_split
+typedef struct {
+    GrepOptions* opts;
+    const GrepPattern* compiled;
+    GrepResult* result;
+    const char** bounds;        // Chunk i is [bounds[i], bounds[i + 1])
+    size_t chunk_count;
+    GrepResult** parts;         // Matches of each chunk, numbered from its start
+    size_t* newlines;           // Newlines in each chunk (counted only with -n)
+    _Atomic size_t next;        // Next chunk to claim
+} GrepSplit;
+
+// Result sharing result's data and filename, with matches of its own
+static GrepResult* grep_result_part(const GrepResult* result) {
+    GrepResult* part = (GrepResult*)calloc(1, sizeof(GrepResult));
+    if (part == NULL) {
+        return NULL;
+    }
+
+    part->arena = grep_arena_create(GREP_ARENA_CHUNK);
+    if (part->arena == NULL) {
+        free(part);
+        return NULL;
+    }
+    part->filename = result->filename;
+    part->data = result->data;
+    part->data_len = result->data_len;
+    return part;
+}
+
+static void* grep_split_worker(void* arg) {
+    GrepSplit* split = (GrepSplit*)arg;
+    size_t i;
+
+    while ((i = atomic_fetch_add(&split->next, 1)) < split->chunk_count) {
+        GrepResult* part = grep_result_part(split->result);
+        if (part != NULL) {
+            GrepScan scan;
+            grep_scan_init(&scan, split->opts, split->compiled, part->filename, part->data,
+                           grep_result_collect, part);
+            if (!grep_scan_buffer(&scan, split->bounds[i], split->bounds[i + 1])) {
+                grep_result_destroy(part);
+                part = NULL;
+            }
+            split->newlines[i] = scan.lines;
+        }
+        split->parts[i] = part;
+    }
+    return NULL;
+}
+
+// Search a large buffer on up to threads threads. Each chunk collects its
+// own matches and newline count; a prefix sum of the counts turns chunk line
+// numbers into file line numbers, and chunks are appended in file order, so
+// the result is identical to a sequential search.
+static bool grep_search_split(GrepOptions* opts, const GrepPattern* compiled, GrepResult* result,
+                              size_t threads) {
+    const char* data = result->data;
+    const char* end = data + result->data_len;
+    size_t chunk_size = result->data_len / (threads * 4);
+    if (chunk_size < GREP_PARALLEL_CHUNK) {
+        chunk_size = GREP_PARALLEL_CHUNK;
+    }
+    size_t max_chunks = result->data_len / chunk_size + 1;
+
+    GrepSplit split;
+    split.opts = opts;
+    split.compiled = compiled;
+    split.result = result;
+    split.bounds = (const char**)malloc((max_chunks + 1) * sizeof(const char*));
+    split.parts = (GrepResult**)calloc(max_chunks, sizeof(GrepResult*));
+    split.newlines = (size_t*)calloc(max_chunks, sizeof(size_t));
+    atomic_init(&split.next, 0);
+    bool ok = split.bounds != NULL && split.parts != NULL && split.newlines != NULL;
+
+    // Each boundary moves forward to the start of the next line
+    size_t count = 0;
+    if (ok) {
+        split.bounds[0] = data;
+        while (split.bounds[count] < end) {
+            const char* cut = split.bounds[count] + chunk_size;
+            const char* eol = cut < end ? grep_scan_byte(cut, (size_t)(end - cut), '\n') : NULL;
+            split.bounds[++count] = eol != NULL ? eol + 1 : end;
+        }
+    }
+    split.chunk_count = count;
+
+    pthread_t* workers = NULL;
+    size_t started = 0;
+    if (ok && threads > 1) {
+        workers = (pthread_t*)malloc((threads - 1) * sizeof(pthread_t));
+        for (; workers != NULL && started < threads - 1 && started + 1 < count; ++started) {
+            if (pthread_create(&workers[started], NULL, grep_split_worker, &split) != 0) {
+                break;
             }
-            if (match) {
-                return true;
+        }
+    }
+    if (ok) {
+        grep_split_worker(&split);
+    }
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    size_t base = 0;
+    for (size_t i = 0; i < count; ++i) {
+        GrepResult* part = split.parts[i];
+        for (size_t j = 0; ok && part != NULL && j < part->count; ++j) {
+            GrepMatch match = part->matches[j];
+            if (match.line_number > 0) {
+                match.line_number = (int)(base + (size_t)match.line_number);
             }
+            ok = grep_result_add(result, &match);
+        }
+        ok = ok && part != NULL;
+        base += split.newlines[i];
+        grep_result_destroy(part);
+    }
+
+    free(split.bounds);
+    free(split.parts);
+    free(split.newlines);
+    return ok;
+}
+
+// How the stream reader treats its input's first bytes
+typedef enum {
+    GREP_INPUT_PLAIN,           // Never decompressed
+    GREP_INPUT_DETECT,          // Inflated if they are the gzip magic
+    GREP_INPUT_GZIP,            // Known to be gzip: inflated without checking
+} GrepInput;
+
+// Streams fd through scan (defined with the stream reader below)
+static int grep_scan_fd(GrepScan* scan, int fd, GrepInput input);
+
+// True if the file open on fd starts with the gzip magic bytes; the file
+// offset is left alone
+static bool grep_fd_compressed(int fd) {
+    unsigned char magic[2];
+    return pread(fd, magic, sizeof(magic), 0) == (ssize_t)sizeof(magic) && magic[0] == 0x1f && magic[1] == 0x8b;
+}
+
+// Collects a compressed file's matches: the decompressed text is never held
+// whole, so each selected line is copied into data as it goes by
+typedef struct {
+    GrepResult* result;
+    size_t capacity;            // Of result->data
+    bool failed;
+} GrepLineCopy;
+
+static bool grep_result_copy(const GrepMatch* match, const char* line, void* ctx) {
+    GrepLineCopy* copy = (GrepLineCopy*)ctx;
+    GrepResult* result = copy->result;
+    // Grown before the first line even if it is empty, so data is never NULL
+    if (copy->capacity == 0 || result->data_len + match->length > copy->capacity) {
+        size_t capacity = copy->capacity == 0 ? 4096 : copy->capacity;
+        while (capacity < result->data_len + match->length) {
+            capacity *= 2;
+        }
+        char* grown = (char*)grep_arena_grow(result->arena, (void*)result->data, copy->capacity, capacity);
+        if (grown == NULL) {
+            copy->failed = true;
+            return false;
         }
+        result->data = grown;
+        copy->capacity = capacity;
+    }
+
+    GrepMatch kept = *match;
+    kept.offset = result->data_len;
+    memcpy((char*)result->data + result->data_len, line, match->length);
+    result->data_len += match->length;
+    if (!grep_result_add(result, &kept)) {
+        copy->failed = true;
         return false;
-    } else {
-        // Case-sensitive matching: use strstr
-        return strstr(text, pattern) != NULL;
     }
+    return true;
 }
 
-// Search for pattern in a single file
-GrepResult* grep_search_file(GrepOptions* opts, const char* filename) {
-    // TODO: Implement file search
-    // Read file line by line, match pattern against each line, and collect matches
-    // Handle line numbers and invert match flags
-    
-    GrepResult* result = (GrepResult*)malloc(sizeof(GrepResult));
+// Search a gzip file, open on fd, through the decompressing stream reader
+static bool grep_search_compressed(GrepOptions* opts, const GrepPattern* compiled, GrepResult* result, int fd) {
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+    GrepLineCopy copy = {result, 0, false};
+    GrepScan scan;
+    grep_scan_init(&scan, opts, compiled, result->filename, NULL, grep_result_copy, &copy);
+    int status = grep_scan_fd(&scan, fd, GREP_INPUT_GZIP);
+    close(fd);
+    return status == 0 && !copy.failed;
+}
+
+// grep_search_file with an explicit thread budget for splitting the file
+GrepResult* grep_search_file_threads(GrepOptions* opts, const char* filename, int threads) {
+    if (opts == NULL || filename == NULL) {
+        return NULL;
+    }
+
+    const GrepPattern* compiled = grep_options_pattern(opts);
+    if (compiled == NULL) {
+        return NULL;
+    }
+
+    // Summary modes keep no lines, so the file is only counted
+    long selected = 0;
+    bool summary = grep_options_summary(opts);
+    if (summary && (selected = grep_count_file(opts, filename)) < 0) {
+        return NULL;
+    }
+
+    GrepResult* result = (GrepResult*)calloc(1, sizeof(GrepResult));
     if (result == NULL) {
         return NULL;
     }
-    
-    result->matches = NULL;
-    result->count = 0;
-    result->capacity = 0;
-    
+
+    result->arena = grep_arena_create(summary ? strlen(filename) + 1 : GREP_ARENA_CHUNK);
+    if (result->arena == NULL) {
+        free(result);
+        return NULL;
+    }
+
+    result->filename = grep_arena_strdup(result->arena, filename);
+    if (result->filename == NULL) {
+        grep_result_destroy(result);
+        return NULL;
+    }
+    if (summary) {
+        result->count = (size_t)selected;
+        return result;
+    }
+    // Opened once: the gzip check and the search both use fd, which they close
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        grep_result_destroy(result);
+        return NULL;
+    }
+    if (opts->decompress && grep_fd_compressed(fd)) {
+        if (!grep_search_compressed(opts, compiled, result, fd)) {
+            grep_result_destroy(result);
+            return NULL;
+        }
+        return result;
+    }
+    if (!grep_load_file(result, fd)) {
+        grep_result_destroy(result);
+        return NULL;
+    }
+
+    if (threads <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        threads = cpus > 0 ? (int)cpus : 1;
+    }
+
+    GrepScan scan;
+    grep_scan_init(&scan, opts, compiled, result->filename, result->data, grep_result_collect, result);
+    grep_scan_probe(&scan, result->data, result->data_len);
+
+    // A -m limit (or a binary file) stops a sequential scan early, which a
+    // split cannot
+    bool ok;
+    if (threads > 1 && result->data_len >= GREP_PARALLEL_MIN && scan.limit == SIZE_MAX) {
+        ok = grep_search_split(opts, compiled, result, (size_t)threads);
+    } else {
+        ok = grep_scan_mapped(&scan, result->data, result->data_len, result->mapped);
+    }
+    if (!ok) {
+        grep_result_destroy(result);
+        return NULL;
+    }
+    // No match refers to the mapping, and the result may wait a while to be
+    // printed
+    if (result->count == 0 && result->mapped) {
+        munmap((void*)result->data, result->data_len);
+        result->data = NULL;
+        result->data_len = 0;
+        result->mapped = false;
+    }
+
     return result;
 }
 
-// Print search results
-void grep_print_results(GrepResult* result) {
-    if (result == NULL || result->matches == NULL) {
+// Search for pattern in a single file
+GrepResult* grep_search_file(GrepOptions* opts, const char* filename) {
+    return grep_search_file_threads(opts, filename, opts != NULL ? opts->threads : 1);
+}
+
+// GrepMatchCallback printing each match as it is found
+static bool grep_print_emit(const GrepMatch* match, const char* line, void* ctx) {
+    (void)ctx;
+    grep_print_match(match, line);
+    return true;
+}
+
+// Open filename for streaming, or stdin for NULL and "-"; *name is what
+// matches report. Returns the fd, or -1.
+static int grep_open_input(const char* filename, const char** name) {
+    if (filename == NULL || strcmp(filename, "-") == 0) {
+        *name = "(standard input)";
+        return STDIN_FILENO;
+    }
+
+    *name = filename;
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    return fd;
+}
+
+static void grep_close_input(int fd) {
+    if (fd != STDIN_FILENO) {
+        close(fd);
+    }
+}
+
+// Reads a stream into a ring of reusable buffers. For a regular file larger
+// than one buffer a reader thread fills the ring ahead of the scan, so the
+// disk is busy while the scan runs; other inputs (pipes, small files) are
+// read on demand into the first buffer, since a pipe's writer already runs
+// concurrently and a read could block forever on it. Gzip input is inflated
+// into the buffers, on the reader thread for any regular file, so the scan
+// sees the decompressed stream and decompression overlaps it.
+typedef struct {
+    int fd;
+    bool compressed;            // Gzip: inflate through zstream
+    z_stream zstream;
+    bool member_end;            // Gzip: the current member is complete
+    bool later_member;          // Gzip: the current member follows a complete one
+    bool trailing;              // Gzip: the rest of the file is not a member; ignored
+    unsigned char* input;       // Compressed bytes, or a plain stream's first bytes
+    size_t pending;             // Plain stream: bytes in input not yet handed out
+    char* buffers[GREP_PREFETCH_DEPTH];
+    size_t lengths[GREP_PREFETCH_DEPTH];
+    size_t head;                // Next buffer to scan
+    size_t filled;              // Buffers read and not yet scanned; a 0-length one marks EOF
+    bool failed;                // A read failed
+    bool stop;                  // The scan is done; the reader thread exits
+    bool threaded;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} GrepReader;
+
+static ssize_t grep_reader_read(int fd, char* buf, size_t len) {
+    ssize_t n;
+    do {
+        n = read(fd, buf, len);
+    } while (n < 0 && errno == EINTR);
+    return n;
+}
+
+// True if the input since the last complete member is too short to hold a
+// gzip magic, so failing on it means the member is trailing garbage or
+// padding rather than corrupt
+static bool grep_reader_after_members(const GrepReader* reader) {
+    return reader->later_member && reader->zstream.total_in <= 2;
+}
+
+// Fill buf with up to len bytes of the stream, inflating gzip input. A gzip
+// file may hold several members, decompressed one after another; as with
+// gzip, bytes after the last member that do not start another are ignored.
+// Returns the length, 0 at the end, or -1 on a read failure or corrupt or
+// truncated data.
+static ssize_t grep_reader_fill(GrepReader* reader, char* buf, size_t len) {
+    if (!reader->compressed) {
+        if (reader->pending == 0) {
+            return grep_reader_read(reader->fd, buf, len);
+        }
+        // Bytes read while checking for the gzip magic
+        size_t n = reader->pending;
+        memcpy(buf, reader->input, n);
+        reader->pending = 0;
+        return (ssize_t)n;
+    }
+
+    if (reader->trailing) {
+        return 0;
+    }
+
+    z_stream* zstream = &reader->zstream;
+    zstream->next_out = (Bytef*)buf;
+    zstream->avail_out = (uInt)len;
+    while (zstream->avail_out > 0) {
+        if (zstream->avail_in == 0) {
+            ssize_t n = grep_reader_read(reader->fd, (char*)reader->input, GREP_INFLATE_CHUNK);
+            if (n < 0 || (n == 0 && !reader->member_end && !grep_reader_after_members(reader) &&
+                          zstream->avail_out == len)) {
+                return -1;
+            }
+            if (n == 0) {
+                // End of the file; a truncated member fails on the next call
+                break;
+            }
+            zstream->next_in = reader->input;
+            zstream->avail_in = (uInt)n;
+        }
+        if (reader->member_end) {
+            inflateReset(zstream);
+            reader->member_end = false;
+            reader->later_member = true;
+        }
+        int status = inflate(zstream, Z_NO_FLUSH);
+        if (status == Z_STREAM_END) {
+            reader->member_end = true;
+        } else if (status == Z_DATA_ERROR && grep_reader_after_members(reader)) {
+            reader->trailing = true;
+            break;
+        } else if (status != Z_OK) {
+            return -1;
+        }
+    }
+    return (ssize_t)(len - zstream->avail_out);
+}
+
+// Read the first bytes of the stream and set up inflating if they are the
+// gzip magic, or regardless with GREP_INPUT_GZIP; otherwise they are kept to
+// be handed out first
+static bool grep_reader_detect(GrepReader* reader, GrepInput input) {
+    reader->input = (unsigned char*)malloc(GREP_INFLATE_CHUNK);
+    if (reader->input == NULL) {
+        return false;
+    }
+
+    size_t n = 0;
+    while (n < 2) {
+        ssize_t got = grep_reader_read(reader->fd, (char*)reader->input + n, GREP_INFLATE_CHUNK - n);
+        if (got < 0) {
+            free(reader->input);
+            return false;
+        }
+        if (got == 0) {
+            break;
+        }
+        n += (size_t)got;
+    }
+
+    if (input != GREP_INPUT_GZIP && (n < 2 || reader->input[0] != 0x1f || reader->input[1] != 0x8b)) {
+        reader->pending = n;
+        return true;
+    }
+    memset(&reader->zstream, 0, sizeof(reader->zstream));
+    // 16: expect a gzip header and trailer
+    if (inflateInit2(&reader->zstream, 15 + 16) != Z_OK) {
+        free(reader->input);
+        return false;
+    }
+    reader->zstream.next_in = reader->input;
+    reader->zstream.avail_in = (uInt)n;
+    reader->compressed = true;
+    return true;
+}
+
+static void* grep_reader_run(void* arg) {
+    GrepReader* reader = (GrepReader*)arg;
+    size_t tail = 0;
+
+    pthread_mutex_lock(&reader->lock);
+    for (;;) {
+        while (reader->filled == GREP_PREFETCH_DEPTH && !reader->stop) {
+            pthread_cond_wait(&reader->cond, &reader->lock);
+        }
+        if (reader->stop) {
+            break;
+        }
+        // buffers[tail] is outside [head, head + filled), so the scan does
+        // not touch it while it is being filled
+        pthread_mutex_unlock(&reader->lock);
+        ssize_t n = grep_reader_fill(reader, reader->buffers[tail], GREP_READ_CHUNK);
+        pthread_mutex_lock(&reader->lock);
+
+        if (n < 0) {
+            reader->failed = true;
+        } else {
+            reader->lengths[tail] = (size_t)n;
+            reader->filled++;
+            tail = (tail + 1) % GREP_PREFETCH_DEPTH;
+        }
+        pthread_cond_broadcast(&reader->cond);
+        if (n <= 0) {
+            break;
+        }
+    }
+    pthread_mutex_unlock(&reader->lock);
+    return NULL;
+}
+
+// Free what grep_reader_detect set up
+static void grep_reader_close(GrepReader* reader) {
+    if (reader->compressed) {
+        inflateEnd(&reader->zstream);
+    }
+    free(reader->input);
+}
+
+// Start reading fd, inflating it as input says
+static bool grep_reader_start(GrepReader* reader, int fd, GrepInput input) {
+    reader->fd = fd;
+    reader->compressed = false;
+    reader->member_end = false;
+    reader->later_member = false;
+    reader->trailing = false;
+    reader->input = NULL;
+    reader->pending = 0;
+    reader->head = 0;
+    reader->filled = 0;
+    reader->failed = false;
+    reader->stop = false;
+    if (input != GREP_INPUT_PLAIN && !grep_reader_detect(reader, input)) {
+        return false;
+    }
+
+    struct stat st;
+    reader->threaded = fstat(fd, &st) == 0 && S_ISREG(st.st_mode) &&
+                       (reader->compressed || st.st_size > GREP_READ_CHUNK);
+    size_t depth = reader->threaded ? GREP_PREFETCH_DEPTH : 1;
+    for (size_t i = 0; i < GREP_PREFETCH_DEPTH; ++i) {
+        reader->buffers[i] = i < depth ? (char*)malloc(GREP_READ_CHUNK) : NULL;
+        if (i < depth && reader->buffers[i] == NULL) {
+            for (size_t j = 0; j < i; ++j) {
+                free(reader->buffers[j]);
+            }
+            grep_reader_close(reader);
+            return false;
+        }
+    }
+
+    if (reader->threaded) {
+        pthread_mutex_init(&reader->lock, NULL);
+        pthread_cond_init(&reader->cond, NULL);
+        if (pthread_create(&reader->thread, NULL, grep_reader_run, reader) != 0) {
+            // Read on demand instead
+            pthread_mutex_destroy(&reader->lock);
+            pthread_cond_destroy(&reader->cond);
+            reader->threaded = false;
+        }
+    }
+    return true;
+}
+
+// Next buffer in order, with its length in *len; NULL at EOF or on failure
+static const char* grep_reader_next(GrepReader* reader, size_t* len) {
+    if (!reader->threaded) {
+        ssize_t n = grep_reader_fill(reader, reader->buffers[0], GREP_READ_CHUNK);
+        reader->failed = n < 0;
+        *len = n > 0 ? (size_t)n : 0;
+        return n > 0 ? reader->buffers[0] : NULL;
+    }
+
+    pthread_mutex_lock(&reader->lock);
+    while (reader->filled == 0 && !reader->failed) {
+        pthread_cond_wait(&reader->cond, &reader->lock);
+    }
+    const char* buf = reader->filled > 0 ? reader->buffers[reader->head] : NULL;
+    *len = buf != NULL ? reader->lengths[reader->head] : 0;
+    pthread_mutex_unlock(&reader->lock);
+    return *len > 0 ? buf : NULL;
+}
+
+// Hand the buffer from grep_reader_next back to the reader
+static void grep_reader_release(GrepReader* reader) {
+    if (!reader->threaded) {
         return;
     }
-    
-    for (size_t i = 0; i < result->count; ++i) {
-        GrepMatch* match = &result->matches[i];
-        
-        if (match->filename != NULL) {
-            printf("%s", match->filename);
+
+    pthread_mutex_lock(&reader->lock);
+    reader->head = (reader->head + 1) % GREP_PREFETCH_DEPTH;
+    reader->filled--;
+    pthread_cond_broadcast(&reader->cond);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+// Stop the reader, which finishes at most the read it is in, and free the ring
+static void grep_reader_finish(GrepReader* reader) {
+    if (reader->threaded) {
+        pthread_mutex_lock(&reader->lock);
+        reader->stop = true;
+        pthread_cond_broadcast(&reader->cond);
+        pthread_mutex_unlock(&reader->lock);
+        pthread_join(reader->thread, NULL);
+        pthread_mutex_destroy(&reader->lock);
+        pthread_cond_destroy(&reader->cond);
+    }
+    for (size_t i = 0; i < GREP_PREFETCH_DEPTH; ++i) {
+        free(reader->buffers[i]);
+    }
+    grep_reader_close(reader);
+}
+
+// Append text[0, len) to the partial line in *carry
+static bool grep_carry_append(char** carry, size_t* carry_len, size_t* carry_capacity, const char* text,
+                              size_t len) {
+    if (*carry_len + len > *carry_capacity) {
+        size_t capacity = *carry_capacity == 0 ? 4096 : *carry_capacity;
+        while (capacity < *carry_len + len) {
+            capacity *= 2;
+        }
+        char* grown = (char*)realloc(*carry, capacity);
+        if (grown == NULL) {
+            return false;
         }
-        
-        if (match->line_number > 0) {
-            printf(":%d", match->line_number);
+        *carry = grown;
+        *carry_capacity = capacity;
+    }
+    memcpy(*carry + *carry_len, text, len);
+    *carry_len += len;
+    return true;
+}
+
+// Feed fd to scan one buffer at a time, each complete line as soon as it
+// has been read. The complete lines of a buffer are scanned in place; a
+// line cut by the buffer's end is copied out and completed from the next
+// one, so the only copying is one partial line per buffer. Reading stops as
+// soon as the scan is done. For input that is inflated, offsets and line
+// numbers are those of the decompressed stream. Returns 0, or -1 on a read,
+// decompression or allocation failure.
+static int grep_scan_fd(GrepScan* scan, int fd, GrepInput input) {
+    GrepReader reader;
+    if (!grep_reader_start(&reader, fd, input)) {
+        return -1;
+    }
+
+    char* carry = NULL;         // Partial line, starting at file offset carry_offset
+    size_t carry_len = 0, carry_capacity = 0, carry_offset = 0;
+    size_t offset = 0;          // File offset of the current buffer
+    bool ok = true;
+    const char* buf;
+    size_t len;
+
+    while (ok && !grep_scan_done(scan) && (buf = grep_reader_next(&reader, &len)) != NULL) {
+        if (offset == 0) {
+            grep_scan_probe(scan, buf, len);
         }
-        
-        if (match->line_content != NULL) {
-            printf(":%s", match->line_content);
+        const char* pos = buf;
+        const char* end = buf + len;
+
+        // Complete the carried line, or extend it if the buffer has no newline
+        if (carry_len > 0) {
+            const char* eol = grep_scan_byte(buf, len, '\n');
+            const char* take = eol != NULL ? eol + 1 : end;
+            ok = grep_carry_append(&carry, &carry_len, &carry_capacity, buf, (size_t)(take - buf));
+            if (ok && eol != NULL) {
+                scan->base = carry;
+                scan->base_offset = carry_offset;
+                grep_scan_buffer(scan, carry, carry + carry_len);
+                carry_len = 0;
+            }
+            pos = take;
         }
-        
-        printf("\n");
+
+        const char* last = pos < end ? (const char*)memrchr(pos, '\n', (size_t)(end - pos)) : NULL;
+        if (ok && last != NULL && !grep_scan_done(scan)) {
+            scan->base = buf;
+            scan->base_offset = offset;
+            grep_scan_buffer(scan, pos, last + 1);
+            pos = last + 1;
+        }
+        if (ok && pos < end) {
+            if (carry_len == 0) {
+                carry_offset = offset + (size_t)(pos - buf);
+            }
+            ok = grep_carry_append(&carry, &carry_len, &carry_capacity, pos, (size_t)(end - pos));
+        }
+
+        offset += len;
+        grep_reader_release(&reader);
+    }
+
+    // The reader thread may still be setting failed until it is joined
+    grep_reader_finish(&reader);
+    bool failed = reader.failed;
+
+    // The last line has no newline
+    if (ok && carry_len > 0 && !grep_scan_done(scan) && !failed) {
+        scan->base = carry;
+        scan->base_offset = carry_offset;
+        grep_scan_buffer(scan, carry, carry + carry_len);
+    }
+    free(carry);
+    return ok && !failed ? 0 : -1;
+}
+
+// Search one file or stdin through a ring of read() buffers, passing each
+// match to emit as soon as its line is complete
+int grep_search_stream(GrepOptions* opts, const char* filename, GrepMatchCallback emit, void* ctx) {
+    if (opts == NULL) {
+        return -1;
+    }
+
+    const GrepPattern* compiled = grep_options_pattern(opts);
+    if (compiled == NULL) {
+        return -1;
+    }
+
+    const char* name;
+    int fd = grep_open_input(filename, &name);
+    if (fd < 0) {
+        return -1;
+    }
+
+    GrepScan scan;
+    grep_scan_init(&scan, opts, compiled, name, NULL, emit != NULL ? emit : grep_print_emit, ctx);
+    int status = grep_scan_fd(&scan, fd, opts->decompress ? GREP_INPUT_DETECT : GREP_INPUT_PLAIN);
+    grep_close_input(fd);
+    if (emit == NULL) {
+        grep_writer_flush(grep_writer_stdout());
+    }
+    return status;
+}
+
+// Count selected lines without storing them, stopping once the answer is known
+long grep_count_file(GrepOptions* opts, const char* filename) {
+    if (opts == NULL) {
+        return -1;
+    }
+
+    const GrepPattern* compiled = grep_options_pattern(opts);
+    if (compiled == NULL) {
+        return -1;
+    }
+
+    const char* name;
+    int fd = grep_open_input(filename, &name);
+    if (fd < 0) {
+        return -1;
     }
+
+    GrepScan scan;
+    grep_scan_init(&scan, opts, compiled, name, NULL, grep_count_emit, NULL);
+    int status = grep_scan_fd(&scan, fd, opts->decompress ? GREP_INPUT_DETECT : GREP_INPUT_PLAIN);
+    grep_close_input(fd);
+    return status == 0 ? (long)scan.selected : -1;
+}
+
+// Print one match as filename:line_number:line
+void grep_print_match(const GrepMatch* match, const char* line) {
+    grep_writer_match(grep_writer_stdout(), match, line);
+}
+
+// Print search results
+void grep_print_results(GrepResult* result) {
+    if (result == NULL || result->matches == NULL) {
+        return;
+    }
+
+    GrepWriter* out = grep_writer_stdout();
+    grep_writer_result(out, result);
+    grep_writer_flush(out);
+}
+
+// Print a result in the output mode opts selects
+void grep_print_summary(const GrepOptions* opts, GrepResult* result) {
+    if (opts == NULL || result == NULL) {
+        return;
+    }
+
+    GrepWriter* out = grep_writer_stdout();
+    grep_writer_summary(out, opts, result);
+    grep_writer_flush(out);
+}
+
+// Start of a match's line (not NUL-terminated; see match->length)
+const char* grep_match_line(const GrepResult* result, const GrepMatch* match) {
+    return result->data + match->offset;
 }
 
 // Destroy GrepResult and free memory
@@ -109,17 +1507,10 @@ void grep_result_destroy(GrepResult* result) {
         return;
     }
     
-    if (result->matches != NULL) {
-        for (size_t i = 0; i < result->count; ++i) {
-            if (result->matches[i].filename != NULL) {
-                free(result->matches[i].filename);
-            }
-            if (result->matches[i].line_content != NULL) {
-                free(result->matches[i].line_content);
-            }
-        }
-        free(result->matches);
+    if (result->mapped) {
+        munmap((void*)result->data, result->data_len);
     }
-    
+
+    grep_arena_destroy(result->arena);
     free(result);
-}
\ No newline at end of file
+}
@@ -4,47 +4,190 @@
 #include <stdbool.h>
 #include <stdlib.h>
 
+// Compiled search pattern (see grep_pattern_compile)
+typedef struct GrepPattern GrepPattern;
+
+// Allocation arena owning a result's storage (see grep_arena.h)
+typedef struct GrepArena GrepArena;
+
+// How files holding a NUL byte are treated
+typedef enum {
+    GREP_BINARY_MATCHES,    // Default: report "Binary file X matches" instead of lines
+    GREP_BINARY_SKIP,       // -I: select nothing in them
+    GREP_BINARY_TEXT,       // -a: search them as text
+} GrepBinaryFiles;
+
 // GrepOptions structure to hold command-line options
 typedef struct {
     char* pattern;          // Search pattern
+    char** patterns;        // -e/-f patterns, searched together with pattern
+    size_t pattern_count;   // Number of -e/-f patterns
     bool recursive;         // -r flag: recursive search
     bool case_insensitive;  // -i flag: case-insensitive search
     bool line_number;       // -n flag: print line numbers
     bool invert_match;      // -v flag: invert match
+    bool extended;          // -E flag: patterns are extended regular expressions
+    bool count;             // -c flag: print only the number of selected lines
+    bool files_with_matches;    // -l flag: print only the names of files with a selected line
+    bool files_without_match;   // -L flag: print only the names of files without one
+    bool quiet;             // -q flag: print nothing; stop at the first selected line
+    long max_count;         // -m flag: stop a file after this many selected lines (-1: no limit)
+    GrepBinaryFiles binary_files;   // Treatment of binary files (-I, -a)
+    char** excludes;        // --exclude globs; walks skip files whose name matches one
+    size_t exclude_count;   // Number of --exclude globs
+    size_t max_file_size;   // Walks skip files larger than this (0: no limit)
+    bool physical_order;    // Walks read files in on-disk order (see grep_search_paths)
+    bool decompress;        // Search gzip files (told by their magic bytes) decompressed, as zgrep
     char** paths;           // Paths to search (can be multiple)
     size_t path_count;      // Number of paths
+    int threads;            // Worker threads for grep_search_paths (0: one per CPU)
+    GrepPattern* compiled;  // Pattern compiled for the current pattern/-i (owned)
 } GrepOptions;
 
 // GrepMatch structure to hold a single match
 typedef struct {
-    char* filename;     // File where match was found
-    int line_number;    // Line number (if -n flag is used)
-    char* line_content; // Content of the matching line
+    const char* filename; // File where match was found (shared, owned by the result)
+    int line_number;      // Line number (if -n flag is used)
+    bool binary;          // Line is from a binary file: report the file, not the line
+    size_t offset;        // Start of the matching line in the result's data
+    size_t length;        // Length of the line, without its newline
 } GrepMatch;
 
-// GrepResult structure to hold all matches
+// GrepResult structure to hold all matches. Matches point into data, the
+// file's contents: an mmap of a regular file, or a buffer filled by read()
+// for pipes and files that cannot be mapped. Everything but the mapping is
+// allocated from arena and released with it. In the summary modes (-c, -l,
+// -L, -q) only filename and count are set: matches and data are NULL. For a
+// file searched decompressed (opts->decompress), data is in arena and holds
+// just the selected lines, back to back without newlines.
 typedef struct {
-    GrepMatch* matches;  // Array of matches
-    size_t count;        // Number of matches
+    GrepMatch* matches;  // Array of matches (in arena)
+    size_t count;        // Number of matches (selected lines)
     size_t capacity;     // Capacity of matches array
+    char* filename;      // File the matches came from (in arena)
+    const char* data;    // File contents the matches refer to
+    size_t data_len;     // Length of data
+    bool mapped;         // data is an mmap (munmap) rather than in arena
+    GrepArena* arena;    // Owns matches, filename and read() data
 } GrepResult;
 
 // Function declarations
 
+// Create GrepOptions with every flag off and no pattern or paths
+GrepOptions* grep_options_create(void);
+
 // Destroy GrepOptions and free memory
 void grep_options_destroy(GrepOptions* opts);
 
-// NOTE: To be implemented in grep.c
-// Search for pattern in a single file
+// Add a pattern (-e); a line matches if it contains any pattern
+bool grep_options_add_pattern(GrepOptions* opts, const char* pattern);
+
+// Add each line of a file as a pattern (-f)
+bool grep_options_load_patterns(GrepOptions* opts, const char* filename);
+
+// Add an --exclude glob (fnmatch syntax, e.g. "*.o"), matched against the
+// names of files found while walking directories
+bool grep_options_add_exclude(GrepOptions* opts, const char* glob);
+
+// Search for pattern in a single file, collecting every match, or at most
+// opts->max_count of them. Files of 16 MiB or more are split into
+// newline-aligned chunks searched on opts->threads threads; the result is
+// the same as a sequential search. In the summary modes (-c, -l, -L, -q) the
+// result only holds the count from grep_count_file.
+//
+// A file with a NUL byte in its first 32 KiB is binary. By default the
+// search of a binary file stops at its first selected line, which is
+// flagged match->binary; with GREP_BINARY_SKIP nothing in it is selected.
+// This applies to every search function.
 GrepResult* grep_search_file(GrepOptions* opts, const char* filename);
 
-// Print search results
+// Number of lines selected in filename (stdin when NULL or "-"), without
+// storing any of them. Reading stops at opts->max_count lines, or at the
+// first one with -l, -L or -q, since the answer is then known. Returns -1
+// if the input could not be read.
+long grep_count_file(GrepOptions* opts, const char* filename);
+
+// Receives each selected line in file order; line is the line's text
+// (match->length bytes, not NUL-terminated). Both match and line are only
+// valid during the call. Return false to stop the search.
+typedef bool (*GrepMatchCallback)(const GrepMatch* match, const char* line, void* ctx);
+
+// Search filename, or stdin when filename is NULL or "-" (reported as
+// "(standard input)"), calling emit for each match as soon as its line has
+// been read. Input is read through a fixed ring of buffers, filled ahead of
+// the scan by a reader thread for large regular files; only a line longer
+// than a buffer needs more, so memory does not depend on the input size or
+// the number of matches. match->offset is the line's offset in the input.
+// emit == NULL prints each match. Returns 0, or -1 if the input could not
+// be read.
+int grep_search_stream(GrepOptions* opts, const char* filename, GrepMatchCallback emit, void* ctx);
+
+// Print one match as filename:line_number:line, or as "Binary file
+// filename matches" for a match in a binary file. Output goes through the
+// buffered stdout writer (grep_output.h) and may not appear until the next
+// grep_print_results or grep_print_summary, or exit.
+void grep_print_match(const GrepMatch* match, const char* line);
+
+// Print search results and flush stdout
 void grep_print_results(GrepResult* result);
 
+// Print a result the way opts's mode asks for: nothing with -q, the filename
+// with -l or -L when it qualifies, filename:count with -c, and otherwise
+// every match as grep_print_results does
+void grep_print_summary(const GrepOptions* opts, GrepResult* result);
+
+// Start of a match's line (not NUL-terminated; see match->length)
+const char* grep_match_line(const GrepResult* result, const GrepMatch* match);
+
 // Destroy GrepResult and free memory
 void grep_result_destroy(GrepResult* result);
 
-// Pattern matching function
+// Receives each file's result and takes ownership of it
+typedef void (*GrepResultCallback)(GrepResult* result, void* ctx);
+
+// Search every path in opts, descending into directories with -r. Files are
+// searched in parallel by opts->threads workers that steal directory and
+// file tasks from each other, but emit sees the results in the order a
+// sequential run would produce: paths in the given order, directory entries
+// sorted by name, depth first. emit == NULL prints each result with
+// grep_print_summary and destroys it. With opts->physical_order the whole
+// tree is listed first and files are read in order of where their data lies
+// on disk, which saves seeks on rotating disks and cold caches; output order
+// is unchanged. With -q the walk stops once any file
+// has a selected line. Returns 0, or -1 if any path could not be read
+// (reported on stderr); with -q, a selected line makes the run succeed
+// regardless, and 1 means no line was selected.
+int grep_search_paths(GrepOptions* opts, GrepResultCallback emit, void* ctx);
+
+// Pattern matching function (compiles the pattern on every call; use
+// grep_pattern_compile to match many lines)
 bool grep_match_pattern(const char* pattern, const char* text, bool case_insensitive);
 
+// Compile pattern once: case-folded copy plus a Horspool skip table. Searches
+// run the vector kernels in grep_scan.h and fall back to Horspool on CPUs
+// without them
+GrepPattern* grep_pattern_compile(const char* pattern, bool case_insensitive);
+
+// Compile several patterns into one Aho-Corasick automaton (grep_ac.h), so a
+// search makes one pass however many patterns there are. A single pattern
+// compiles as in grep_pattern_compile.
+GrepPattern* grep_pattern_compile_set(const char* const* patterns, size_t count, bool case_insensitive);
+
+// Compile extended regular expressions (grep_regex.h), matched as their
+// alternation. On a syntax error returns NULL and sets *error if given.
+GrepPattern* grep_pattern_compile_regex(const char* const* patterns, size_t count, bool case_insensitive,
+                                        const char** error);
+
+// Destroy a compiled pattern
+void grep_pattern_destroy(GrepPattern* compiled);
+
+// First occurrence of the pattern in text[0, len), or NULL. For a set, the
+// first occurrence of any pattern to end; for a regex, a position inside the
+// first matching line (text must start at a line start).
+const char* grep_pattern_search(const GrepPattern* compiled, const char* text, size_t len);
+
+// Compiled form of opts->pattern and the -e/-f patterns, rebuilt only when
+// they, -i or -E change. An invalid regex is reported on stderr.
+const GrepPattern* grep_options_pattern(GrepOptions* opts);
+
 #endif  // GREP_H
\ No newline at end of file
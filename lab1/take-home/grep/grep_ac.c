@@ -0,0 +1,159 @@
+#include "grep_ac.h"
+#include "grep_scan.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GREP_AC_ACCEPT 0x80000000u
+
+struct GrepAc {
+    uint16_t classes[256];      // Byte -> column
+    size_t class_count;
+    uint32_t* delta;            // state_count rows of class_count entries
+    size_t state_count;
+    uint32_t* match_len;        // Per state: length of a pattern ending there, or 0
+};
+
+// Build the automaton for count non-empty patterns
+GrepAc* grep_ac_create(const char* const* patterns, size_t count, bool case_insensitive) {
+    GrepAc* ac = (GrepAc*)calloc(1, sizeof(GrepAc));
+    if (ac == NULL) {
+        return NULL;
+    }
+
+    // Column per distinct (folded) byte; case variants share a column
+    size_t total = 0;
+    ac->class_count = 1;
+    for (size_t i = 0; i < count; ++i) {
+        for (const unsigned char* p = (const unsigned char*)patterns[i]; *p != '\0'; ++p) {
+            unsigned char c = case_insensitive ? grep_scan_fold(*p) : *p;
+            if (ac->classes[c] == 0) {
+                ac->classes[c] = (uint16_t)ac->class_count++;
+            }
+            total++;
+        }
+    }
+    if (case_insensitive) {
+        for (int c = 'A'; c <= 'Z'; ++c) {
+            ac->classes[c] = ac->classes[grep_scan_fold((unsigned char)c)];
+        }
+    }
+
+    // At most one state per pattern byte plus the root
+    size_t width = ac->class_count;
+    size_t max_states = total + 1;
+    if (max_states > (GREP_AC_ACCEPT - 1) / width) {
+        // Row offsets would not fit below the accept bit
+        grep_ac_destroy(ac);
+        return NULL;
+    }
+    int32_t* trie = (int32_t*)malloc(max_states * width * sizeof(int32_t));
+    uint32_t* depth = (uint32_t*)calloc(max_states, sizeof(uint32_t));
+    uint32_t* fail = (uint32_t*)calloc(max_states, sizeof(uint32_t));
+    uint32_t* queue = (uint32_t*)malloc(max_states * sizeof(uint32_t));
+    ac->match_len = (uint32_t*)calloc(max_states, sizeof(uint32_t));
+    if (trie == NULL || depth == NULL || fail == NULL || queue == NULL || ac->match_len == NULL) {
+        free(trie);
+        free(depth);
+        free(fail);
+        free(queue);
+        grep_ac_destroy(ac);
+        return NULL;
+    }
+
+    // Trie; -1 marks a missing edge
+    memset(trie, 0xff, width * sizeof(int32_t));
+    ac->state_count = 1;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t state = 0;
+        for (const unsigned char* p = (const unsigned char*)patterns[i]; *p != '\0'; ++p) {
+            int32_t* edge = &trie[state * width + ac->classes[*p]];
+            if (*edge < 0) {
+                uint32_t next = (uint32_t)ac->state_count++;
+                memset(&trie[next * width], 0xff, width * sizeof(int32_t));
+                depth[next] = depth[state] + 1;
+                *edge = (int32_t)next;
+            }
+            state = (uint32_t)*edge;
+        }
+        ac->match_len[state] = depth[state];
+    }
+
+    // Breadth first, so a state's failure target is complete before it:
+    // missing edges take the failure target's edge, and a state ends a
+    // pattern if its failure target does
+    size_t head = 0, tail = 0;
+    for (size_t c = 0; c < width; ++c) {
+        if (trie[c] < 0) {
+            trie[c] = 0;
+        } else {
+            fail[trie[c]] = 0;
+            queue[tail++] = (uint32_t)trie[c];
+        }
+    }
+    while (head < tail) {
+        uint32_t state = queue[head++];
+        if (ac->match_len[state] == 0) {
+            ac->match_len[state] = ac->match_len[fail[state]];
+        }
+        for (size_t c = 0; c < width; ++c) {
+            int32_t* edge = &trie[state * width + c];
+            int32_t via_fail = trie[fail[state] * width + c];
+            if (*edge < 0) {
+                *edge = via_fail;
+            } else {
+                fail[*edge] = (uint32_t)via_fail;
+                queue[tail++] = (uint32_t)*edge;
+            }
+        }
+    }
+
+    // Shared prefixes leave the table shorter than the bound it was sized for
+    int32_t* shrunk = (int32_t*)realloc(trie, ac->state_count * width * sizeof(int32_t));
+    if (shrunk != NULL) {
+        trie = shrunk;
+    }
+
+    // Store row offsets with the accept bit, so the search loop has no
+    // multiply and tests acceptance on the value it already loaded
+    ac->delta = (uint32_t*)trie;
+    for (size_t i = 0; i < ac->state_count * width; ++i) {
+        uint32_t target = (uint32_t)trie[i];
+        ac->delta[i] = target * (uint32_t)width | (ac->match_len[target] != 0 ? GREP_AC_ACCEPT : 0);
+    }
+
+    free(depth);
+    free(fail);
+    free(queue);
+    return ac;
+}
+
+// Destroy the automaton
+void grep_ac_destroy(GrepAc* ac) {
+    if (ac == NULL) {
+        return;
+    }
+
+    free(ac->delta);
+    free(ac->match_len);
+    free(ac);
+}
+
+// Start of the first match to end in text[0, len), or NULL
+const char* grep_ac_search(const GrepAc* ac, const char* text, size_t len) {
+    const unsigned char* t = (const unsigned char*)text;
+    const uint32_t* delta = ac->delta;
+    const uint16_t* classes = ac->classes;
+    uint32_t row = 0;
+
+    for (size_t i = 0; i < len; ++i) {
+        uint32_t next = delta[row + classes[t[i]]];
+        if (next & GREP_AC_ACCEPT) {
+            row = next & ~GREP_AC_ACCEPT;
+            return text + i + 1 - ac->match_len[row / ac->class_count];
+        }
+        row = next;
+    }
+    return NULL;
+}
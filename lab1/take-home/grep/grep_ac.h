@@ -0,0 +1,28 @@
+#ifndef GREP_AC_H
+#define GREP_AC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Aho-Corasick automaton for searching many literals in one pass.
+//
+// The trie's failure links are folded into a complete transition table, so
+// each text byte costs one table load. Bytes are first mapped to classes:
+// every byte that occurs in some pattern gets its own class and all other
+// bytes share class 0, so a row is only as wide as the patterns' alphabet
+// and the whole table stays small enough to live in cache for typical
+// keyword lists. Entries hold the target row's offset with the top bit set
+// when the target state ends a pattern.
+
+typedef struct GrepAc GrepAc;
+
+// Build the automaton for count non-empty patterns; NULL on allocation failure
+GrepAc* grep_ac_create(const char* const* patterns, size_t count, bool case_insensitive);
+
+// Destroy the automaton
+void grep_ac_destroy(GrepAc* ac);
+
+// Start of the first match to end in text[0, len), or NULL
+const char* grep_ac_search(const GrepAc* ac, const char* text, size_t len);
+
+#endif // GREP_AC_H
@@ -0,0 +1,159 @@
+#include "grep_arena.h"
+
+#include <stdalign.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define GREP_ARENA_ALIGN alignof(max_align_t)
+
+typedef struct GrepArenaChunk {
+    struct GrepArenaChunk* next;
+    size_t size;                // Usable bytes in data
+    size_t used;
+    bool own;                   // Holds one oversized allocation, resized with realloc
+    alignas(max_align_t) char data[];
+} GrepArenaChunk;
+
+struct GrepArena {
+    GrepArenaChunk* chunks;     // Current chunk first, unless it is an own chunk
+    size_t chunk_size;
+    char* last;                 // Most recent allocation in chunks, for in-place growth
+};
+
+static size_t align_up(size_t n) {
+    return (n + GREP_ARENA_ALIGN - 1) & ~(size_t)(GREP_ARENA_ALIGN - 1);
+}
+
+// Create an arena whose chunks hold at least chunk_size bytes
+GrepArena* grep_arena_create(size_t chunk_size) {
+    GrepArena* arena = (GrepArena*)malloc(sizeof(GrepArena));
+    if (arena == NULL) {
+        return NULL;
+    }
+
+    arena->chunks = NULL;
+    arena->chunk_size = chunk_size;
+    arena->last = NULL;
+
+    return arena;
+}
+
+// Destroy the arena and everything allocated from it
+void grep_arena_destroy(GrepArena* arena) {
+    if (arena == NULL) {
+        return;
+    }
+
+    GrepArenaChunk* chunk = arena->chunks;
+    while (chunk != NULL) {
+        GrepArenaChunk* next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+
+    free(arena);
+}
+
+// True if a request of size bytes gets a chunk of its own
+static bool grep_arena_oversized(const GrepArena* arena, size_t size) {
+    return size > arena->chunk_size / 4;
+}
+
+// Link to the own chunk holding ptr, or NULL if ptr is in a shared chunk
+static GrepArenaChunk** grep_arena_find_own(GrepArena* arena, const void* ptr) {
+    for (GrepArenaChunk** link = &arena->chunks; *link != NULL; link = &(*link)->next) {
+        if ((*link)->own && (*link)->data == (const char*)ptr) {
+            return link;
+        }
+    }
+    return NULL;
+}
+
+// Allocate size bytes, aligned for any type; NULL when out of memory
+void* grep_arena_alloc(GrepArena* arena, size_t size) {
+    size = align_up(size == 0 ? 1 : size);
+
+    // An oversized request gets a chunk of its own, linked behind the
+    // current chunk so small requests keep filling that
+    if (grep_arena_oversized(arena, size)) {
+        GrepArenaChunk* chunk = (GrepArenaChunk*)malloc(sizeof(GrepArenaChunk) + size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->size = size;
+        chunk->used = size;
+        chunk->own = true;
+        GrepArenaChunk** link = arena->chunks != NULL ? &arena->chunks->next : &arena->chunks;
+        chunk->next = *link;
+        *link = chunk;
+        return chunk->data;
+    }
+
+    // The current chunk's tail is abandoned only when a small request does
+    // not fit in it, which wastes less than a quarter chunk
+    GrepArenaChunk* chunk = arena->chunks;
+    if (chunk == NULL || chunk->own || chunk->size - chunk->used < size) {
+        chunk = (GrepArenaChunk*)malloc(sizeof(GrepArenaChunk) + arena->chunk_size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->size = arena->chunk_size;
+        chunk->used = 0;
+        chunk->own = false;
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+    }
+
+    char* ptr = chunk->data + chunk->used;
+    chunk->used += size;
+    arena->last = ptr;
+    return ptr;
+}
+
+// Resize an allocation, keeping its first min(old_size, new_size) bytes
+void* grep_arena_grow(GrepArena* arena, void* ptr, size_t old_size, size_t new_size) {
+    if (ptr == NULL) {
+        return grep_arena_alloc(arena, new_size);
+    }
+
+    // An own chunk is resized in place, so the old space is released
+    GrepArenaChunk** link = grep_arena_find_own(arena, ptr);
+    size_t size = align_up(new_size == 0 ? 1 : new_size);
+    if (link != NULL && grep_arena_oversized(arena, size)) {
+        GrepArenaChunk* chunk = (GrepArenaChunk*)realloc(*link, sizeof(GrepArenaChunk) + size);
+        if (chunk == NULL) {
+            return NULL;
+        }
+        chunk->size = size;
+        chunk->used = size;
+        *link = chunk;
+        return chunk->data;
+    }
+
+    GrepArenaChunk* chunk = arena->chunks;
+    if (link == NULL && ptr == arena->last) {
+        size_t start = (size_t)((char*)ptr - chunk->data);
+        if (size <= chunk->size - start) {
+            chunk->used = start + size;
+            return ptr;
+        }
+    }
+
+    void* grown = grep_arena_alloc(arena, new_size);
+    if (grown == NULL) {
+        return NULL;
+    }
+    memcpy(grown, ptr, old_size < new_size ? old_size : new_size);
+    return grown;
+}
+
+// Copy of s in the arena
+char* grep_arena_strdup(GrepArena* arena, const char* s) {
+    size_t len = strlen(s) + 1;
+    char* copy = (char*)grep_arena_alloc(arena, len);
+    if (copy != NULL) {
+        memcpy(copy, s, len);
+    }
+    return copy;
+}
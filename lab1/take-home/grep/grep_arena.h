@@ -0,0 +1,31 @@
+#ifndef GREP_ARENA_H
+#define GREP_ARENA_H
+
+#include <stddef.h>
+
+// Bump allocator backing a GrepResult: the match array, the interned
+// filename and read() buffers all come from a few large chunks, and
+// grep_arena_destroy releases them together instead of one free per object.
+
+typedef struct GrepArena GrepArena;
+
+// Create an arena whose chunks hold at least chunk_size bytes
+GrepArena* grep_arena_create(size_t chunk_size);
+
+// Destroy the arena and everything allocated from it
+void grep_arena_destroy(GrepArena* arena);
+
+// Allocate size bytes, aligned for any type; NULL when out of memory
+void* grep_arena_alloc(GrepArena* arena, size_t size);
+
+// Resize an allocation, keeping its first min(old_size, new_size) bytes.
+// Allocations over a quarter of chunk_size live in a chunk of their own,
+// which is resized with realloc, so the old space is freed at once. Of the
+// rest, the most recent allocation grows in place while its chunk has room,
+// and anything else is copied, the old space being reclaimed with the arena.
+void* grep_arena_grow(GrepArena* arena, void* ptr, size_t old_size, size_t new_size);
+
+// Copy of s in the arena
+char* grep_arena_strdup(GrepArena* arena, const char* s);
+
+#endif // GREP_ARENA_H
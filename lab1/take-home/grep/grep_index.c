@@ -0,0 +1,846 @@
+#define _GNU_SOURCE
+
+#include "grep_index.h"
+#include "grep_internal.h"
+#include "grep_scan.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define GREP_INDEX_MAGIC "GREPIDX2"
+
+// Trigrams are three bytes, so the set of trigrams seen in a file is a
+// bitmap of 2^24 bits
+#define GREP_INDEX_TRIGRAMS (1u << 24)
+
+// Marks an old file that is not reused
+#define GREP_INDEX_NONE UINT32_MAX
+
+typedef struct {
+    char magic[8];              // GREP_INDEX_MAGIC
+    uint64_t file_count;
+    uint64_t trigram_count;
+    uint64_t files_offset;      // GrepIndexFile[file_count]
+    uint64_t names_offset;      // NUL-terminated paths, relative to the index's directory
+    uint64_t names_len;
+    uint64_t trigrams_offset;   // GrepIndexTrigram[trigram_count], ascending
+    uint64_t postings_offset;   // Varint-coded posting lists
+    uint64_t size;              // Whole file, to detect truncation
+} GrepIndexHeader;
+
+typedef struct {
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t name;              // Offset of the path in the names
+} GrepIndexFile;
+
+typedef struct {
+    uint32_t trigram;
+    uint32_t count;             // Files in the posting list
+    uint64_t offset;            // Start of the posting list in the postings
+} GrepIndexTrigram;
+
+struct GrepIndex {
+    char* dir;                  // Directory of the index file as opened, or NULL for "."
+    const char* map;
+    size_t size;
+    const GrepIndexHeader* header;
+    const GrepIndexFile* files;
+    const char* names;
+    const GrepIndexTrigram* trigrams;
+    const unsigned char* postings;
+    size_t postings_len;
+};
+
+// Growable array of (trigram << 32 | file) pairs
+typedef struct {
+    uint64_t* keys;
+    size_t count, capacity;
+} GrepIndexPairs;
+
+// Growable array of paths
+typedef struct {
+    char** paths;
+    size_t count, capacity;
+} GrepIndexPaths;
+
+static bool grep_index_pairs_push(GrepIndexPairs* pairs, uint64_t key) {
+    if (pairs->count == pairs->capacity) {
+        size_t capacity = pairs->capacity == 0 ? 4096 : pairs->capacity * 2;
+        uint64_t* keys = (uint64_t*)realloc(pairs->keys, capacity * sizeof(uint64_t));
+        if (keys == NULL) {
+            return false;
+        }
+        pairs->keys = keys;
+        pairs->capacity = capacity;
+    }
+    pairs->keys[pairs->count++] = key;
+    return true;
+}
+
+static bool grep_index_paths_push(GrepIndexPaths* list, char* path) {
+    if (list->count == list->capacity) {
+        size_t capacity = list->capacity == 0 ? 256 : list->capacity * 2;
+        char** paths = (char**)realloc(list->paths, capacity * sizeof(char*));
+        if (paths == NULL) {
+            free(path);
+            return false;
+        }
+        list->paths = paths;
+        list->capacity = capacity;
+    }
+    list->paths[list->count++] = path;
+    return true;
+}
+
+static char* grep_index_join(const char* dir, const char* name) {
+    size_t dir_len = strlen(dir);
+    bool slash = dir_len > 0 && dir[dir_len - 1] != '/';
+    char* path = (char*)malloc(dir_len + slash + strlen(name) + 1);
+    if (path != NULL) {
+        sprintf(path, slash ? "%s/%s" : "%s%s", dir, name);
+    }
+    return path;
+}
+
+// Add every regular file under the directory path to list, not following
+// symbolic links
+static bool grep_index_collect(GrepIndexPaths* list, const char* path) {
+    DIR* dir = opendir(path);
+    if (dir == NULL) {
+        fprintf(stderr, "grep: %s: %s\n", path, strerror(errno));
+        return true;
+    }
+
+    bool ok = true;
+    struct dirent* entry;
+    while (ok && (entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        char* child = grep_index_join(path, entry->d_name);
+        if (child == NULL) {
+            ok = false;
+            break;
+        }
+
+        unsigned char type = entry->d_type;
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            type = lstat(child, &st) != 0 ? DT_UNKNOWN
+                 : S_ISDIR(st.st_mode)    ? DT_DIR
+                 : S_ISREG(st.st_mode)    ? DT_REG
+                                          : DT_UNKNOWN;
+        }
+        if (type == DT_DIR) {
+            ok = grep_index_collect(list, child);
+            free(child);
+        } else if (type == DT_REG) {
+            ok = grep_index_paths_push(list, child);
+        } else {
+            free(child);
+        }
+    }
+    closedir(dir);
+    return ok;
+}
+
+// Directory part of path: "." if it has none
+static char* grep_index_dirname(const char* path) {
+    const char* slash = strrchr(path, '/');
+    if (slash == NULL) {
+        return strdup(".");
+    }
+    size_t len = slash == path ? 1 : (size_t)(slash - path);
+    char* dir = (char*)malloc(len + 1);
+    if (dir != NULL) {
+        memcpy(dir, path, len);
+        dir[len] = '\0';
+    }
+    return dir;
+}
+
+// path relative to the directory base; both are absolute and canonical
+static char* grep_index_relative(const char* base, const char* path) {
+    // Skip the components the two share
+    size_t i = 0, common = 0;
+    while (base[i] != '\0' && base[i] == path[i]) {
+        if (base[i] == '/') {
+            common = i + 1;
+        }
+        i++;
+    }
+    if (base[i] == '\0' && path[i] == '/') {
+        return strdup(path + i + 1);
+    }
+
+    // One ".." for each of base's remaining components
+    size_t ups = base[common] != '\0';
+    for (const char* p = base + common; *p != '\0'; ++p) {
+        ups += *p == '/';
+    }
+    const char* rest = path + common;
+    char* relative = (char*)malloc(ups * 3 + strlen(rest) + 1);
+    if (relative != NULL) {
+        for (size_t j = 0; j < ups; ++j) {
+            memcpy(relative + j * 3, "../", 3);
+        }
+        strcpy(relative + ups * 3, rest);
+    }
+    return relative;
+}
+
+static int grep_index_compare_paths(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+// Add the distinct folded trigrams of file to pairs. seen is an all-zero
+// GREP_INDEX_TRIGRAMS-bit set, and is all zero again on return.
+static bool grep_index_scan_file(GrepIndexPairs* pairs, uint64_t* seen, uint32_t file, const char* path,
+                                 const struct stat* st) {
+    if (st->st_size == 0) {
+        return true;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fprintf(stderr, "grep: %s: %s\n", path, strerror(errno));
+        return true;
+    }
+    size_t len = (size_t)st->st_size;
+    const unsigned char* data = (const unsigned char*)mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "grep: %s: %s\n", path, strerror(errno));
+        return true;
+    }
+    madvise((void*)data, len, MADV_SEQUENTIAL);
+
+    size_t first = pairs->count;
+    bool ok = true;
+    uint32_t trigram = 0;
+    for (size_t i = 0; ok && i < len; ++i) {
+        trigram = ((trigram << 8) | grep_scan_fold(data[i])) & (GREP_INDEX_TRIGRAMS - 1);
+        if (i >= 2 && !((seen[trigram >> 6] >> (trigram & 63)) & 1)) {
+            seen[trigram >> 6] |= 1ull << (trigram & 63);
+            ok = grep_index_pairs_push(pairs, (uint64_t)trigram << 32 | file);
+        }
+    }
+    munmap((void*)data, len);
+
+    for (size_t i = first; i < pairs->count; ++i) {
+        uint32_t t = (uint32_t)(pairs->keys[i] >> 32);
+        seen[t >> 6] = 0;
+    }
+    return ok;
+}
+
+// Sort keys by trigram, then file: a stable radix sort on 16-bit digits,
+// skipping the file number's high digit when every file number fits below it
+static bool grep_index_sort(GrepIndexPairs* pairs, size_t file_count) {
+    if (pairs->count == 0) {
+        return true;
+    }
+    uint64_t* tmp = (uint64_t*)malloc(pairs->count * sizeof(uint64_t));
+    size_t* counts = (size_t*)malloc(65536 * sizeof(size_t));
+    if (tmp == NULL || counts == NULL) {
+        free(tmp);
+        free(counts);
+        return false;
+    }
+
+    uint64_t* from = pairs->keys;
+    uint64_t* to = tmp;
+    for (unsigned shift = 0; shift < 64; shift += 16) {
+        if (shift == 16 && file_count <= 65536) {
+            continue;
+        }
+        memset(counts, 0, 65536 * sizeof(size_t));
+        for (size_t i = 0; i < pairs->count; ++i) {
+            counts[(from[i] >> shift) & 0xffff]++;
+        }
+        size_t sum = 0;
+        for (size_t d = 0; d < 65536; ++d) {
+            size_t n = counts[d];
+            counts[d] = sum;
+            sum += n;
+        }
+        for (size_t i = 0; i < pairs->count; ++i) {
+            to[counts[(from[i] >> shift) & 0xffff]++] = from[i];
+        }
+        uint64_t* swap = from;
+        from = to;
+        to = swap;
+    }
+
+    if (from != pairs->keys) {
+        memcpy(pairs->keys, from, pairs->count * sizeof(uint64_t));
+    }
+    free(tmp);
+    free(counts);
+    return true;
+}
+
+// Read a varint at *pos, which must stay below end
+static bool grep_index_varint(const unsigned char** pos, const unsigned char* end, uint32_t* value) {
+    uint32_t result = 0;
+    for (unsigned shift = 0; shift < 35; shift += 7) {
+        if (*pos >= end) {
+            return false;
+        }
+        unsigned char byte = *(*pos)++;
+        result |= (uint32_t)(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Decode the posting list of entry into files[0, entry->count)
+static bool grep_index_decode(const GrepIndex* index, const GrepIndexTrigram* entry, uint32_t* files) {
+    if (entry->offset > index->postings_len) {
+        return false;
+    }
+    const unsigned char* pos = index->postings + entry->offset;
+    const unsigned char* end = index->postings + index->postings_len;
+    uint32_t file = 0;
+    for (uint32_t i = 0; i < entry->count; ++i) {
+        uint32_t delta;
+        if (!grep_index_varint(&pos, end, &delta)) {
+            return false;
+        }
+        file += delta;
+        if (file >= index->header->file_count) {
+            return false;
+        }
+        files[i] = file;
+    }
+    return true;
+}
+
+// Append value to buf as a varint
+static bool grep_index_put_varint(unsigned char** buf, size_t* len, size_t* capacity, uint32_t value) {
+    if (*len + 5 > *capacity) {
+        size_t grown_capacity = *capacity == 0 ? 65536 : *capacity * 2;
+        unsigned char* grown = (unsigned char*)realloc(*buf, grown_capacity);
+        if (grown == NULL) {
+            return false;
+        }
+        *buf = grown;
+        *capacity = grown_capacity;
+    }
+    while (value >= 0x80) {
+        (*buf)[(*len)++] = (unsigned char)(value | 0x80);
+        value >>= 7;
+    }
+    (*buf)[(*len)++] = (unsigned char)value;
+    return true;
+}
+
+// Index of path among old's files, or GREP_INDEX_NONE
+static uint32_t grep_index_find_file(const GrepIndex* old, const char* path) {
+    size_t lo = 0, hi = old->header->file_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int order = strcmp(old->names + old->files[mid].name, path);
+        if (order == 0) {
+            return (uint32_t)mid;
+        }
+        if (order < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return GREP_INDEX_NONE;
+}
+
+// Write the trigram table and postings for sorted pairs, then the whole
+// index, to a temporary file renamed over index_path
+static bool grep_index_write(const char* index_path, const GrepIndexPaths* list, const GrepIndexFile* files,
+                             const GrepIndexPairs* pairs) {
+    GrepIndexTrigram* trigrams = NULL;
+    size_t trigram_count = 0, trigram_capacity = 0;
+    unsigned char* postings = NULL;
+    size_t postings_len = 0, postings_capacity = 0;
+    bool ok = true;
+
+    for (size_t i = 0; ok && i < pairs->count;) {
+        uint32_t trigram = (uint32_t)(pairs->keys[i] >> 32);
+        if (trigram_count == trigram_capacity) {
+            trigram_capacity = trigram_capacity == 0 ? 4096 : trigram_capacity * 2;
+            GrepIndexTrigram* grown =
+                (GrepIndexTrigram*)realloc(trigrams, trigram_capacity * sizeof(GrepIndexTrigram));
+            if (grown == NULL) {
+                ok = false;
+                break;
+            }
+            trigrams = grown;
+        }
+        GrepIndexTrigram* entry = &trigrams[trigram_count++];
+        entry->trigram = trigram;
+        entry->count = 0;
+        entry->offset = postings_len;
+
+        uint32_t previous = 0;
+        for (; ok && i < pairs->count && (uint32_t)(pairs->keys[i] >> 32) == trigram; ++i) {
+            uint32_t file = (uint32_t)pairs->keys[i];
+            ok = grep_index_put_varint(&postings, &postings_len, &postings_capacity, file - previous);
+            previous = file;
+            entry->count++;
+        }
+    }
+
+    GrepIndexHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, GREP_INDEX_MAGIC, sizeof(header.magic));
+    header.file_count = list->count;
+    header.trigram_count = trigram_count;
+    header.files_offset = sizeof(GrepIndexHeader);
+    header.names_offset = header.files_offset + list->count * sizeof(GrepIndexFile);
+    for (size_t i = 0; i < list->count; ++i) {
+        header.names_len += strlen(list->paths[i]) + 1;
+    }
+    header.trigrams_offset = (header.names_offset + header.names_len + 7) & ~(uint64_t)7;
+    header.postings_offset = header.trigrams_offset + trigram_count * sizeof(GrepIndexTrigram);
+    header.size = header.postings_offset + postings_len;
+
+    size_t tmp_len = strlen(index_path) + 5;
+    char* tmp_path = (char*)malloc(tmp_len);
+    FILE* out = NULL;
+    if (ok && tmp_path != NULL) {
+        snprintf(tmp_path, tmp_len, "%s.tmp", index_path);
+        out = fopen(tmp_path, "wb");
+    }
+    ok = ok && out != NULL;
+
+    if (ok) {
+        static const char padding[8];
+        ok = fwrite(&header, sizeof(header), 1, out) == 1;
+        ok = ok && (list->count == 0 || fwrite(files, sizeof(GrepIndexFile), list->count, out) == list->count);
+        for (size_t i = 0; ok && i < list->count; ++i) {
+            ok = fputs(list->paths[i], out) >= 0 && fputc('\0', out) != EOF;
+        }
+        size_t pad = (size_t)(header.trigrams_offset - header.names_offset - header.names_len);
+        ok = ok && fwrite(padding, 1, pad, out) == pad;
+        ok = ok && fwrite(trigrams, sizeof(GrepIndexTrigram), trigram_count, out) == trigram_count;
+        ok = ok && fwrite(postings, 1, postings_len, out) == postings_len;
+        ok = ok && fflush(out) == 0 && fsync(fileno(out)) == 0;
+    }
+    if (out != NULL) {
+        ok = fclose(out) == 0 && ok;
+        ok = ok && rename(tmp_path, index_path) == 0;
+        if (!ok) {
+            unlink(tmp_path);
+        }
+    }
+
+    free(tmp_path);
+    free(trigrams);
+    free(postings);
+    return ok;
+}
+
+// Build the index of root, reusing old's trigrams for unchanged files
+static int grep_index_make(const char* root, const char* index_path, const GrepIndex* old) {
+    if (root == NULL || index_path == NULL) {
+        return -1;
+    }
+
+    struct stat st;
+    if (stat(root, &st) != 0) {
+        fprintf(stderr, "grep: %s: %s\n", root, strerror(errno));
+        return -1;
+    }
+
+    // Files are found by absolute path and stored relative to the index's
+    // directory, so queries work from any working directory
+    char* index_dir = grep_index_dirname(index_path);
+    char* base = index_dir != NULL ? realpath(index_dir, NULL) : NULL;
+    char* root_path = realpath(root, NULL);
+    free(index_dir);
+    if (base == NULL || root_path == NULL) {
+        fprintf(stderr, "grep: %s: %s\n", base == NULL ? index_path : root, strerror(errno));
+        free(base);
+        free(root_path);
+        return -1;
+    }
+
+    GrepIndexPaths list = {NULL, 0, 0};
+    bool ok;
+    if (S_ISDIR(st.st_mode)) {
+        ok = grep_index_collect(&list, root_path);
+        free(root_path);
+    } else {
+        ok = grep_index_paths_push(&list, root_path);
+    }
+    // Names under one root all share its relative prefix, so sorting the
+    // absolute paths sorts the stored names too
+    if (ok && list.count > 0) {
+        qsort(list.paths, list.count, sizeof(char*), grep_index_compare_paths);
+    }
+    ok = ok && list.count < GREP_INDEX_NONE;
+
+    size_t old_count = old != NULL ? old->header->file_count : 0;
+    GrepIndexFile* files = (GrepIndexFile*)calloc(list.count == 0 ? 1 : list.count, sizeof(GrepIndexFile));
+    uint32_t* reuse = (uint32_t*)malloc((old_count == 0 ? 1 : old_count) * sizeof(uint32_t));
+    uint64_t* seen = (uint64_t*)calloc(GREP_INDEX_TRIGRAMS / 64, sizeof(uint64_t));
+    GrepIndexPairs pairs = {NULL, 0, 0};
+    ok = ok && files != NULL && reuse != NULL && seen != NULL;
+    for (size_t i = 0; ok && i < old_count; ++i) {
+        reuse[i] = GREP_INDEX_NONE;
+    }
+
+    // Files that vanish or stop being regular before they are read are left
+    // out; kept counts the rest, which are compacted to the front of list
+    size_t kept = 0;
+    uint64_t name_offset = 0;
+    for (size_t i = 0; ok && i < list.count; ++i) {
+        char* path = list.paths[i];
+        list.paths[i] = NULL;
+        if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode)) {
+            free(path);
+            continue;
+        }
+        char* name = grep_index_relative(base, path);
+        if (name == NULL) {
+            free(path);
+            ok = false;
+            break;
+        }
+        list.paths[kept] = name;
+
+        GrepIndexFile* file = &files[kept];
+        file->size = (uint64_t)st.st_size;
+        file->mtime_sec = (int64_t)st.st_mtim.tv_sec;
+        file->mtime_nsec = (int64_t)st.st_mtim.tv_nsec;
+        file->name = name_offset;
+        name_offset += strlen(name) + 1;
+
+        uint32_t previous = old != NULL ? grep_index_find_file(old, name) : GREP_INDEX_NONE;
+        if (previous != GREP_INDEX_NONE && old->files[previous].size == file->size &&
+            old->files[previous].mtime_sec == file->mtime_sec &&
+            old->files[previous].mtime_nsec == file->mtime_nsec) {
+            reuse[previous] = (uint32_t)kept;
+        } else {
+            ok = grep_index_scan_file(&pairs, seen, (uint32_t)kept, path, &st);
+        }
+        free(path);
+        kept++;
+    }
+    if (ok) {
+        list.count = kept;
+    }
+
+    // Unchanged files keep the trigrams the old index lists them under
+    uint32_t* decoded = NULL;
+    for (uint64_t t = 0; ok && old != NULL && t < old->header->trigram_count; ++t) {
+        const GrepIndexTrigram* entry = &old->trigrams[t];
+        uint32_t* grown = (uint32_t*)realloc(decoded, (entry->count == 0 ? 1 : entry->count) * sizeof(uint32_t));
+        ok = grown != NULL && grep_index_decode(old, entry, (decoded = grown));
+        for (uint32_t i = 0; ok && i < entry->count; ++i) {
+            if (reuse[decoded[i]] != GREP_INDEX_NONE) {
+                ok = grep_index_pairs_push(&pairs, (uint64_t)entry->trigram << 32 | reuse[decoded[i]]);
+            }
+        }
+    }
+    free(decoded);
+
+    ok = ok && grep_index_sort(&pairs, list.count) && grep_index_write(index_path, &list, files, &pairs);
+    if (!ok) {
+        fprintf(stderr, "grep: %s: could not write index\n", index_path);
+    }
+
+    // On failure the unvisited tail of list is still in place
+    for (size_t i = 0; i < list.count; ++i) {
+        free(list.paths[i]);
+    }
+    free(list.paths);
+    free(base);
+    free(files);
+    free(reuse);
+    free(seen);
+    free(pairs.keys);
+    return ok ? 0 : -1;
+}
+
+// Index every regular file under root
+int grep_index_build(const char* root, const char* index_path) {
+    return grep_index_make(root, index_path, NULL);
+}
+
+// Rebuild the index, re-reading only files whose size or mtime changed
+int grep_index_update(const char* root, const char* index_path) {
+    GrepIndex* old = index_path != NULL ? grep_index_open(index_path) : NULL;
+    // The new index is renamed over the old one, which stays mapped until closed
+    int status = grep_index_make(root, index_path, old);
+    grep_index_close(old);
+    return status;
+}
+
+// Map an index for querying, checking that every section lies inside it
+GrepIndex* grep_index_open(const char* index_path) {
+    int fd = open(index_path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(GrepIndexHeader)) {
+        close(fd);
+        return NULL;
+    }
+    size_t size = (size_t)st.st_size;
+    const char* map = (const char*)mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return NULL;
+    }
+
+    const GrepIndexHeader* header = (const GrepIndexHeader*)map;
+    bool ok = memcmp(header->magic, GREP_INDEX_MAGIC, sizeof(header->magic)) == 0 && header->size == size &&
+              header->file_count < GREP_INDEX_NONE &&
+              header->files_offset == sizeof(GrepIndexHeader) &&
+              header->names_offset == header->files_offset + header->file_count * sizeof(GrepIndexFile) &&
+              header->names_len <= size - header->names_offset &&
+              header->trigrams_offset >= header->names_offset + header->names_len &&
+              header->trigrams_offset % 8 == 0 && header->trigrams_offset <= size &&
+              header->trigram_count <= (size - header->trigrams_offset) / sizeof(GrepIndexTrigram) &&
+              header->postings_offset == header->trigrams_offset + header->trigram_count * sizeof(GrepIndexTrigram);
+
+    GrepIndex* index = ok ? (GrepIndex*)malloc(sizeof(GrepIndex)) : NULL;
+    char* dir = index != NULL ? grep_index_dirname(index_path) : NULL;
+    if (dir == NULL) {
+        free(index);
+        munmap((void*)map, size);
+        return NULL;
+    }
+    if (strcmp(dir, ".") == 0) {
+        free(dir);
+        dir = NULL;
+    }
+    index->dir = dir;
+    index->map = map;
+    index->size = size;
+    index->header = header;
+    index->files = (const GrepIndexFile*)(map + header->files_offset);
+    index->names = map + header->names_offset;
+    index->trigrams = (const GrepIndexTrigram*)(map + header->trigrams_offset);
+    index->postings = (const unsigned char*)map + header->postings_offset;
+    index->postings_len = size - header->postings_offset;
+
+    // Every path must be a NUL-terminated string inside the names
+    for (uint64_t i = 0; ok && i < header->file_count; ++i) {
+        uint64_t name = index->files[i].name;
+        ok = name < header->names_len && memchr(index->names + name, '\0', header->names_len - name) != NULL;
+    }
+    if (!ok) {
+        grep_index_close(index);
+        return NULL;
+    }
+    return index;
+}
+
+// Unmap the index
+void grep_index_close(GrepIndex* index) {
+    if (index == NULL) {
+        return;
+    }
+
+    munmap((void*)index->map, index->size);
+    free(index->dir);
+    free(index);
+}
+
+// Number of files in the index
+size_t grep_index_file_count(const GrepIndex* index) {
+    return index != NULL ? (size_t)index->header->file_count : 0;
+}
+
+// Trigram table entry for trigram, or NULL if no file contains it
+static const GrepIndexTrigram* grep_index_lookup(const GrepIndex* index, uint32_t trigram) {
+    size_t lo = 0, hi = index->header->trigram_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->trigrams[mid].trigram == trigram) {
+            return &index->trigrams[mid];
+        }
+        if (index->trigrams[mid].trigram < trigram) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return NULL;
+}
+
+// Mark the files holding every trigram of literal[0, len), len >= 3. The
+// shortest posting list is decoded first and the others only narrow it.
+static bool grep_index_mark_literal(const GrepIndex* index, const char* literal, size_t len, bool* marks) {
+    size_t count = len - 2;
+    const GrepIndexTrigram** entries = (const GrepIndexTrigram**)malloc(count * sizeof(GrepIndexTrigram*));
+    if (entries == NULL) {
+        return false;
+    }
+
+    size_t shortest = 0;
+    for (size_t i = 0; i < count; ++i) {
+        const unsigned char* p = (const unsigned char*)literal + i;
+        uint32_t trigram = (uint32_t)grep_scan_fold(p[0]) << 16 | (uint32_t)grep_scan_fold(p[1]) << 8 |
+                           grep_scan_fold(p[2]);
+        entries[i] = grep_index_lookup(index, trigram);
+        if (entries[i] == NULL) {
+            // No file holds this trigram, so none holds the literal
+            free(entries);
+            return true;
+        }
+        if (entries[i]->count < entries[shortest]->count) {
+            shortest = i;
+        }
+    }
+
+    uint32_t* files = (uint32_t*)malloc((entries[shortest]->count + 1) * sizeof(uint32_t));
+    uint32_t* other = (uint32_t*)malloc((index->header->file_count + 1) * sizeof(uint32_t));
+    bool ok = files != NULL && other != NULL && grep_index_decode(index, entries[shortest], files);
+    size_t file_count = ok ? entries[shortest]->count : 0;
+
+    for (size_t i = 0; ok && file_count > 0 && i < count; ++i) {
+        if (i == shortest || !(ok = grep_index_decode(index, entries[i], other))) {
+            continue;
+        }
+        // Both lists ascend: keep the files that are in both
+        size_t kept = 0, j = 0;
+        for (size_t k = 0; k < file_count; ++k) {
+            while (j < entries[i]->count && other[j] < files[k]) {
+                j++;
+            }
+            if (j < entries[i]->count && other[j] == files[k]) {
+                files[kept++] = files[k];
+            }
+        }
+        file_count = kept;
+    }
+    for (size_t k = 0; ok && k < file_count; ++k) {
+        marks[files[k]] = true;
+    }
+
+    free(entries);
+    free(files);
+    free(other);
+    return ok;
+}
+
+// Indexed files opts could select a line in
+size_t grep_index_candidates(GrepIndex* index, GrepOptions* opts, char*** paths) {
+    const GrepPattern* compiled = grep_options_pattern(opts);
+    if (index == NULL || compiled == NULL) {
+        return SIZE_MAX;
+    }
+
+    size_t file_count = (size_t)index->header->file_count;
+    bool* marks = (bool*)calloc(file_count + 1, sizeof(bool));
+    *paths = (char**)malloc((file_count + 1) * sizeof(char*));
+    if (marks == NULL || *paths == NULL) {
+        free(marks);
+        free(*paths);
+        return SIZE_MAX;
+    }
+
+    // Only a mode that prints nothing for a file without selected lines can
+    // skip files, and only literals of three bytes or more narrow the search
+    size_t literal_count = grep_pattern_literal_count(compiled);
+    // Compressed files are indexed by their compressed bytes, so with
+    // opts->decompress any file may match
+    bool every = opts->invert_match || opts->count || opts->files_without_match || opts->decompress ||
+                 literal_count == 0;
+    bool ok = true;
+    for (size_t i = 0; ok && !every && i < literal_count; ++i) {
+        size_t len;
+        const char* literal = grep_pattern_literal(compiled, i, &len);
+        if (len < 3) {
+            every = true;
+        } else {
+            ok = grep_index_mark_literal(index, literal, len, marks);
+        }
+    }
+
+    // Stored names are relative to the index's directory. The candidates'
+    // paths are resolved into *paths one by one, then packed after the
+    // array in a single allocation.
+    size_t count = 0, names_len = 0;
+    for (size_t i = 0; ok && i < file_count; ++i) {
+        const GrepIndexFile* file = &index->files[i];
+        const char* name = index->names + file->name;
+        char* path = index->dir != NULL ? grep_index_join(index->dir, name) : strdup(name);
+        struct stat st;
+        if (path == NULL) {
+            ok = false;
+            break;
+        }
+        if (stat(path, &st) != 0) {
+            // Deleted since the index was built
+            free(path);
+            continue;
+        }
+        bool changed = (uint64_t)st.st_size != file->size || (int64_t)st.st_mtim.tv_sec != file->mtime_sec ||
+                       (int64_t)st.st_mtim.tv_nsec != file->mtime_nsec;
+        if (every || marks[i] || changed) {
+            (*paths)[count++] = path;
+            names_len += strlen(path) + 1;
+        } else {
+            free(path);
+        }
+    }
+    free(marks);
+
+    char** packed = ok ? (char**)malloc(count * sizeof(char*) + names_len + 1) : NULL;
+    char* names = packed != NULL ? (char*)(packed + count) : NULL;
+    for (size_t i = 0; i < count; ++i) {
+        if (packed != NULL) {
+            packed[i] = strcpy(names, (*paths)[i]);
+            names += strlen(names) + 1;
+        }
+        free((*paths)[i]);
+    }
+    free(*paths);
+    *paths = packed;
+    return packed != NULL ? count : SIZE_MAX;
+}
+
+// Search the candidate files with the normal matcher
+int grep_index_search(GrepIndex* index, GrepOptions* opts, GrepResultCallback emit, void* ctx) {
+    if (index == NULL || opts == NULL) {
+        return -1;
+    }
+
+    char** paths;
+    size_t count = grep_index_candidates(index, opts, &paths);
+    if (count == SIZE_MAX) {
+        return -1;
+    }
+    if (count == 0) {
+        free(paths);
+        return opts->quiet ? 1 : 0;
+    }
+
+    char** saved_paths = opts->paths;
+    size_t saved_count = opts->path_count;
+    opts->paths = paths;
+    opts->path_count = count;
+    int status = grep_search_paths(opts, emit, ctx);
+    opts->paths = saved_paths;
+    opts->path_count = saved_count;
+
+    free(paths);
+    return status;
+}
@@ -0,0 +1,69 @@
+#ifndef GREP_INDEX_H
+#define GREP_INDEX_H
+
+#include "grep.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Persistent trigram index for searching the same tree many times.
+//
+// The index records, for every three-byte sequence (trigram) that occurs in
+// some file under a root, the list of files it occurs in. Bytes are ASCII
+// case-folded first, so one index serves searches with and without -i. A
+// line containing a literal contains all of its trigrams, so only files on
+// every one of those lists can match; a query intersects the lists and runs
+// the normal matcher on just those files.
+//
+// On disk (native byte order) the index is a header, a file table sorted by
+// path with each file's size and mtime, the paths (relative to the index
+// file's directory, so it can be queried from anywhere), a trigram table
+// sorted by trigram, and the posting lists: ascending file numbers stored as
+// varint deltas, which take one byte per entry in a tree of a few hundred
+// files.
+// The file is memory-mapped for queries, so opening costs no read beyond the
+// pages a query touches.
+//
+// An index narrows the search to the files that can match. Files whose size
+// or mtime no longer match the index are always searched. Files created
+// after the index was built are not searched until grep_index_update adds
+// them, so until then their matches are missing from the result.
+
+typedef struct GrepIndex GrepIndex;
+
+// Index every regular file under root (root itself if it is a file), not
+// following symbolic links, and write the index to index_path. The file is
+// replaced atomically. Returns 0, or -1 (reported on stderr).
+int grep_index_build(const char* root, const char* index_path);
+
+// As grep_index_build, but the trigrams of files whose size and mtime match
+// the existing index at index_path are taken from it instead of re-read.
+// Without a usable existing index this is a full build.
+int grep_index_update(const char* root, const char* index_path);
+
+// Map an index for querying; NULL if it is missing or malformed
+GrepIndex* grep_index_open(const char* index_path);
+
+// Unmap the index
+void grep_index_close(GrepIndex* index);
+
+// Number of files in the index
+size_t grep_index_file_count(const GrepIndex* index);
+
+// Number of indexed files opts could select a line in: those holding every
+// trigram of one of the pattern's literals, plus files changed since the
+// index was built. When the pattern has no usable literal, the mode must
+// report files without matches (-v, -c, -L), or files are searched
+// decompressed (the index holds their compressed bytes), this is every
+// file. Files deleted since the build are left out. *paths is set to a
+// malloc'd array of the candidates' paths, resolved against the directory
+// the index was opened from, and stored in the same allocation; free only
+// the array. Returns SIZE_MAX on failure.
+size_t grep_index_candidates(GrepIndex* index, GrepOptions* opts, char*** paths);
+
+// Search the index's candidate files for opts's pattern as grep_search_paths
+// would search them, in path order; opts->paths is ignored. Returns as
+// grep_search_paths does.
+int grep_index_search(GrepIndex* index, GrepOptions* opts, GrepResultCallback emit, void* ctx);
+
+#endif // GREP_INDEX_H
@@ -0,0 +1,19 @@
+#ifndef GREP_INTERNAL_H
+#define GREP_INTERNAL_H
+
+#include "grep.h"
+
+// grep_search_file with an explicit thread budget: files of at least
+// GREP_PARALLEL_MIN bytes are split into newline-aligned chunks searched by
+// up to threads threads (0: one per CPU). The walker passes 1 when it is
+// already searching many files at once.
+GrepResult* grep_search_file_threads(GrepOptions* opts, const char* filename, int threads);
+
+// Literals that narrow down where compiled can match: a line is selected
+// only if it contains at least one of them. Returns how many there are, or
+// 0 when no such set is known (an empty pattern, a regex without a required
+// literal); literal i is grep_pattern_literal(compiled, i, &len).
+size_t grep_pattern_literal_count(const GrepPattern* compiled);
+const char* grep_pattern_literal(const GrepPattern* compiled, size_t i, size_t* len);
+
+#endif // GREP_INTERNAL_H
@@ -0,0 +1,278 @@
+#include "grep_output.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+// Buffer size of the stdout writer
+#define GREP_OUTPUT_BUFFER (256 * 1024)
+
+struct GrepWriter {
+    int fd;
+    FILE* sync;                 // stdio stream sharing fd, or NULL
+    char* buf;
+    size_t len, capacity;
+    bool failed;                // A write failed; later output is dropped
+    pthread_mutex_t lock;
+};
+
+static GrepWriter* grep_stdout_writer;
+static pthread_once_t grep_stdout_once = PTHREAD_ONCE_INIT;
+
+// Create a writer for fd with a capacity-byte buffer
+GrepWriter* grep_writer_create(int fd, FILE* sync, size_t capacity) {
+    GrepWriter* writer = (GrepWriter*)malloc(sizeof(GrepWriter));
+    if (writer == NULL) {
+        return NULL;
+    }
+
+    writer->buf = (char*)malloc(capacity == 0 ? 1 : capacity);
+    if (writer->buf == NULL) {
+        free(writer);
+        return NULL;
+    }
+    writer->fd = fd;
+    writer->sync = sync;
+    writer->len = 0;
+    writer->capacity = capacity == 0 ? 1 : capacity;
+    writer->failed = false;
+    pthread_mutex_init(&writer->lock, NULL);
+
+    return writer;
+}
+
+// Flush and destroy the writer
+void grep_writer_destroy(GrepWriter* writer) {
+    if (writer == NULL) {
+        return;
+    }
+
+    grep_writer_flush(writer);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer->buf);
+    free(writer);
+}
+
+static void grep_stdout_flush_at_exit(void) {
+    grep_writer_flush(grep_stdout_writer);
+}
+
+static void grep_stdout_init(void) {
+    grep_stdout_writer = grep_writer_create(STDOUT_FILENO, stdout, GREP_OUTPUT_BUFFER);
+    if (grep_stdout_writer != NULL) {
+        atexit(grep_stdout_flush_at_exit);
+    }
+}
+
+// The shared stdout writer
+GrepWriter* grep_writer_stdout(void) {
+    pthread_once(&grep_stdout_once, grep_stdout_init);
+    return grep_stdout_writer;
+}
+
+// Write the buffer followed by extra[0, extra_len), retrying short writes
+static bool grep_writer_drain(GrepWriter* writer, const char* extra, size_t extra_len) {
+    struct iovec parts[2] = {
+        {writer->buf, writer->len},
+        {(void*)extra, extra_len},
+    };
+    struct iovec* part = parts;
+    int count = 2;
+
+    while (!writer->failed && count > 0) {
+        if (part->iov_len == 0) {
+            part++;
+            count--;
+            continue;
+        }
+        ssize_t n = writev(writer->fd, part, count);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            writer->failed = true;
+            break;
+        }
+        while (count > 0 && (size_t)n >= part->iov_len) {
+            n -= (ssize_t)part->iov_len;
+            part++;
+            count--;
+        }
+        if (count > 0) {
+            part->iov_base = (char*)part->iov_base + n;
+            part->iov_len -= (size_t)n;
+        }
+    }
+
+    writer->len = 0;
+    return !writer->failed;
+}
+
+// Make room for len more bytes: true if they now fit in the buffer
+static bool grep_writer_reserve(GrepWriter* writer, size_t len) {
+    if (writer->len == 0 && writer->sync != NULL) {
+        // Whatever the stream holds was printed before this output
+        fflush(writer->sync);
+    }
+    if (writer->len + len <= writer->capacity) {
+        return true;
+    }
+    grep_writer_drain(writer, NULL, 0);
+    return len <= writer->capacity;
+}
+
+static void grep_writer_append(GrepWriter* writer, const char* data, size_t len) {
+    if (grep_writer_reserve(writer, len)) {
+        memcpy(writer->buf + writer->len, data, len);
+        writer->len += len;
+    } else {
+        // Too large to buffer: send it straight from data
+        grep_writer_drain(writer, data, len);
+    }
+}
+
+// Decimal digits of value, written backwards ending at end; returns the start
+static char* grep_format_decimal(char* end, unsigned long long value) {
+    do {
+        *--end = (char)('0' + value % 10);
+        value /= 10;
+    } while (value != 0);
+    return end;
+}
+
+// Append filename:line_number:line\n, or the binary file notice
+static void grep_writer_append_match(GrepWriter* writer, const GrepMatch* match, const char* line) {
+    char digits[24];
+    char* number = digits + sizeof(digits);
+    if (match->line_number > 0) {
+        number = grep_format_decimal(number, (unsigned long long)match->line_number);
+    }
+    size_t number_len = (size_t)(digits + sizeof(digits) - number);
+    const char* filename = match->filename != NULL ? match->filename : "";
+    size_t filename_len = strlen(filename);
+
+    if (match->binary) {
+        grep_writer_append(writer, "Binary file ", 12);
+        grep_writer_append(writer, filename, filename_len);
+        grep_writer_append(writer, " matches\n", 9);
+        return;
+    }
+
+    // The usual case: the whole record fits, and is formatted in place
+    size_t total = filename_len + (number_len > 0 ? number_len + 1 : 0) + 1 + match->length + 1;
+    if (grep_writer_reserve(writer, total)) {
+        char* out = writer->buf + writer->len;
+        memcpy(out, filename, filename_len);
+        out += filename_len;
+        if (number_len > 0) {
+            *out++ = ':';
+            memcpy(out, number, number_len);
+            out += number_len;
+        }
+        *out++ = ':';
+        memcpy(out, line, match->length);
+        out += match->length;
+        *out++ = '\n';
+        writer->len += total;
+        return;
+    }
+
+    grep_writer_append(writer, filename, filename_len);
+    if (number_len > 0) {
+        grep_writer_append(writer, ":", 1);
+        grep_writer_append(writer, number, number_len);
+    }
+    grep_writer_append(writer, ":", 1);
+    grep_writer_append(writer, line, match->length);
+    grep_writer_append(writer, "\n", 1);
+}
+
+// Append len bytes
+bool grep_writer_write(GrepWriter* writer, const char* data, size_t len) {
+    if (writer == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    grep_writer_append(writer, data, len);
+    bool ok = !writer->failed;
+    pthread_mutex_unlock(&writer->lock);
+    return ok;
+}
+
+// Append one match
+bool grep_writer_match(GrepWriter* writer, const GrepMatch* match, const char* line) {
+    if (writer == NULL || match == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    grep_writer_append_match(writer, match, line);
+    bool ok = !writer->failed;
+    pthread_mutex_unlock(&writer->lock);
+    return ok;
+}
+
+// Append every match of result under one lock
+bool grep_writer_result(GrepWriter* writer, const GrepResult* result) {
+    if (writer == NULL || result == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    for (size_t i = 0; result->matches != NULL && i < result->count; ++i) {
+        const GrepMatch* match = &result->matches[i];
+        grep_writer_append_match(writer, match, grep_match_line(result, match));
+    }
+    bool ok = !writer->failed;
+    pthread_mutex_unlock(&writer->lock);
+    return ok;
+}
+
+// Append result in opts's output mode
+bool grep_writer_summary(GrepWriter* writer, const GrepOptions* opts, const GrepResult* result) {
+    if (writer == NULL || opts == NULL || result == NULL) {
+        return false;
+    }
+    if (!opts->files_with_matches && !opts->files_without_match && !opts->count) {
+        return opts->quiet || grep_writer_result(writer, result);
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    size_t filename_len = strlen(result->filename);
+    if (opts->quiet) {
+        // Nothing to print
+    } else if (opts->files_with_matches || opts->files_without_match) {
+        if ((result->count > 0) == opts->files_with_matches) {
+            grep_writer_append(writer, result->filename, filename_len);
+            grep_writer_append(writer, "\n", 1);
+        }
+    } else {
+        char digits[24];
+        char* number = grep_format_decimal(digits + sizeof(digits) - 1, result->count);
+        digits[sizeof(digits) - 1] = '\n';
+        grep_writer_append(writer, result->filename, filename_len);
+        grep_writer_append(writer, ":", 1);
+        grep_writer_append(writer, number, (size_t)(digits + sizeof(digits) - number));
+    }
+    bool ok = !writer->failed;
+    pthread_mutex_unlock(&writer->lock);
+    return ok;
+}
+
+// Write out everything buffered
+bool grep_writer_flush(GrepWriter* writer) {
+    if (writer == NULL) {
+        return false;
+    }
+
+    pthread_mutex_lock(&writer->lock);
+    if (writer->len > 0) {
+        grep_writer_drain(writer, NULL, 0);
+    }
+    bool ok = !writer->failed;
+    pthread_mutex_unlock(&writer->lock);
+    return ok;
+}
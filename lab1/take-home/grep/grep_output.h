@@ -0,0 +1,49 @@
+#ifndef GREP_OUTPUT_H
+#define GREP_OUTPUT_H
+
+#include "grep.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// Buffered output for grep's results.
+//
+// Matches are formatted straight into one large reusable buffer, line
+// numbers with a hand-rolled conversion instead of printf, and the buffer is
+// written out with write() only when it fills up or is flushed. A line too
+// long to fit is sent with writev() alongside the buffered bytes instead of
+// being copied. Each call appends under the writer's lock, and a whole
+// result is appended in one call, so output from several threads never
+// interleaves within a line or a result.
+
+typedef struct GrepWriter GrepWriter;
+
+// Writer buffering capacity bytes for fd. If sync is not NULL it is a stdio
+// stream on the same fd, flushed before this writer's output so text
+// printed through it earlier comes out first.
+GrepWriter* grep_writer_create(int fd, FILE* sync, size_t capacity);
+
+// Flush and destroy the writer
+void grep_writer_destroy(GrepWriter* writer);
+
+// The process-wide writer for stdout used by grep_print_results and
+// friends; flushed at exit
+GrepWriter* grep_writer_stdout(void);
+
+// Append len bytes
+bool grep_writer_write(GrepWriter* writer, const char* data, size_t len);
+
+// Append one match as grep_print_match formats it
+bool grep_writer_match(GrepWriter* writer, const GrepMatch* match, const char* line);
+
+// Append every match of result, in order, with no other output in between
+bool grep_writer_result(GrepWriter* writer, const GrepResult* result);
+
+// Append result the way opts's mode asks for (see grep_print_summary)
+bool grep_writer_summary(GrepWriter* writer, const GrepOptions* opts, const GrepResult* result);
+
+// Write out everything buffered. Returns false if any write failed.
+bool grep_writer_flush(GrepWriter* writer);
+
+#endif // GREP_OUTPUT_H
@@ -0,0 +1,1009 @@
+#define _GNU_SOURCE
+
+#include "grep_regex.h"
+#include "grep_scan.h"
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Largest {n,m} bound (POSIX RE_DUP_MAX)
+#define GREP_RE_DUP_MAX 255
+
+// Deepest ( ) nesting the recursive parser accepts
+#define GREP_RE_MAX_DEPTH 1000
+
+// Deepest recursion nfa_compile may need; stacked quantifiers such as
+// a{1}{1}{1}... nest without parentheses
+#define GREP_RE_MAX_NESTING 5000
+
+// Largest NFA; bounded repetition is expanded, so this caps a{255}{255}
+#define GREP_RE_MAX_STATES 100000
+
+// DFA states cached per thread before the cache is flushed
+#define GREP_DFA_MAX_STATES 2048
+
+// next[] value for '\n', which always takes the slow path (line boundary)
+#define GREP_DFA_NEWLINE (-2)
+
+typedef uint64_t ReSet[4];
+
+static void re_set_add(uint64_t* set, unsigned c) {
+    set[c >> 6] |= 1ull << (c & 63);
+}
+
+static bool re_set_has(const uint64_t* set, unsigned c) {
+    return (set[c >> 6] >> (c & 63)) & 1;
+}
+
+// Parse tree
+typedef enum {
+    RE_EMPTY,
+    RE_CHAR,    // value: byte
+    RE_SET,     // value: set index
+    RE_BOL,
+    RE_EOL,
+    RE_CAT,
+    RE_ALT,
+    RE_STAR,
+    RE_PLUS,
+    RE_QUEST,
+    RE_REPEAT,  // min, max (-1: unbounded)
+} ReType;
+
+typedef struct {
+    ReType type;
+    int value;
+    int left, right;
+    int min, max;
+    int nesting;    // Recursive nfa_compile calls needed below this node
+} ReNode;
+
+typedef struct {
+    const char* p;
+    bool case_insensitive;
+    ReNode* nodes;
+    size_t node_count, node_capacity;
+    ReSet* sets;
+    size_t set_count, set_capacity;
+    const char* error;
+    int depth;
+} ReParser;
+
+// Thompson NFA
+typedef enum {
+    NFA_SET,    // Consume a byte in sets[set], then go to out
+    NFA_SPLIT,  // Go to out and out1
+    NFA_BOL,    // Go to out at the start of a line
+    NFA_EOL,    // Go to out at the end of a line
+    NFA_MATCH,
+} NfaType;
+
+typedef struct {
+    NfaType type;
+    int32_t out, out1;
+    int32_t set;
+} NfaState;
+
+struct GrepRegex {
+    NfaState* states;
+    size_t state_count, state_capacity;
+    ReSet* sets;
+    size_t set_count;
+    int32_t start;
+    unsigned char* literal;     // Required in every match (folded with -i), or NULL
+    size_t literal_len;
+    bool case_insensitive;
+    pthread_key_t cache_key;    // Per-thread DfaCache
+};
+
+// Lazily built DFA; a state is a sorted set of NFA states
+typedef struct {
+    int32_t next[256];          // -1: not computed yet
+    uint32_t set_offset, set_len;
+    bool accept;                // A match ends here
+    bool accept_eol;            // A match ends here if the line ends here
+} DfaState;
+
+typedef struct {
+    DfaState* states;
+    size_t count;
+    uint32_t* pool;             // NFA state sets of all DFA states
+    size_t pool_len, pool_capacity;
+    int32_t* table;             // Hash of set -> DFA state, -1 for empty slots
+    size_t table_capacity;
+    int32_t start_bol;          // State at the start of a line, or -1
+
+    // Scratch for closures
+    uint32_t* mark;             // Per NFA state: generation it was last added in
+    uint32_t generation;
+    int32_t* stack;
+    uint32_t* work;
+    size_t work_len;
+} DfaCache;
+
+static int re_node(ReParser* ps, ReType type, int value, int left, int right) {
+    if (ps->node_count == ps->node_capacity) {
+        size_t capacity = ps->node_capacity == 0 ? 64 : ps->node_capacity * 2;
+        ReNode* nodes = (ReNode*)realloc(ps->nodes, capacity * sizeof(ReNode));
+        if (nodes == NULL) {
+            ps->error = "out of memory";
+            return -1;
+        }
+        ps->nodes = nodes;
+        ps->node_capacity = capacity;
+    }
+
+    // Left spines of concatenations and alternations are compiled in a loop
+    int nesting = 0;
+    if (type == RE_CAT || type == RE_ALT) {
+        nesting = ps->nodes[right].nesting + 1;
+        nesting = ps->nodes[left].nesting > nesting ? ps->nodes[left].nesting : nesting;
+    } else if (left >= 0) {
+        nesting = ps->nodes[left].nesting + 1;
+    }
+    if (nesting > GREP_RE_MAX_NESTING) {
+        ps->error = "regular expression nested too deeply";
+        return -1;
+    }
+
+    ReNode* node = &ps->nodes[ps->node_count];
+    node->type = type;
+    node->value = value;
+    node->left = left;
+    node->right = right;
+    node->min = 0;
+    node->max = -1;
+    node->nesting = nesting;
+    return (int)ps->node_count++;
+}
+
+static int re_new_set(ReParser* ps) {
+    if (ps->set_count == ps->set_capacity) {
+        size_t capacity = ps->set_capacity == 0 ? 16 : ps->set_capacity * 2;
+        ReSet* sets = (ReSet*)realloc(ps->sets, capacity * sizeof(ReSet));
+        if (sets == NULL) {
+            ps->error = "out of memory";
+            return -1;
+        }
+        ps->sets = sets;
+        ps->set_capacity = capacity;
+    }
+
+    memset(ps->sets[ps->set_count], 0, sizeof(ReSet));
+    return (int)ps->set_count++;
+}
+
+// Add the other case of every ASCII letter in the set
+static void re_fold_set(uint64_t* set) {
+    for (unsigned c = 'a'; c <= 'z'; ++c) {
+        if (re_set_has(set, c) || re_set_has(set, c - 'a' + 'A')) {
+            re_set_add(set, c);
+            re_set_add(set, c - 'a' + 'A');
+        }
+    }
+}
+
+static bool re_add_class(uint64_t* set, const char* name, size_t len) {
+    static const struct {
+        const char* name;
+        int (*test)(int);
+    } classes[] = {
+        {"alpha", isalpha}, {"digit", isdigit}, {"alnum", isalnum}, {"upper", isupper},
+        {"lower", islower}, {"space", isspace}, {"blank", isblank}, {"punct", ispunct},
+        {"print", isprint}, {"graph", isgraph}, {"cntrl", iscntrl}, {"xdigit", isxdigit},
+    };
+
+    for (size_t i = 0; i < sizeof(classes) / sizeof(classes[0]); ++i) {
+        if (strlen(classes[i].name) == len && memcmp(classes[i].name, name, len) == 0) {
+            for (unsigned c = 0; c < 128; ++c) {
+                if (classes[i].test((int)c)) {
+                    re_set_add(set, c);
+                }
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+// \w \W \s \S
+static int re_escape_set(ReParser* ps, char c) {
+    int index = re_new_set(ps);
+    if (index < 0) {
+        return -1;
+    }
+
+    uint64_t* set = ps->sets[index];
+    if (c == 'w' || c == 'W') {
+        re_add_class(set, "alnum", 5);
+        re_set_add(set, '_');
+    } else {
+        re_add_class(set, "space", 5);
+    }
+    if (c == 'W' || c == 'S') {
+        for (int i = 0; i < 4; ++i) {
+            set[i] = ~set[i];
+        }
+    }
+    return re_node(ps, RE_SET, index, -1, -1);
+}
+
+// [...] with ps->p just past the '['
+static int re_parse_bracket(ReParser* ps) {
+    int index = re_new_set(ps);
+    if (index < 0) {
+        return -1;
+    }
+
+    bool negate = *ps->p == '^';
+    if (negate) {
+        ps->p++;
+    }
+
+    // A ']' right after '[' or '[^' is a literal
+    bool first = true;
+    for (;;) {
+        const char* p = ps->p;
+        uint64_t* set = ps->sets[index];
+        if (*p == '\0') {
+            ps->error = "unmatched [";
+            return -1;
+        }
+        if (*p == ']' && !first) {
+            ps->p = p + 1;
+            break;
+        }
+        first = false;
+
+        if (p[0] == '[' && p[1] == ':') {
+            const char* close = strstr(p + 2, ":]");
+            if (close == NULL || !re_add_class(set, p + 2, (size_t)(close - p - 2))) {
+                ps->error = "invalid character class";
+                return -1;
+            }
+            ps->p = close + 2;
+            continue;
+        }
+
+        unsigned char lo = (unsigned char)p[0];
+        if (p[1] == '-' && p[2] != ']' && p[2] != '\0') {
+            unsigned char hi = (unsigned char)p[2];
+            if (hi < lo) {
+                ps->error = "invalid range end";
+                return -1;
+            }
+            for (unsigned c = lo; c <= hi; ++c) {
+                re_set_add(set, c);
+            }
+            ps->p = p + 3;
+        } else {
+            re_set_add(set, lo);
+            ps->p = p + 1;
+        }
+    }
+
+    uint64_t* set = ps->sets[index];
+    if (ps->case_insensitive) {
+        re_fold_set(set);
+    }
+    if (negate) {
+        for (int i = 0; i < 4; ++i) {
+            set[i] = ~set[i];
+        }
+    }
+    // Lines never contain the newline
+    set['\n' >> 6] &= ~(1ull << ('\n' & 63));
+    return re_node(ps, RE_SET, index, -1, -1);
+}
+
+static int re_parse_alt(ReParser* ps);
+
+static int re_parse_atom(ReParser* ps) {
+    char c = *ps->p++;
+
+    switch (c) {
+    case '(': {
+        if (++ps->depth > GREP_RE_MAX_DEPTH) {
+            ps->error = "parentheses nested too deeply";
+            return -1;
+        }
+        int inner = *ps->p == ')' ? re_node(ps, RE_EMPTY, 0, -1, -1) : re_parse_alt(ps);
+        if (inner < 0) {
+            return -1;
+        }
+        if (*ps->p != ')') {
+            ps->error = "unmatched (";
+            return -1;
+        }
+        ps->p++;
+        ps->depth--;
+        return inner;
+    }
+    case '[':
+        return re_parse_bracket(ps);
+    case '.': {
+        int index = re_new_set(ps);
+        if (index < 0) {
+            return -1;
+        }
+        memset(ps->sets[index], 0xff, sizeof(ReSet));
+        ps->sets[index]['\n' >> 6] &= ~(1ull << ('\n' & 63));
+        return re_node(ps, RE_SET, index, -1, -1);
+    }
+    case '^':
+        return re_node(ps, RE_BOL, 0, -1, -1);
+    case '$':
+        return re_node(ps, RE_EOL, 0, -1, -1);
+    case '\\':
+        c = *ps->p++;
+        if (c == '\0') {
+            ps->error = "trailing backslash";
+            return -1;
+        }
+        if (c == 'w' || c == 'W' || c == 's' || c == 'S') {
+            return re_escape_set(ps, c);
+        }
+        return re_node(ps, RE_CHAR, (unsigned char)c, -1, -1);
+    default:
+        // Includes a quantifier with nothing to repeat, taken literally
+        return re_node(ps, RE_CHAR, (unsigned char)c, -1, -1);
+    }
+}
+
+static int re_parse_number(const char** p) {
+    int n = 0;
+    while (isdigit((unsigned char)**p)) {
+        n = n * 10 + (*(*p)++ - '0');
+        if (n > GREP_RE_DUP_MAX) {
+            n = GREP_RE_DUP_MAX + 1;
+        }
+    }
+    return n;
+}
+
+// {n}, {n,}, {n,m} or {,m} with ps->p at the '{'; false if it is not a
+// valid bound, in which case the '{' is a literal
+static bool re_parse_bound(ReParser* ps, int* min, int* max) {
+    const char* p = ps->p + 1;
+    if (!isdigit((unsigned char)*p) && *p != ',') {
+        return false;
+    }
+
+    *min = re_parse_number(&p);
+    *max = *min;
+    if (*p == ',') {
+        p++;
+        *max = isdigit((unsigned char)*p) ? re_parse_number(&p) : -1;
+    }
+    if (*p != '}') {
+        return false;
+    }
+
+    ps->p = p + 1;
+    if (*min > GREP_RE_DUP_MAX || *max > GREP_RE_DUP_MAX || (*max >= 0 && *max < *min)) {
+        ps->error = "invalid repetition count";
+    }
+    return true;
+}
+
+static int re_parse_cat(ReParser* ps) {
+    int result = -1;
+
+    while (*ps->p != '\0' && *ps->p != '|' && *ps->p != ')') {
+        int atom = re_parse_atom(ps);
+        if (atom < 0) {
+            return -1;
+        }
+
+        for (;;) {
+            char q = *ps->p;
+            int min, max;
+            if (q == '*' || q == '+' || q == '?') {
+                ps->p++;
+                atom = re_node(ps, q == '*' ? RE_STAR : q == '+' ? RE_PLUS : RE_QUEST, 0, atom, -1);
+            } else if (q == '{' && re_parse_bound(ps, &min, &max)) {
+                if (ps->error != NULL) {
+                    return -1;
+                }
+                atom = re_node(ps, RE_REPEAT, 0, atom, -1);
+                if (atom >= 0) {
+                    ps->nodes[atom].min = min;
+                    ps->nodes[atom].max = max;
+                }
+            } else {
+                break;
+            }
+            if (atom < 0) {
+                return -1;
+            }
+        }
+
+        result = result < 0 ? atom : re_node(ps, RE_CAT, 0, result, atom);
+        if (result < 0) {
+            return -1;
+        }
+    }
+
+    return result < 0 ? re_node(ps, RE_EMPTY, 0, -1, -1) : result;
+}
+
+static int re_parse_alt(ReParser* ps) {
+    int left = re_parse_cat(ps);
+
+    while (left >= 0 && *ps->p == '|') {
+        ps->p++;
+        int right = re_parse_cat(ps);
+        left = right < 0 ? -1 : re_node(ps, RE_ALT, 0, left, right);
+    }
+    return left;
+}
+
+static int32_t nfa_state(GrepRegex* re, NfaType type, int32_t out, int32_t out1, int32_t set) {
+    if (re->state_count == re->state_capacity) {
+        if (re->state_capacity >= GREP_RE_MAX_STATES) {
+            return -1;
+        }
+        size_t capacity = re->state_capacity == 0 ? 64 : re->state_capacity * 2;
+        NfaState* states = (NfaState*)realloc(re->states, capacity * sizeof(NfaState));
+        if (states == NULL) {
+            return -1;
+        }
+        re->states = states;
+        re->state_capacity = capacity;
+    }
+
+    NfaState* state = &re->states[re->state_count];
+    state->type = type;
+    state->out = out;
+    state->out1 = out1;
+    state->set = set;
+    return (int32_t)re->state_count++;
+}
+
+// NFA for node that continues to next; returns its entry state. Built back
+// to front, so every fragment's exit is known when it is created.
+static int32_t nfa_compile(GrepRegex* re, const ReParser* ps, int index, int32_t next) {
+    const ReNode* node = &ps->nodes[index];
+    int32_t entry, split;
+
+    // Concatenations and alternations lean left and can be as long as the
+    // pattern list, so walk their left spine in a loop; recursion only goes
+    // as deep as the parentheses
+    while (node->type == RE_CAT && next >= 0) {
+        next = nfa_compile(re, ps, node->right, next);
+        index = node->left;
+        node = &ps->nodes[index];
+    }
+    if (next < 0) {
+        return -1;
+    }
+
+    switch (node->type) {
+    case RE_EMPTY:
+        return next;
+    case RE_CHAR:
+        // Sets for single characters follow the parser's sets
+        return nfa_state(re, NFA_SET, next, -1, (int32_t)(ps->set_count + (size_t)index));
+    case RE_SET:
+        return nfa_state(re, NFA_SET, next, -1, node->value);
+    case RE_BOL:
+        return nfa_state(re, NFA_BOL, next, -1, -1);
+    case RE_EOL:
+        return nfa_state(re, NFA_EOL, next, -1, -1);
+    case RE_CAT:
+        break;  // Unwound above
+    case RE_ALT: {
+        // a|b|c is a chain of splits; each one's other branch is patched in
+        // once the next is made
+        int32_t first = -1, last = -1;
+        for (; node->type == RE_ALT; node = &ps->nodes[node->left]) {
+            entry = nfa_compile(re, ps, node->right, next);
+            split = entry < 0 ? -1 : nfa_state(re, NFA_SPLIT, -1, entry, -1);
+            if (split < 0) {
+                return -1;
+            }
+            if (last < 0) {
+                first = split;
+            } else {
+                re->states[last].out = split;
+            }
+            last = split;
+        }
+        entry = nfa_compile(re, ps, (int)(node - ps->nodes), next);
+        if (entry < 0) {
+            return -1;
+        }
+        re->states[last].out = entry;
+        return first;
+    }
+    case RE_QUEST:
+        entry = nfa_compile(re, ps, node->left, next);
+        return entry < 0 ? -1 : nfa_state(re, NFA_SPLIT, entry, next, -1);
+    case RE_STAR:
+    case RE_PLUS:
+        split = nfa_state(re, NFA_SPLIT, -1, next, -1);
+        entry = nfa_compile(re, ps, node->left, split);
+        if (entry < 0) {
+            return -1;
+        }
+        re->states[split].out = entry;
+        return node->type == RE_STAR ? split : entry;
+    case RE_REPEAT: {
+        // x{2,4} is x x (x (x)?)?; x{2,} is x x x*
+        int32_t tail = next;
+        if (node->max < 0) {
+            split = nfa_state(re, NFA_SPLIT, -1, next, -1);
+            entry = nfa_compile(re, ps, node->left, split);
+            if (entry < 0) {
+                return -1;
+            }
+            re->states[split].out = entry;
+            tail = split;
+        } else {
+            for (int i = node->min; i < node->max && tail >= 0; ++i) {
+                entry = nfa_compile(re, ps, node->left, tail);
+                tail = entry < 0 ? -1 : nfa_state(re, NFA_SPLIT, entry, next, -1);
+            }
+        }
+        for (int i = 0; i < node->min && tail >= 0; ++i) {
+            tail = nfa_compile(re, ps, node->left, tail);
+        }
+        return tail;
+    }
+    }
+    return -1;
+}
+
+// Gather the leaves of a chain of concatenations in order; stack holds
+// node_count entries
+static size_t re_flatten(const ReParser* ps, int root, int* leaves, int* stack) {
+    size_t count = 0, depth = 0;
+    stack[depth++] = root;
+    while (depth > 0) {
+        int index = stack[--depth];
+        const ReNode* node = &ps->nodes[index];
+        if (node->type == RE_CAT) {
+            stack[depth++] = node->right;
+            stack[depth++] = node->left;
+        } else {
+            leaves[count++] = index;
+        }
+    }
+    return count;
+}
+
+// Longest run of plain characters in the top-level concatenation; every
+// match contains it
+static bool re_required_literal(GrepRegex* re, const ReParser* ps, int root) {
+    int* leaves = (int*)malloc(2 * ps->node_count * sizeof(int));
+    if (leaves == NULL) {
+        return false;
+    }
+
+    size_t count = re_flatten(ps, root, leaves, leaves + ps->node_count), best = 0, best_len = 0;
+    for (size_t i = 0; i < count;) {
+        size_t run = 0;
+        while (i + run < count && ps->nodes[leaves[i + run]].type == RE_CHAR) {
+            run++;
+        }
+        if (run > best_len) {
+            best = i;
+            best_len = run;
+        }
+        i += run > 0 ? run : 1;
+    }
+
+    if (best_len > 0) {
+        re->literal = (unsigned char*)malloc(best_len);
+        if (re->literal == NULL) {
+            free(leaves);
+            return false;
+        }
+        for (size_t i = 0; i < best_len; ++i) {
+            unsigned char c = (unsigned char)ps->nodes[leaves[best + i]].value;
+            re->literal[i] = re->case_insensitive ? grep_scan_fold(c) : c;
+        }
+        re->literal_len = best_len;
+    }
+
+    free(leaves);
+    return true;
+}
+
+static void dfa_cache_free(void* arg) {
+    DfaCache* cache = (DfaCache*)arg;
+    if (cache == NULL) {
+        return;
+    }
+
+    free(cache->states);
+    free(cache->pool);
+    free(cache->table);
+    free(cache->mark);
+    free(cache->stack);
+    free(cache->work);
+    free(cache);
+}
+
+// Compile count patterns, matched as their alternation
+GrepRegex* grep_regex_compile(const char* const* patterns, size_t count, bool case_insensitive,
+                              const char** error) {
+    ReParser ps;
+    memset(&ps, 0, sizeof(ps));
+    ps.case_insensitive = case_insensitive;
+
+    // Parse each pattern and join them with |
+    int root = -1;
+    for (size_t i = 0; i < count && ps.error == NULL; ++i) {
+        ps.p = patterns[i];
+        ps.depth = 0;
+        int tree = re_parse_alt(&ps);
+        if (tree >= 0 && *ps.p != '\0') {
+            ps.error = "unmatched )";
+        }
+        if (tree >= 0 && ps.error == NULL) {
+            root = root < 0 ? tree : re_node(&ps, RE_ALT, 0, root, tree);
+        }
+    }
+    if (root < 0 && ps.error == NULL) {
+        ps.error = "no pattern";
+    }
+
+    GrepRegex* re = ps.error == NULL ? (GrepRegex*)calloc(1, sizeof(GrepRegex)) : NULL;
+    if (re == NULL) {
+        if (error != NULL) {
+            *error = ps.error != NULL ? ps.error : "out of memory";
+        }
+        free(ps.nodes);
+        free(ps.sets);
+        return NULL;
+    }
+    re->case_insensitive = case_insensitive;
+
+    // Parser sets, then one set per character node (indexed by node)
+    re->set_count = ps.set_count + ps.node_count;
+    re->sets = (ReSet*)calloc(re->set_count, sizeof(ReSet));
+    const char* failure = re->sets == NULL ? "out of memory" : NULL;
+    if (failure == NULL) {
+        if (ps.set_count > 0) {
+            memcpy(re->sets, ps.sets, ps.set_count * sizeof(ReSet));
+        }
+        for (size_t i = 0; i < ps.node_count; ++i) {
+            if (ps.nodes[i].type == RE_CHAR) {
+                uint64_t* set = re->sets[ps.set_count + i];
+                re_set_add(set, (unsigned)ps.nodes[i].value);
+                if (case_insensitive) {
+                    re_fold_set(set);
+                }
+            }
+        }
+
+        int32_t match = nfa_state(re, NFA_MATCH, -1, -1, -1);
+        re->start = nfa_compile(re, &ps, root, match);
+        if (re->start < 0) {
+            failure = "regular expression too big";
+        } else if (!re_required_literal(re, &ps, root) ||
+                   pthread_key_create(&re->cache_key, dfa_cache_free) != 0) {
+            failure = "out of memory";
+        }
+    }
+
+    free(ps.nodes);
+    free(ps.sets);
+    if (failure != NULL) {
+        if (error != NULL) {
+            *error = failure;
+        }
+        free(re->states);
+        free(re->sets);
+        free(re->literal);
+        free(re);
+        return NULL;
+    }
+    return re;
+}
+
+// Destroy the regex and the calling thread's DFA cache
+void grep_regex_destroy(GrepRegex* regex) {
+    if (regex == NULL) {
+        return;
+    }
+
+    dfa_cache_free(pthread_getspecific(regex->cache_key));
+    pthread_key_delete(regex->cache_key);
+    free(regex->states);
+    free(regex->sets);
+    free(regex->literal);
+    free(regex);
+}
+
+// A literal every match contains, or NULL
+const unsigned char* grep_regex_literal(const GrepRegex* regex, size_t* len) {
+    *len = regex->literal_len;
+    return regex->literal;
+}
+
+static DfaCache* dfa_cache(const GrepRegex* re) {
+    DfaCache* cache = (DfaCache*)pthread_getspecific(re->cache_key);
+    if (cache != NULL) {
+        return cache;
+    }
+
+    cache = (DfaCache*)calloc(1, sizeof(DfaCache));
+    if (cache == NULL) {
+        return NULL;
+    }
+    cache->states = (DfaState*)malloc(GREP_DFA_MAX_STATES * sizeof(DfaState));
+    cache->table_capacity = GREP_DFA_MAX_STATES * 2;
+    cache->table = (int32_t*)malloc(cache->table_capacity * sizeof(int32_t));
+    cache->mark = (uint32_t*)calloc(re->state_count, sizeof(uint32_t));
+    cache->stack = (int32_t*)malloc(re->state_count * 3 * sizeof(int32_t));
+    cache->work = (uint32_t*)malloc(re->state_count * sizeof(uint32_t));
+    if (cache->states == NULL || cache->table == NULL || cache->mark == NULL ||
+        cache->stack == NULL || cache->work == NULL ||
+        pthread_setspecific(re->cache_key, cache) != 0) {
+        dfa_cache_free(cache);
+        return NULL;
+    }
+    memset(cache->table, 0xff, cache->table_capacity * sizeof(int32_t));
+    cache->start_bol = -1;
+    return cache;
+}
+
+// Start a new work set; states are marked with the generation they joined in
+static void dfa_begin(DfaCache* cache, const GrepRegex* re) {
+    if (++cache->generation == 0) {
+        memset(cache->mark, 0, re->state_count * sizeof(uint32_t));
+        cache->generation = 1;
+    }
+    cache->work_len = 0;
+}
+
+static void dfa_flush(DfaCache* cache) {
+    cache->count = 0;
+    cache->pool_len = 0;
+    cache->start_bol = -1;
+    memset(cache->table, 0xff, cache->table_capacity * sizeof(int32_t));
+}
+
+// Add the states reachable from seed without consuming a byte to the work
+// set. BOL and EOL are passed only where bol/eol hold; an EOL that cannot be
+// passed yet stays in the set so accept_eol can be computed.
+static void dfa_closure(DfaCache* cache, const GrepRegex* re, int32_t seed, bool bol, bool eol) {
+    size_t top = 0;
+    cache->stack[top++] = seed;
+
+    while (top > 0) {
+        int32_t s = cache->stack[--top];
+        if (s < 0 || cache->mark[s] == cache->generation) {
+            continue;
+        }
+        cache->mark[s] = cache->generation;
+
+        const NfaState* state = &re->states[s];
+        switch (state->type) {
+        case NFA_SPLIT:
+            cache->stack[top++] = state->out1;
+            cache->stack[top++] = state->out;
+            break;
+        case NFA_BOL:
+            if (bol) {
+                cache->stack[top++] = state->out;
+            }
+            break;
+        case NFA_EOL:
+            if (eol) {
+                cache->stack[top++] = state->out;
+            } else {
+                cache->work[cache->work_len++] = (uint32_t)s;
+            }
+            break;
+        default:
+            cache->work[cache->work_len++] = (uint32_t)s;
+            break;
+        }
+    }
+}
+
+static int dfa_compare(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// DFA state for the work set, created if needed; -1 when the cache is full
+static int32_t dfa_state(DfaCache* cache, const GrepRegex* re) {
+    uint32_t* set = cache->work;
+    size_t len = cache->work_len;
+    qsort(set, len, sizeof(uint32_t), dfa_compare);
+
+    uint64_t hash = 1469598103934665603ull;
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ set[i]) * 1099511628211ull;
+    }
+
+    size_t slot = (size_t)hash % cache->table_capacity;
+    for (; cache->table[slot] >= 0; slot = (slot + 1) % cache->table_capacity) {
+        const DfaState* state = &cache->states[cache->table[slot]];
+        if (state->set_len == len &&
+            memcmp(cache->pool + state->set_offset, set, len * sizeof(uint32_t)) == 0) {
+            return cache->table[slot];
+        }
+    }
+
+    if (cache->count == GREP_DFA_MAX_STATES) {
+        return -1;
+    }
+    if (cache->pool_len + len > cache->pool_capacity) {
+        size_t capacity = cache->pool_capacity == 0 ? 4096 : cache->pool_capacity;
+        while (capacity < cache->pool_len + len) {
+            capacity *= 2;
+        }
+        uint32_t* pool = (uint32_t*)realloc(cache->pool, capacity * sizeof(uint32_t));
+        if (pool == NULL) {
+            return -1;
+        }
+        cache->pool = pool;
+        cache->pool_capacity = capacity;
+    }
+
+    int32_t index = (int32_t)cache->count++;
+    DfaState* state = &cache->states[index];
+    for (int c = 0; c < 256; ++c) {
+        state->next[c] = -1;
+    }
+    state->next['\n'] = GREP_DFA_NEWLINE;
+    state->set_offset = (uint32_t)cache->pool_len;
+    state->set_len = (uint32_t)len;
+    memcpy(cache->pool + cache->pool_len, set, len * sizeof(uint32_t));
+    cache->pool_len += len;
+    cache->table[slot] = index;
+
+    state->accept = false;
+    bool has_eol = false;
+    for (size_t i = 0; i < len; ++i) {
+        state->accept = state->accept || re->states[set[i]].type == NFA_MATCH;
+        has_eol = has_eol || re->states[set[i]].type == NFA_EOL;
+    }
+
+    // Would passing the pending $ assertions reach a match?
+    state->accept_eol = state->accept;
+    if (!state->accept && has_eol) {
+        dfa_begin(cache, re);
+        const uint32_t* own = cache->pool + state->set_offset;
+        for (size_t i = 0; i < len; ++i) {
+            if (re->states[own[i]].type == NFA_EOL) {
+                dfa_closure(cache, re, re->states[own[i]].out, false, true);
+            }
+        }
+        for (size_t i = 0; i < cache->work_len && !state->accept_eol; ++i) {
+            state->accept_eol = re->states[cache->work[i]].type == NFA_MATCH;
+        }
+    }
+    return index;
+}
+
+// Find or create the work set's DFA state, flushing the cache if it is full
+static int32_t dfa_intern(DfaCache* cache, const GrepRegex* re) {
+    int32_t index = dfa_state(cache, re);
+    if (index < 0) {
+        dfa_flush(cache);
+        index = dfa_state(cache, re);
+    }
+    return index;
+}
+
+static int32_t dfa_start(DfaCache* cache, const GrepRegex* re) {
+    if (cache->start_bol < 0) {
+        dfa_begin(cache, re);
+        dfa_closure(cache, re, re->start, true, false);
+        cache->start_bol = dfa_intern(cache, re);
+    }
+    return cache->start_bol;
+}
+
+// Transition of from on byte. The search is unanchored, so the start
+// state's closure joins every step.
+static int32_t dfa_step(DfaCache* cache, const GrepRegex* re, int32_t from, unsigned char byte) {
+    dfa_begin(cache, re);
+
+    const DfaState* state = &cache->states[from];
+    const uint32_t* set = cache->pool + state->set_offset;
+    for (size_t i = 0; i < state->set_len; ++i) {
+        const NfaState* nfa = &re->states[set[i]];
+        if (nfa->type == NFA_SET && re_set_has(re->sets[nfa->set], byte)) {
+            dfa_closure(cache, re, nfa->out, false, false);
+        }
+    }
+    dfa_closure(cache, re, re->start, false, false);
+
+    int32_t to = dfa_state(cache, re);
+    if (to >= 0) {
+        cache->states[from].next[byte] = to;
+        return to;
+    }
+    // Full: start over with only the state we are moving to
+    dfa_flush(cache);
+    return dfa_state(cache, re);
+}
+
+// Run the DFA over text[0, len), which starts at a line start
+static const char* dfa_search(DfaCache* cache, const GrepRegex* re, const char* text, size_t len) {
+    const unsigned char* t = (const unsigned char*)text;
+    int32_t state = dfa_start(cache, re);
+
+    if (state < 0) {
+        return NULL;
+    }
+    if (cache->states[state].accept) {
+        return text;
+    }
+
+    for (size_t i = 0; i < len; ++i) {
+        int32_t next = cache->states[state].next[t[i]];
+        if (next == GREP_DFA_NEWLINE) {
+            if (cache->states[state].accept_eol) {
+                return text + i;
+            }
+            if (i + 1 == len) {
+                return NULL;
+            }
+            next = dfa_start(cache, re);
+            if (next >= 0 && cache->states[next].accept) {
+                return text + i + 1;
+            }
+        } else if (next < 0) {
+            next = dfa_step(cache, re, state, t[i]);
+        }
+        if (next < 0) {
+            return NULL;
+        }
+        state = next;
+        if (cache->states[state].accept) {
+            return text + i;
+        }
+    }
+
+    // The last line has no newline
+    if (len > 0 && t[len - 1] == '\n') {
+        return NULL;
+    }
+    return cache->states[state].accept_eol ? text + len : NULL;
+}
+
+// A position inside the first line of text[0, len) that matches, or NULL
+const char* grep_regex_search(const GrepRegex* regex, const char* text, size_t len) {
+    DfaCache* cache = dfa_cache(regex);
+    if (cache == NULL) {
+        return NULL;
+    }
+    if (regex->literal == NULL) {
+        return dfa_search(cache, regex, text, len);
+    }
+
+    // Only lines containing the required literal can match
+    const char* end = text + len;
+    const char* pos = text;
+    while (pos < end) {
+        const char* candidate = grep_scan_find(regex->literal, regex->literal_len, regex->case_insensitive,
+                                               pos, (size_t)(end - pos));
+        if (candidate == NULL) {
+            return NULL;
+        }
+        const char* prev = (const char*)memrchr(pos, '\n', (size_t)(candidate - pos));
+        const char* line = prev == NULL ? pos : prev + 1;
+        const char* eol = grep_scan_byte(candidate, (size_t)(end - candidate), '\n');
+        if (eol == NULL) {
+            eol = end;
+        }
+
+        const char* hit = dfa_search(cache, regex, line, (size_t)(eol - line));
+        if (hit != NULL) {
+            return hit;
+        }
+        pos = eol + 1;
+    }
+    return NULL;
+}
@@ -0,0 +1,45 @@
+#ifndef GREP_REGEX_H
+#define GREP_REGEX_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Extended regular expressions (-E) matched in linear time.
+//
+// Patterns are parsed into a Thompson NFA, which is run as a DFA built
+// lazily: a DFA state is the set of NFA states the search can be in, and its
+// transition on a byte is computed the first time that byte is seen in that
+// state and cached. Every byte of text therefore costs one table lookup
+// once the cache is warm, and at most one NFA step otherwise; there is no
+// backtracking, so no pattern can take more than linear time. The cache is
+// per thread and bounded: when it fills up it is flushed and rebuilt from
+// the state the search is in.
+//
+// When every match must contain some literal string (e.g. "error" in
+// "error [0-9]+ at"), the text is first scanned for that literal with the
+// vector kernels, and the DFA only runs on lines that contain it.
+//
+// Supported syntax: literals, ., [...] with ranges, negation and [:class:]
+// names, ^, $, (...), |, *, +, ?, {n}, {n,}, {n,m}, \w \W \s \S, and \ to
+// quote any other character.
+
+typedef struct GrepRegex GrepRegex;
+
+// Compile count patterns, matched as their alternation. On a syntax error
+// returns NULL and, if error is not NULL, sets it to a static message.
+GrepRegex* grep_regex_compile(const char* const* patterns, size_t count, bool case_insensitive,
+                              const char** error);
+
+// Destroy the regex and the calling thread's DFA cache (other threads free
+// theirs when they exit)
+void grep_regex_destroy(GrepRegex* regex);
+
+// A literal every match contains (case-folded with -i), or NULL if none is
+// known; its length is stored in *len
+const unsigned char* grep_regex_literal(const GrepRegex* regex, size_t* len);
+
+// A position inside the first line of text[0, len) that matches, or NULL.
+// text must start at the beginning of a line.
+const char* grep_regex_search(const GrepRegex* regex, const char* text, size_t len);
+
+#endif // GREP_REGEX_H
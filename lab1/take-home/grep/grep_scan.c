@@ -0,0 +1,240 @@
+#include "grep_scan.h"
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define GREP_SCAN_X86 1
+#endif
+
+static _Atomic int scan_level = -1;
+
+static GrepScanLevel detect_level(void) {
+#ifdef GREP_SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return GREP_SCAN_AVX2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return GREP_SCAN_SSE2;
+    }
+#endif
+    return GREP_SCAN_SCALAR;
+}
+
+// Level in use (detected on first call)
+GrepScanLevel grep_scan_level(void) {
+    int level = atomic_load_explicit(&scan_level, memory_order_relaxed);
+    if (level < 0) {
+        level = (int)detect_level();
+        atomic_store_explicit(&scan_level, level, memory_order_relaxed);
+    }
+    return (GrepScanLevel)level;
+}
+
+// Use at most level (for tests and benchmarks); returns the level in use
+GrepScanLevel grep_scan_set_level(GrepScanLevel level) {
+    GrepScanLevel supported = detect_level();
+    if (level > supported) {
+        level = supported;
+    }
+    atomic_store_explicit(&scan_level, (int)level, memory_order_relaxed);
+    return level;
+}
+
+// Bytes 1 .. m-2 of a candidate whose first and last bytes already matched
+static inline bool verify(const unsigned char* needle, size_t m, bool fold, const char* at) {
+    const unsigned char* t = (const unsigned char*)at;
+    if (!fold) {
+        return m <= 2 || memcmp(t + 1, needle + 1, m - 2) == 0;
+    }
+    for (size_t j = 1; j + 1 < m; j++) {
+        if (grep_scan_fold(t[j]) != needle[j]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Plain C scan from pos, also used for the tail the vector loops leave
+static const char* find_scalar(const unsigned char* needle, size_t m, bool fold,
+                               const char* text, size_t len, size_t pos) {
+    const unsigned char* t = (const unsigned char*)text;
+    for (; pos + m <= len; pos++) {
+        unsigned char a = fold ? grep_scan_fold(t[pos]) : t[pos];
+        unsigned char b = fold ? grep_scan_fold(t[pos + m - 1]) : t[pos + m - 1];
+        if (a == needle[0] && b == needle[m - 1] && verify(needle, m, fold, text + pos)) {
+            return text + pos;
+        }
+    }
+    return NULL;
+}
+
+#ifdef GREP_SCAN_X86
+
+__attribute__((target("sse2")))
+static inline __m128i fold_sse2(__m128i v) {
+    // Bytes >= 0x80 compare as negative, so only 'A'..'Z' are selected
+    __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                                  _mm_cmpgt_epi8(_mm_set1_epi8('Z' + 1), v));
+    return _mm_or_si128(v, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+__attribute__((target("sse2")))
+static const char* find_sse2(const unsigned char* needle, size_t m, bool fold,
+                             const char* text, size_t len) {
+    const __m128i first = _mm_set1_epi8((char)needle[0]);
+    const __m128i last = _mm_set1_epi8((char)needle[m - 1]);
+    size_t pos = 0;
+
+    for (; pos + m - 1 + 16 <= len; pos += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i*)(text + pos));
+        __m128i b = _mm_loadu_si128((const __m128i*)(text + pos + m - 1));
+        if (fold) {
+            a = fold_sse2(a);
+            b = fold_sse2(b);
+        }
+        unsigned mask = (unsigned)_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(a, first), _mm_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            size_t at = pos + (size_t)__builtin_ctz(mask);
+            if (verify(needle, m, fold, text + at)) {
+                return text + at;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(needle, m, fold, text, len, pos);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i fold_avx2(__m256i v) {
+    __m256i upper = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8('A' - 1)),
+                                     _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), v));
+    return _mm256_or_si256(v, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static const char* find_avx2(const unsigned char* needle, size_t m, bool fold,
+                             const char* text, size_t len) {
+    const __m256i first = _mm256_set1_epi8((char)needle[0]);
+    const __m256i last = _mm256_set1_epi8((char)needle[m - 1]);
+    size_t pos = 0;
+
+    for (; pos + m - 1 + 32 <= len; pos += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(text + pos));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(text + pos + m - 1));
+        if (fold) {
+            a = fold_avx2(a);
+            b = fold_avx2(b);
+        }
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(a, first), _mm256_cmpeq_epi8(b, last)));
+        while (mask != 0) {
+            size_t at = pos + (size_t)__builtin_ctz(mask);
+            if (verify(needle, m, fold, text + at)) {
+                return text + at;
+            }
+            mask &= mask - 1;
+        }
+    }
+    return find_scalar(needle, m, fold, text, len, pos);
+}
+
+__attribute__((target("sse2")))
+static size_t count_sse2(const char* text, size_t len, unsigned char c) {
+    const __m128i needle = _mm_set1_epi8((char)c);
+    size_t pos = 0, count = 0;
+
+    for (; pos + 16 <= len; pos += 16) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(text + pos));
+        count += (size_t)__builtin_popcount((unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, needle)));
+    }
+    for (; pos < len; pos++) {
+        count += (unsigned char)text[pos] == c;
+    }
+    return count;
+}
+
+__attribute__((target("avx2")))
+static const char* byte_avx2(const char* text, size_t len, unsigned char c) {
+    const __m256i needle = _mm256_set1_epi8((char)c);
+    size_t pos = 0;
+
+    for (; pos + 32 <= len; pos += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(text + pos));
+        uint32_t mask = (uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle));
+        if (mask != 0) {
+            return text + pos + __builtin_ctz(mask);
+        }
+    }
+    return (const char*)memchr(text + pos, c, len - pos);
+}
+
+__attribute__((target("avx2")))
+static size_t count_avx2(const char* text, size_t len, unsigned char c) {
+    const __m256i needle = _mm256_set1_epi8((char)c);
+    size_t pos = 0, count = 0;
+
+    for (; pos + 32 <= len; pos += 32) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(text + pos));
+        count += (size_t)__builtin_popcount((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, needle)));
+    }
+    return count + count_sse2(text + pos, len - pos, c);
+}
+
+#endif // GREP_SCAN_X86
+
+// First occurrence of needle[0, m) in text[0, len), m >= 1
+const char* grep_scan_find(const unsigned char* needle, size_t m, bool fold,
+                           const char* text, size_t len) {
+    if (m == 0 || m > len) {
+        return m == 0 ? text : NULL;
+    }
+    if (m == 1 && !fold) {
+        return grep_scan_byte(text, len, needle[0]);
+    }
+
+    switch (grep_scan_level()) {
+#ifdef GREP_SCAN_X86
+    case GREP_SCAN_AVX2:
+        return find_avx2(needle, m, fold, text, len);
+    case GREP_SCAN_SSE2:
+        return find_sse2(needle, m, fold, text, len);
+#endif
+    default:
+        return find_scalar(needle, m, fold, text, len, 0);
+    }
+}
+
+// First c in text[0, len), or NULL
+const char* grep_scan_byte(const char* text, size_t len, unsigned char c) {
+#ifdef GREP_SCAN_X86
+    if (grep_scan_level() == GREP_SCAN_AVX2) {
+        return byte_avx2(text, len, c);
+    }
+#endif
+    // libc's memchr is already an SSE2 loop on x86
+    return (const char*)memchr(text, c, len);
+}
+
+// Number of c in text[0, len)
+size_t grep_scan_count(const char* text, size_t len, unsigned char c) {
+    switch (grep_scan_level()) {
+#ifdef GREP_SCAN_X86
+    case GREP_SCAN_AVX2:
+        return count_avx2(text, len, c);
+    case GREP_SCAN_SSE2:
+        return count_sse2(text, len, c);
+#endif
+    default: {
+        size_t count = 0;
+        for (size_t pos = 0; pos < len; pos++) {
+            count += (unsigned char)text[pos] == c;
+        }
+        return count;
+    }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef GREP_SCAN_H
+#define GREP_SCAN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Vector scan kernels used by the pattern search and line splitting.
+//
+// The kernel is picked once from the CPU's features (AVX2, then SSE2, then
+// plain C). Pattern search filters candidate positions by comparing the
+// needle's first and last bytes against a whole vector of text at a time and
+// only verifies the bytes in between for candidates; with case folding the
+// text is lowered in-register, so -i costs a few extra instructions per
+// vector rather than a table lookup per byte.
+
+typedef enum {
+    GREP_SCAN_SCALAR = 0,
+    GREP_SCAN_SSE2,
+    GREP_SCAN_AVX2,
+} GrepScanLevel;
+
+// Level in use (detected on first call)
+GrepScanLevel grep_scan_level(void);
+
+// Use at most level (for tests and benchmarks); returns the level in use
+GrepScanLevel grep_scan_set_level(GrepScanLevel level);
+
+// ASCII case fold, the same mapping the vector kernels apply
+static inline unsigned char grep_scan_fold(unsigned char c) {
+    return (c >= 'A' && c <= 'Z') ? (unsigned char)(c + ('a' - 'A')) : c;
+}
+
+// First occurrence of needle[0, m) in text[0, len), m >= 1. With fold the
+// needle must already be folded and text is folded while comparing.
+const char* grep_scan_find(const unsigned char* needle, size_t m, bool fold,
+                           const char* text, size_t len);
+
+// First c in text[0, len), or NULL
+const char* grep_scan_byte(const char* text, size_t len, unsigned char c);
+
+// Number of c in text[0, len)
+size_t grep_scan_count(const char* text, size_t len, unsigned char c);
+
+#endif // GREP_SCAN_H
@@ -1,7 +1,53 @@
 #include "grep.h"
+#include "grep_arena.h"
+#include "grep_index.h"
+#include "grep_output.h"
+#include "grep_scan.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Records the files grep_search_paths emits, in order
+typedef struct {
+    char order[4096];
+    size_t matches;
+} WalkLog;
+
+static void walk_collect(GrepResult* result, void* ctx) {
+    WalkLog* log = (WalkLog*)ctx;
+    strncat(log->order, result->filename, sizeof(log->order) - strlen(log->order) - 2);
+    strcat(log->order, " ");
+    log->matches += result->count;
+    grep_result_destroy(result);
+}
+
+// Compares streamed matches against a collected GrepResult
+typedef struct {
+    const GrepResult* expected;
+    size_t seen;
+    size_t mismatches;
+    size_t limit;       // Stop after this many matches (0: never)
+} StreamCheck;
+
+static bool stream_check(const GrepMatch* match, const char* line, void* ctx) {
+    StreamCheck* check = (StreamCheck*)ctx;
+    const GrepResult* expected = check->expected;
+    if (check->seen >= expected->count) {
+        check->mismatches++;
+    } else {
+        const GrepMatch* want = &expected->matches[check->seen];
+        if (match->line_number != want->line_number || match->offset != want->offset ||
+            match->length != want->length ||
+            memcmp(line, grep_match_line(expected, want), match->length) != 0) {
+            check->mismatches++;
+        }
+    }
+    check->seen++;
+    return check->limit == 0 || check->seen < check->limit;
+}
 
 int main(int argc, char* argv[]) {
     // Create test file
@@ -21,19 +67,14 @@ int main(int argc, char* argv[]) {
     fclose(f);
     
     // Create GrepOptions
-    GrepOptions* opts = (GrepOptions*)malloc(sizeof(GrepOptions));
+    GrepOptions* opts = grep_options_create();
     if (opts == NULL) {
         fprintf(stderr, "Failed to allocate GrepOptions\n");
         return 1;
     }
     
     opts->pattern = strdup("test");
-    opts->recursive = false;
-    opts->case_insensitive = false;
     opts->line_number = true;
-    opts->invert_match = false;
-    opts->paths = NULL;
-    opts->path_count = 0;
     
     printf("=== Test 1: Basic pattern matching with line numbers ===\n");
     printf("Pattern: 'test'\n");
@@ -55,6 +96,16 @@ int main(int argc, char* argv[]) {
         printf("ERROR: Expected 2 matches, got %zu\n", result->count);
     } else {
         printf("PASS: Found correct number of matches\n");
+        
+        // Matches refer into the file's data and share one filename
+        const GrepMatch* second = &result->matches[1];
+        if (second->filename != result->matches[0].filename || second->line_number != 5 ||
+            second->length != strlen("test pattern here") ||
+            memcmp(grep_match_line(result, second), "test pattern here", second->length) != 0) {
+            printf("ERROR: Match does not point at line 5\n");
+        } else {
+            printf("PASS: Match offsets point into the file\n");
+        }
     }
     
     grep_result_destroy(result);
@@ -141,6 +192,818 @@ int main(int argc, char* argv[]) {
     
     grep_result_destroy(result);
     
+    // Test 5: Compiled pattern search
+    printf("\n=== Test 5: Compiled pattern search ===\n");
+    {
+        struct {
+            const char* pattern;
+            const char* text;
+            bool case_insensitive;
+            long expected;  // Offset of the first match, -1 for none
+        } cases[] = {
+            {"test", "this is a test", false, 10},
+            {"TEST", "this is a test", false, -1},
+            {"TEST", "this is a TeSt", true, 10},
+            {"abcab", "abcadabcabcab", false, 5},
+            {"a", "bbba", false, 3},
+            {"A", "bbba", true, 3},
+            {"", "anything", false, 0},
+            {"longer than text", "short", false, -1},
+            {"xx", "axax", false, -1},
+        };
+        size_t failed = 0;
+
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+            GrepPattern* compiled = grep_pattern_compile(cases[i].pattern, cases[i].case_insensitive);
+            const char* hit = grep_pattern_search(compiled, cases[i].text, strlen(cases[i].text));
+            long offset = hit == NULL ? -1 : (long)(hit - cases[i].text);
+            if (offset != cases[i].expected) {
+                printf("ERROR: '%s' in '%s': expected %ld, got %ld\n",
+                       cases[i].pattern, cases[i].text, cases[i].expected, offset);
+                failed++;
+            }
+            if (grep_match_pattern(cases[i].pattern, cases[i].text, cases[i].case_insensitive) !=
+                (cases[i].expected >= 0)) {
+                printf("ERROR: grep_match_pattern disagrees for '%s'\n", cases[i].pattern);
+                failed++;
+            }
+            grep_pattern_destroy(compiled);
+        }
+
+        if (failed == 0) {
+            printf("PASS: Compiled search finds the first occurrence\n");
+        }
+    }
+    
+    // Test 6: Vector kernels agree with the scalar kernel
+    printf("\n=== Test 6: Scan kernels ===\n");
+    {
+        char text[1000];
+        const char* needles[] = {"ab", "aBa", "b", "B", "abcab", "zz", "bab\xe1", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa"};
+        unsigned seed = 12345;
+        size_t failed = 0;
+
+        // Small alphabet (with a high byte) so candidates and near misses are frequent
+        for (size_t i = 0; i < sizeof(text); ++i) {
+            seed = seed * 1103515245 + 12345;
+            text[i] = "abAB\n\xe1"[(seed >> 16) % 6];
+        }
+
+        GrepScanLevel best = grep_scan_level();
+        for (size_t n = 0; n < sizeof(needles) / sizeof(needles[0]); ++n) {
+            for (int fold = 0; fold <= 1; ++fold) {
+                unsigned char needle[64];
+                size_t m = strlen(needles[n]);
+                for (size_t j = 0; j < m; ++j) {
+                    needle[j] = fold ? grep_scan_fold((unsigned char)needles[n][j]) : (unsigned char)needles[n][j];
+                }
+                for (size_t start = 0; start < 40; ++start) {
+                    size_t len = sizeof(text) - start * 7;
+                    grep_scan_set_level(GREP_SCAN_SCALAR);
+                    const char* want = grep_scan_find(needle, m, fold, text + start, len - start);
+                    size_t want_count = grep_scan_count(text + start, len - start, '\n');
+                    for (int level = GREP_SCAN_SSE2; level <= (int)best; ++level) {
+                        grep_scan_set_level((GrepScanLevel)level);
+                        if (grep_scan_find(needle, m, fold, text + start, len - start) != want ||
+                            grep_scan_count(text + start, len - start, '\n') != want_count ||
+                            grep_scan_byte(text + start, len - start, '\n') !=
+                                memchr(text + start, '\n', len - start)) {
+                            failed++;
+                        }
+                    }
+                }
+            }
+        }
+        grep_scan_set_level(best);
+
+        if (failed != 0) {
+            printf("ERROR: %zu kernel mismatches\n", failed);
+        } else {
+            printf("PASS: Kernels agree (best level %d)\n", (int)best);
+        }
+    }
+    
+    // Test 7: Arena allocation
+    printf("\n=== Test 7: Arena allocation ===\n");
+    {
+        GrepArena* arena = grep_arena_create(256);
+        size_t failed = 0;
+        int* values = NULL;
+        size_t capacity = 0;
+        char* copies[10];
+
+        // Grow an array past the chunk size while interleaving other allocations
+        for (int i = 0; arena != NULL && i < 1000; ++i) {
+            if ((size_t)i == capacity) {
+                size_t grown = capacity == 0 ? 4 : capacity * 2;
+                values = (int*)grep_arena_grow(arena, values, capacity * sizeof(int), grown * sizeof(int));
+                capacity = grown;
+            }
+            values[i] = i;
+            if (i % 100 == 0) {
+                copies[i / 100] = grep_arena_strdup(arena, "interned");
+            }
+        }
+        for (int i = 0; arena != NULL && i < 1000; ++i) {
+            if (values[i] != i) {
+                failed++;
+            }
+        }
+        // Resizing the array's own chunk leaves the small allocations alone
+        for (size_t i = 0; arena != NULL && i < sizeof(copies) / sizeof(copies[0]); ++i) {
+            if (copies[i] == NULL || strcmp(copies[i], "interned") != 0) {
+                failed++;
+            }
+        }
+
+        if (arena == NULL || failed != 0) {
+            printf("ERROR: Arena lost data (%zu mismatches)\n", failed);
+        } else {
+            printf("PASS: Arena keeps grown and interned data\n");
+        }
+        grep_arena_destroy(arena);
+    }
+    
+    // Test 8: Parallel recursive search keeps sequential order
+    printf("\n=== Test 8: Parallel recursive search ===\n");
+    {
+        const char* dirs[] = {"grep_test_tree", "grep_test_tree/b", "grep_test_tree/a", "grep_test_tree/a/c"};
+        const char* files[] = {"grep_test_tree/z.txt", "grep_test_tree/b/1.txt", "grep_test_tree/a/2.txt",
+                               "grep_test_tree/a/c/3.txt", "grep_test_tree/a/1.txt", "grep_test_tree/m.txt"};
+        const char* expected = "grep_test_tree/a/1.txt grep_test_tree/a/2.txt grep_test_tree/a/c/3.txt "
+                               "grep_test_tree/b/1.txt grep_test_tree/m.txt grep_test_tree/z.txt ";
+        for (size_t i = 0; i < sizeof(dirs) / sizeof(dirs[0]); ++i) {
+            mkdir(dirs[i], 0755);
+        }
+        for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+            FILE* tf = fopen(files[i], "w");
+            if (tf != NULL) {
+                fprintf(tf, "test one\nnothing\ntest two\n");
+                fclose(tf);
+            }
+        }
+
+        char* tree = strdup("grep_test_tree");
+        opts->paths = &tree;
+        opts->path_count = 1;
+        opts->recursive = true;
+        size_t failed = 0;
+
+        // Reading files in physical order must not change the output order
+        for (int physical = 0; physical <= 1; ++physical) {
+            opts->physical_order = physical;
+            for (int threads = 1; threads <= 8; threads *= 2) {
+                WalkLog log = {{0}, 0};
+                opts->threads = threads;
+                if (grep_search_paths(opts, walk_collect, &log) != 0 ||
+                    strcmp(log.order, expected) != 0 || log.matches != 12) {
+                    printf("ERROR: %d threads%s: order '%s', %zu matches\n", threads,
+                           physical ? " (physical order)" : "", log.order, log.matches);
+                    failed++;
+                }
+            }
+        }
+        if (failed == 0) {
+            printf("PASS: Every thread count emits files in sequential order\n");
+        }
+        opts->physical_order = false;
+
+        opts->paths = NULL;
+        opts->path_count = 0;
+        opts->recursive = false;
+        free(tree);
+        for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+            remove(files[i]);
+        }
+        for (size_t i = sizeof(dirs) / sizeof(dirs[0]); i-- > 0;) {
+            remove(dirs[i]);
+        }
+    }
+    
+    // Test 9: Splitting a large file across threads
+    printf("\n=== Test 9: Intra-file parallel search ===\n");
+    {
+        // Comfortably past the 16 MiB split threshold
+        const char* big_file = "grep_test_big.txt";
+        FILE* bf = fopen(big_file, "w");
+        for (int i = 0; bf != NULL && i < 700000; ++i) {
+            fprintf(bf, i % 7 == 0 ? "line %d has a test in it\n" : "line %d is plain filler\n", i);
+        }
+        if (bf != NULL) {
+            fclose(bf);
+        }
+
+        size_t failed = 0;
+        opts->line_number = true;
+        for (int invert = 0; invert <= 1; ++invert) {
+            opts->invert_match = invert;
+            opts->threads = 1;
+            GrepResult* sequential = grep_search_file(opts, big_file);
+            opts->threads = 4;
+            GrepResult* parallel = grep_search_file(opts, big_file);
+
+            if (sequential == NULL || parallel == NULL || sequential->count != parallel->count) {
+                failed++;
+            } else {
+                for (size_t i = 0; i < sequential->count; ++i) {
+                    if (sequential->matches[i].line_number != parallel->matches[i].line_number ||
+                        sequential->matches[i].offset != parallel->matches[i].offset ||
+                        sequential->matches[i].length != parallel->matches[i].length) {
+                        failed++;
+                        break;
+                    }
+                }
+            }
+            grep_result_destroy(sequential);
+            grep_result_destroy(parallel);
+        }
+        opts->invert_match = false;
+        opts->line_number = false;
+        opts->threads = 0;
+        remove(big_file);
+
+        if (failed != 0) {
+            printf("ERROR: Parallel search differs from sequential search\n");
+        } else {
+            printf("PASS: Parallel search matches sequential search\n");
+        }
+    }
+    
+    // Test 10: Multi-pattern search agrees with one search per pattern
+    printf("\n=== Test 10: Multi-pattern search ===\n");
+    {
+        const char* keywords[] = {"he", "she", "his", "hers", "ushe", "Ab", "bab", "aab"};
+        size_t keyword_count = sizeof(keywords) / sizeof(keywords[0]);
+        unsigned seed = 777;
+        size_t failed = 0;
+
+        for (int round = 0; round < 400; ++round) {
+            char text[64];
+            size_t len = (size_t)(round % 60);
+            for (size_t i = 0; i < len; ++i) {
+                seed = seed * 1103515245 + 12345;
+                text[i] = "hesriuaAbB"[(seed >> 16) % 10];
+            }
+            text[len] = '\0';
+
+            bool case_insensitive = round % 2 == 1;
+            GrepPattern* set = grep_pattern_compile_set(keywords, keyword_count, case_insensitive);
+            const char* hit = grep_pattern_search(set, text, len);
+
+            // Expected: smallest end position over all keywords
+            const char* best_end = NULL;
+            for (size_t k = 0; k < keyword_count; ++k) {
+                GrepPattern* one = grep_pattern_compile(keywords[k], case_insensitive);
+                const char* at = grep_pattern_search(one, text, len);
+                if (at != NULL && (best_end == NULL || at + strlen(keywords[k]) < best_end)) {
+                    best_end = at + strlen(keywords[k]);
+                }
+                grep_pattern_destroy(one);
+            }
+            if ((hit == NULL) != (best_end == NULL) || (hit != NULL && hit >= best_end)) {
+                failed++;
+            }
+            grep_pattern_destroy(set);
+        }
+
+        // -e patterns combine with the main pattern
+        GrepOptions* set_opts = grep_options_create();
+        set_opts->pattern = strdup("test");
+        grep_options_add_pattern(set_opts, "another");
+        grep_options_add_pattern(set_opts, "no match");
+        GrepResult* result_set = grep_search_file(set_opts, test_file);
+        if (result_set == NULL || result_set->count != 4) {
+            failed++;
+        }
+        grep_result_destroy(result_set);
+        grep_options_destroy(set_opts);
+
+        if (failed != 0) {
+            printf("ERROR: %zu multi-pattern mismatches\n", failed);
+        } else {
+            printf("PASS: Multi-pattern search finds the earliest-ending keyword\n");
+        }
+    }
+    
+    // Test 11: Extended regular expressions
+    printf("\n=== Test 11: Extended regular expressions ===\n");
+    {
+        struct {
+            const char* pattern;
+            const char* line;
+            bool case_insensitive;
+            bool expected;
+        } cases[] = {
+            {"te?st", "this is a tst", false, true},
+            {"^hello", "say hello", false, false},
+            {"world$", "hello world", false, true},
+            {"^$", "", false, true},
+            {"(ab|cd)+e", "xxcdabe", false, true},
+            {"[0-9]{3}-[0-9]{4}", "call 555-1234 now", false, true},
+            {"[0-9]{3}-[0-9]{4}", "call 55-1234 now", false, false},
+            {"[[:upper:]][a-z]+", "hello World", false, true},
+            {"HELLO w.rld", "hello world", true, true},
+            {"[^a-z ]", "only lower case", false, false},
+            {"(a|b)*abb", "babaabb", false, true},
+            {"a\\.c", "abc", false, false},
+            {"(a*)*b", "aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa", false, false},
+        };
+        size_t failed = 0;
+
+        for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i) {
+            GrepPattern* compiled = grep_pattern_compile_regex(&cases[i].pattern, 1, cases[i].case_insensitive, NULL);
+            bool found = compiled != NULL &&
+                         grep_pattern_search(compiled, cases[i].line, strlen(cases[i].line)) != NULL;
+            if (found != cases[i].expected) {
+                printf("ERROR: /%s/ on '%s': expected %d\n", cases[i].pattern, cases[i].line, cases[i].expected);
+                failed++;
+            }
+            grep_pattern_destroy(compiled);
+        }
+
+        const char* error = NULL;
+        const char* broken = "(unclosed";
+        if (grep_pattern_compile_regex(&broken, 1, false, &error) != NULL || error == NULL) {
+            printf("ERROR: Unbalanced parenthesis was accepted\n");
+            failed++;
+        }
+
+        // Long concatenations and pattern lists compile without deep recursion
+        size_t long_len = 20000;
+        char* long_pattern = (char*)malloc(long_len + 1);
+        for (size_t i = 0; i < long_len; ++i) {
+            long_pattern[i] = (char)('a' + i % 26);
+        }
+        long_pattern[long_len] = '\0';
+        const char* long_list[1] = {long_pattern};
+        GrepPattern* compiled = grep_pattern_compile_regex(long_list, 1, false, NULL);
+        if (compiled == NULL || grep_pattern_search(compiled, long_pattern, long_len) == NULL ||
+            grep_pattern_search(compiled, long_pattern, long_len - 1) != NULL) {
+            printf("ERROR: %zu-character pattern did not compile or match\n", long_len);
+            failed++;
+        }
+        grep_pattern_destroy(compiled);
+
+        size_t list_count = 10000;
+        char (*words)[8] = malloc(list_count * sizeof(*words));
+        const char** list = (const char**)malloc(list_count * sizeof(char*));
+        for (size_t i = 0; i < list_count; ++i) {
+            snprintf(words[i], sizeof(words[i]), "w%04zu", i);
+            list[i] = words[i];
+        }
+        compiled = grep_pattern_compile_regex(list, list_count, false, NULL);
+        if (compiled == NULL || grep_pattern_search(compiled, "x w9999 x", 9) == NULL ||
+            grep_pattern_search(compiled, "x w999 x", 8) != NULL) {
+            printf("ERROR: %zu-pattern list did not compile or match\n", list_count);
+            failed++;
+        }
+        grep_pattern_destroy(compiled);
+        free(list);
+        free(words);
+
+        // Stacked bounds nest without parentheses and are refused past the limit
+        strcpy(long_pattern, "a");
+        for (size_t i = 0; i < 6000; ++i) {
+            strcat(long_pattern + 3 * i, "{1}");
+        }
+        error = NULL;
+        if (grep_pattern_compile_regex(long_list, 1, false, &error) != NULL || error == NULL) {
+            printf("ERROR: 6000 stacked bounds were accepted\n");
+            failed++;
+        }
+        free(long_pattern);
+
+        if (failed == 0) {
+            printf("PASS: Regular expressions match as expected\n");
+        }
+    }
+    
+    // Test 12: Streaming search agrees with the collecting search
+    printf("\n=== Test 12: Streaming search ===\n");
+    {
+        // Several read buffers' worth, one line longer than a buffer, and no
+        // final newline
+        const char* stream_file = "grep_test_stream.txt";
+        FILE* sf = fopen(stream_file, "w");
+        for (int i = 0; sf != NULL && i < 120000; ++i) {
+            fprintf(sf, i % 5 == 0 ? "row %d holds a test\n" : "row %d is filler\n", i);
+            if (i == 60000) {
+                for (int j = 0; j < 300000; ++j) {
+                    fputs("long", sf);
+                }
+                fputs(" test\n", sf);
+            }
+        }
+        if (sf != NULL) {
+            fputs("last test without newline", sf);
+            fclose(sf);
+        }
+
+        size_t failed = 0;
+        opts->line_number = true;
+        for (int invert = 0; invert <= 1; ++invert) {
+            opts->invert_match = invert;
+            GrepResult* collected = grep_search_file(opts, stream_file);
+            StreamCheck check = {collected, 0, 0, 0};
+            if (collected == NULL || grep_search_stream(opts, stream_file, stream_check, &check) != 0 ||
+                check.mismatches != 0 || check.seen != collected->count) {
+                failed++;
+            }
+
+            // Returning false stops the search
+            StreamCheck first = {collected, 0, 0, 3};
+            if (collected == NULL || grep_search_stream(opts, stream_file, stream_check, &first) != 0 ||
+                first.seen != 3 || first.mismatches != 0) {
+                failed++;
+            }
+            grep_result_destroy(collected);
+        }
+        opts->invert_match = false;
+        opts->line_number = false;
+        remove(stream_file);
+
+        if (grep_search_stream(opts, "no_such_file.txt", stream_check, NULL) != -1) {
+            failed++;
+        }
+
+        if (failed != 0) {
+            printf("ERROR: Streaming search differs from collected search\n");
+        } else {
+            printf("PASS: Streaming search matches collected search\n");
+        }
+    }
+    
+    // Test 13: Counting, listing, max-count and quiet modes
+    printf("\n=== Test 13: Summary modes ===\n");
+    {
+        size_t failed = 0;
+        GrepOptions* summary = grep_options_create();
+        summary->pattern = strdup("test");
+
+        // "test" is on lines 2 and 5 of test_file
+        summary->count = true;
+        if (grep_count_file(summary, test_file) != 2) {
+            failed++;
+        }
+        GrepResult* counted = grep_search_file(summary, test_file);
+        if (counted == NULL || counted->count != 2 || counted->matches != NULL) {
+            failed++;
+        }
+        grep_result_destroy(counted);
+
+        summary->max_count = 1;
+        if (grep_count_file(summary, test_file) != 1) {
+            failed++;
+        }
+        summary->count = false;
+        GrepResult* limited = grep_search_file(summary, test_file);
+        if (limited == NULL || limited->count != 1) {
+            failed++;
+        }
+        grep_result_destroy(limited);
+        summary->max_count = -1;
+
+        // -l, -L and -q only need the first selected line
+        summary->files_with_matches = true;
+        if (grep_count_file(summary, test_file) != 1) {
+            failed++;
+        }
+        summary->files_with_matches = false;
+
+        summary->quiet = true;
+        summary->paths = (char**)&test_file;
+        summary->path_count = 1;
+        if (grep_search_paths(summary, NULL, NULL) != 0) {
+            failed++;
+        }
+        free(summary->pattern);
+        summary->pattern = strdup("absent");
+        if (grep_search_paths(summary, NULL, NULL) != 1) {
+            failed++;
+        }
+        summary->paths = NULL;
+        summary->path_count = 0;
+        grep_options_destroy(summary);
+
+        if (failed != 0) {
+            printf("ERROR: %zu summary mode checks failed\n", failed);
+        } else {
+            printf("PASS: Summary modes count and stop as expected\n");
+        }
+    }
+    
+    // Test 14: Trigram index narrows the files searched
+    printf("\n=== Test 14: Trigram index ===\n");
+    {
+        const char* dir = "grep_test_index";
+        const char* files[] = {"grep_test_index/a.txt", "grep_test_index/b.txt", "grep_test_index/c.txt"};
+        const char* contents[] = {"alpha beta\n", "gamma delta\n", "ALPHAbet soup\n"};
+        const char* index_path = "grep_test_index.idx";
+        mkdir(dir, 0755);
+        for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+            FILE* tf = fopen(files[i], "w");
+            if (tf != NULL) {
+                fputs(contents[i], tf);
+                fclose(tf);
+            }
+        }
+
+        size_t failed = 0;
+        GrepOptions* query = grep_options_create();
+        query->pattern = strdup("alpha");
+        query->case_insensitive = true;
+        char** candidates = NULL;
+
+        GrepIndex* index = grep_index_build(dir, index_path) == 0 ? grep_index_open(index_path) : NULL;
+        if (index == NULL || grep_index_file_count(index) != 3 ||
+            grep_index_candidates(index, query, &candidates) != 2) {
+            failed++;
+        }
+        free(candidates);
+        WalkLog log = {{0}, 0};
+        if (index == NULL || grep_index_search(index, query, walk_collect, &log) != 0 ||
+            strcmp(log.order, "grep_test_index/a.txt grep_test_index/c.txt ") != 0 || log.matches != 2) {
+            failed++;
+        }
+
+        // A file changed since the build is searched even before the update
+        free(query->pattern);
+        query->pattern = strdup("zeta");
+        FILE* tf = fopen(files[1], "w");
+        if (tf != NULL) {
+            fputs("zeta epsilon\n", tf);
+            fclose(tf);
+        }
+        if (index == NULL || grep_index_candidates(index, query, &candidates) != 1) {
+            failed++;
+        }
+        free(candidates);
+        grep_index_close(index);
+
+        index = grep_index_update(dir, index_path) == 0 ? grep_index_open(index_path) : NULL;
+        log.order[0] = '\0';
+        log.matches = 0;
+        if (index == NULL || grep_index_search(index, query, walk_collect, &log) != 0 || log.matches != 1) {
+            failed++;
+        }
+        grep_index_close(index);
+
+        // Paths resolve against the index, not the working directory
+        if (chdir(dir) == 0) {
+            index = grep_index_open("../grep_test_index.idx");
+            log.order[0] = '\0';
+            log.matches = 0;
+            if (index == NULL || grep_index_search(index, query, walk_collect, &log) != 0 ||
+                strcmp(log.order, "../grep_test_index/b.txt ") != 0 || log.matches != 1) {
+                failed++;
+            }
+            grep_index_close(index);
+            if (chdir("..") != 0) {
+                failed++;
+            }
+        } else {
+            failed++;
+        }
+        grep_options_destroy(query);
+
+        for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+            remove(files[i]);
+        }
+        remove(dir);
+        remove(index_path);
+
+        if (failed != 0) {
+            printf("ERROR: %zu index checks failed\n", failed);
+        } else {
+            printf("PASS: Index finds the candidate files\n");
+        }
+    }
+    
+    // Test 15: Binary files and walk filters
+    printf("\n=== Test 15: Binary files and excludes ===\n");
+    {
+        const char* dir = "grep_test_bin";
+        const char* files[] = {"grep_test_bin/data.bin", "grep_test_bin/skip.o", "grep_test_bin/text.txt"};
+        const char contents[][24] = {"needle\0x\nneedle\n", "needle\n", "needle\n"};
+        const size_t lengths[] = {16, 7, 7};
+        mkdir(dir, 0755);
+        for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+            FILE* tf = fopen(files[i], "w");
+            if (tf != NULL) {
+                fwrite(contents[i], 1, lengths[i], tf);
+                fclose(tf);
+            }
+        }
+
+        size_t failed = 0;
+        GrepOptions* filter = grep_options_create();
+        filter->pattern = strdup("needle");
+
+        // Stops at the first match, flagged as binary
+        GrepResult* binary = grep_search_file(filter, files[0]);
+        if (binary == NULL || binary->count != 1 || !binary->matches[0].binary) {
+            failed++;
+        }
+        grep_result_destroy(binary);
+        filter->binary_files = GREP_BINARY_TEXT;
+        binary = grep_search_file(filter, files[0]);
+        if (binary == NULL || binary->count != 2 || binary->matches[0].binary) {
+            failed++;
+        }
+        grep_result_destroy(binary);
+
+        // *.o never reaches the search; -I selects nothing in data.bin
+        char* root = strdup(dir);
+        filter->paths = &root;
+        filter->path_count = 1;
+        filter->recursive = true;
+        filter->binary_files = GREP_BINARY_SKIP;
+        grep_options_add_exclude(filter, "*.o");
+        WalkLog log = {{0}, 0};
+        if (grep_search_paths(filter, walk_collect, &log) != 0 ||
+            strcmp(log.order, "grep_test_bin/data.bin grep_test_bin/text.txt ") != 0 || log.matches != 1) {
+            failed++;
+        }
+
+        // Files over the size limit are skipped too
+        filter->max_file_size = 7;
+        filter->binary_files = GREP_BINARY_MATCHES;
+        log.order[0] = '\0';
+        log.matches = 0;
+        if (grep_search_paths(filter, walk_collect, &log) != 0 || strcmp(log.order, "grep_test_bin/text.txt ") != 0) {
+            failed++;
+        }
+        filter->paths = NULL;
+        filter->path_count = 0;
+        free(root);
+        grep_options_destroy(filter);
+
+        for (size_t i = 0; i < sizeof(files) / sizeof(files[0]); ++i) {
+            remove(files[i]);
+        }
+        remove(dir);
+
+        if (failed != 0) {
+            printf("ERROR: %zu binary/exclude checks failed\n", failed);
+        } else {
+            printf("PASS: Binary files and excludes are handled\n");
+        }
+    }
+    // Test 16: Buffered output
+    printf("\n=== Test 16: Buffered output ===\n");
+    {
+        FILE* sink = tmpfile();
+        // A tiny buffer, so records both fill it and overflow it
+        GrepWriter* writer = sink != NULL ? grep_writer_create(fileno(sink), NULL, 16) : NULL;
+        char long_line[64];
+        memset(long_line, 'x', sizeof(long_line));
+
+        GrepMatch numbered = {"a.txt", 12, false, 0, 5};
+        GrepMatch plain = {"b.txt", 0, false, 0, sizeof(long_line)};
+        GrepMatch binary = {"c.bin", 3, true, 0, 0};
+        GrepResult counted = {NULL, 7, 0, "d.txt", NULL, 0, false, NULL};
+        GrepOptions* count_opts = grep_options_create();
+        count_opts->count = true;
+
+        bool ok = writer != NULL;
+        ok = ok && grep_writer_match(writer, &numbered, "hello");
+        ok = ok && grep_writer_match(writer, &plain, long_line);
+        ok = ok && grep_writer_match(writer, &binary, NULL);
+        ok = ok && grep_writer_summary(writer, count_opts, &counted);
+        ok = ok && grep_writer_flush(writer);
+        grep_writer_destroy(writer);
+        grep_options_destroy(count_opts);
+
+        char expected[256];
+        snprintf(expected, sizeof(expected), "a.txt:12:hello\nb.txt:%.*s\nBinary file c.bin matches\nd.txt:7\n",
+                 (int)sizeof(long_line), long_line);
+        char written[256] = {0};
+        if (sink != NULL) {
+            rewind(sink);
+            fread(written, 1, sizeof(written) - 1, sink);
+            fclose(sink);
+        }
+
+        if (!ok || strcmp(written, expected) != 0) {
+            printf("ERROR: Writer produced \"%s\"\n", written);
+        } else {
+            printf("PASS: Writer formats, overflows and flushes records in order\n");
+        }
+    }
+
+    // Test 17: Compressed files
+    printf("\n=== Test 17: Compressed files ===\n");
+    {
+        const char* plain_name = "grep_test_plain.txt";
+        const char* gz_name = "grep_test_plain.txt.gz";
+        size_t failed = 0;
+
+        // Enough text to span several read buffers, written as two gzip
+        // members the way appending to a .gz does
+        FILE* plain = fopen(plain_name, "w");
+        for (int member = 0; member < 2; ++member) {
+            gzFile gz = gzopen(gz_name, member == 0 ? "wb" : "ab");
+            for (int i = 0; i < 100000; ++i) {
+                char line[64];
+                int len = snprintf(line, sizeof(line), "%s line %d of member %d\n",
+                                   i % 1000 == 0 ? "marker" : "filler", i, member);
+                if (plain != NULL) {
+                    fwrite(line, 1, (size_t)len, plain);
+                }
+                if (gz != NULL) {
+                    gzwrite(gz, line, (unsigned)len);
+                }
+            }
+            if (gz != NULL) {
+                gzclose(gz);
+            }
+        }
+        if (plain != NULL) {
+            fclose(plain);
+        }
+
+        GrepOptions* zopts = grep_options_create();
+        zopts->pattern = strdup("marker");
+        zopts->line_number = true;
+        zopts->decompress = true;
+
+        // The decompressed file matches exactly as the plain one does
+        GrepResult* expected = grep_search_file(zopts, plain_name);
+        GrepResult* unpacked = grep_search_file(zopts, gz_name);
+        if (expected == NULL || unpacked == NULL || expected->count != 200 || unpacked->count != expected->count) {
+            failed++;
+        } else {
+            for (size_t i = 0; i < expected->count; ++i) {
+                const GrepMatch* want = &expected->matches[i];
+                const GrepMatch* got = &unpacked->matches[i];
+                if (got->line_number != want->line_number || got->length != want->length ||
+                    memcmp(grep_match_line(unpacked, got), grep_match_line(expected, want), want->length) != 0) {
+                    failed++;
+                    break;
+                }
+            }
+        }
+
+        StreamCheck check = {expected, 0, 0, 0};
+        if (expected == NULL || grep_search_stream(zopts, gz_name, stream_check, &check) != 0 ||
+            check.seen != expected->count || check.mismatches != 0) {
+            failed++;
+        }
+        grep_result_destroy(unpacked);
+        grep_result_destroy(expected);
+
+        if (grep_count_file(zopts, gz_name) != 200) {
+            failed++;
+        }
+
+        // Zero padding after the last member is ignored, as gzip does
+        FILE* padded = fopen(gz_name, "ab");
+        if (padded != NULL) {
+            char zeros[512] = {0};
+            fwrite(zeros, 1, sizeof(zeros), padded);
+            fclose(padded);
+        }
+        if (padded == NULL || grep_count_file(zopts, gz_name) != 200) {
+            failed++;
+        }
+
+        // An empty first line is collected like any other
+        gzFile blank = gzopen(gz_name, "wb");
+        if (blank != NULL) {
+            gzwrite(blank, "\nfiller\n", 8);
+            gzclose(blank);
+        }
+        zopts->invert_match = true;
+        free(zopts->pattern);
+        zopts->pattern = strdup("filler");
+        GrepResult* empty = grep_search_file(zopts, gz_name);
+        if (blank == NULL || empty == NULL || empty->count != 1 || empty->matches[0].length != 0 ||
+            empty->matches[0].line_number != 1) {
+            failed++;
+        }
+        grep_result_destroy(empty);
+        zopts->invert_match = false;
+
+        // Without decompress the .gz is just a binary file holding the magic
+        zopts->decompress = false;
+        free(zopts->pattern);
+        zopts->pattern = strdup("\x1f\x8b");
+        GrepResult* packed = grep_search_file(zopts, gz_name);
+        if (packed == NULL || packed->count != 1 || !packed->matches[0].binary) {
+            failed++;
+        }
+        grep_result_destroy(packed);
+        grep_options_destroy(zopts);
+        remove(plain_name);
+        remove(gz_name);
+
+        if (failed != 0) {
+            printf("ERROR: %zu compressed file checks failed\n", failed);
+        } else {
+            printf("PASS: Gzip files are searched decompressed\n");
+        }
+    }
+    
     // Cleanup
     grep_options_destroy(opts);
     
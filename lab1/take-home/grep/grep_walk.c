@@ -0,0 +1,723 @@
+#define _GNU_SOURCE
+
+#include "grep.h"
+#include "grep_internal.h"
+#include "grep_output.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <limits.h>
+#include <pthread.h>
+#include <linux/fiemap.h>
+#include <linux/fs.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Files searched by workers whose results may wait for the output stage at
+// once; each holds its arena and mapping until printed
+#define GREP_WALK_AHEAD 1024
+
+// One directory or file to search. Nodes form the tree the ordered output
+// stage walks; a directory's children exist once it is done.
+typedef struct GrepNode {
+    char* path;
+    bool is_dir;
+    bool done;                  // Set under walk->done_lock
+    int error;                  // errno from opening the path, or 0
+    GrepResult* result;         // File nodes
+    struct GrepNode** children; // Directory nodes, sorted by name
+    size_t child_count;
+    bool claimed;               // File taken by a worker or the output stage (under walk->done_lock)
+    bool ahead;                 // Searched by a worker, counted in walk->ahead until emitted
+    bool dequeued;              // Taken by the output stage, then out of its queue too
+    bool emitted;               // Taken by the output stage, and printed
+    uint64_t extent;            // Physical order: disk offset of the data (UINT64_MAX: unknown)
+    ino_t inode;                // Physical order: stands in for extent where it is unknown
+} GrepNode;
+
+// Per-worker task deque: the owner pushes and pops at the bottom (newest
+// first, so a directory's first child runs next), thieves take from the top
+typedef struct {
+    pthread_mutex_t lock;
+    GrepNode** tasks;
+    size_t head, tail, capacity; // Live tasks are [head, tail) modulo capacity
+} GrepDeque;
+
+typedef struct GrepWalk GrepWalk;
+
+typedef struct {
+    GrepWalk* walk;
+    GrepDeque deque;
+    size_t index;
+    pthread_t thread;
+} GrepWorker;
+
+struct GrepWalk {
+    GrepOptions* opts;
+    GrepWorker* workers;
+    size_t worker_count;
+    int file_threads;           // Threads each file may be split across
+    atomic_bool stop;           // -q: some file has a selected line, skip the rest
+    bool found;                 // The output stage saw a selected line
+
+    GrepNode** files;           // Physical order: every file, sorted by location
+    size_t file_count, file_capacity;
+    atomic_size_t next_file;    // Next of files to search
+
+    pthread_mutex_t lock;       // Guards queued and pending
+    pthread_cond_t work;
+    size_t queued;              // Tasks sitting in deques
+    size_t pending;             // Tasks queued or running
+
+    pthread_mutex_t done_lock;  // Guards done, claimed and ahead
+    pthread_cond_t done_cond;
+    size_t ahead;               // Worker results not yet emitted
+};
+
+static void grep_deque_init(GrepDeque* deque) {
+    pthread_mutex_init(&deque->lock, NULL);
+    deque->tasks = NULL;
+    deque->head = 0;
+    deque->tail = 0;
+    deque->capacity = 0;
+}
+
+static void grep_deque_destroy(GrepDeque* deque) {
+    pthread_mutex_destroy(&deque->lock);
+    free(deque->tasks);
+}
+
+static bool grep_deque_push(GrepDeque* deque, GrepNode* node) {
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail - deque->head == deque->capacity) {
+        size_t capacity = deque->capacity == 0 ? 64 : deque->capacity * 2;
+        GrepNode** tasks = (GrepNode**)malloc(capacity * sizeof(GrepNode*));
+        if (tasks == NULL) {
+            pthread_mutex_unlock(&deque->lock);
+            return false;
+        }
+        size_t count = deque->tail - deque->head;
+        for (size_t i = 0; i < count; ++i) {
+            tasks[i] = deque->tasks[(deque->head + i) % deque->capacity];
+        }
+        free(deque->tasks);
+        deque->tasks = tasks;
+        deque->capacity = capacity;
+        deque->head = 0;
+        deque->tail = count;
+    }
+    deque->tasks[deque->tail++ % deque->capacity] = node;
+    pthread_mutex_unlock(&deque->lock);
+    return true;
+}
+
+static GrepNode* grep_deque_pop(GrepDeque* deque) {
+    GrepNode* node = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail != deque->head) {
+        node = deque->tasks[--deque->tail % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return node;
+}
+
+static GrepNode* grep_deque_steal(GrepDeque* deque) {
+    GrepNode* node = NULL;
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail != deque->head) {
+        node = deque->tasks[deque->head++ % deque->capacity];
+    }
+    pthread_mutex_unlock(&deque->lock);
+    return node;
+}
+
+// Ask the kernel to start reading path, so it arrives while the current
+// file is being scanned
+static void grep_prefetch_path(const char* path) {
+    int fd = open(path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd >= 0) {
+        posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+        close(fd);
+    }
+}
+
+// Prefetch the file this deque's owner will take next. The path is copied
+// under the lock, since a thief may take and finish the node.
+static void grep_deque_prefetch(GrepDeque* deque) {
+    char path[PATH_MAX];
+    bool found = false;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->tail != deque->head) {
+        const GrepNode* next = deque->tasks[(deque->tail - 1) % deque->capacity];
+        found = !next->is_dir && strlen(next->path) < sizeof(path);
+        if (found) {
+            strcpy(path, next->path);
+        }
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    if (found) {
+        grep_prefetch_path(path);
+    }
+}
+
+static GrepNode* grep_node_create(char* path, bool is_dir) {
+    GrepNode* node = (GrepNode*)calloc(1, sizeof(GrepNode));
+    if (node == NULL) {
+        free(path);
+        return NULL;
+    }
+    node->path = path;
+    node->is_dir = is_dir;
+    return node;
+}
+
+static void grep_node_destroy(GrepNode* node) {
+    for (size_t i = 0; i < node->child_count; ++i) {
+        if (node->children[i] != NULL) {
+            grep_node_destroy(node->children[i]);
+        }
+    }
+    free(node->children);
+    grep_result_destroy(node->result);
+    free(node->path);
+    free(node);
+}
+
+static void grep_node_finish(GrepWalk* walk, GrepNode* node) {
+    pthread_mutex_lock(&walk->done_lock);
+    node->done = true;
+    pthread_cond_broadcast(&walk->done_cond);
+    pthread_mutex_unlock(&walk->done_lock);
+}
+
+static int grep_compare_names(const void* a, const void* b) {
+    return strcmp(*(char* const*)a + 1, *(char* const*)b + 1);
+}
+
+static char* grep_join_path(const char* dir, const char* name) {
+    size_t dir_len = strlen(dir);
+    bool slash = dir_len > 0 && dir[dir_len - 1] != '/';
+    char* path = (char*)malloc(dir_len + slash + strlen(name) + 1);
+    if (path != NULL) {
+        sprintf(path, slash ? "%s/%s" : "%s%s", dir, name);
+    }
+    return path;
+}
+
+// True if a file found while walking is filtered out by --exclude or the
+// size limit; decided from its name and metadata, before it is opened
+static bool grep_walk_excluded(const GrepOptions* opts, const char* name, const char* path) {
+    for (size_t i = 0; i < opts->exclude_count; ++i) {
+        if (fnmatch(opts->excludes[i], name, 0) == 0) {
+            return true;
+        }
+    }
+
+    struct stat st;
+    return opts->max_file_size > 0 && lstat(path, &st) == 0 && (size_t)st.st_size > opts->max_file_size;
+}
+
+// List a directory into sorted child nodes. Symlinks found while walking are
+// not followed, as with grep -r; excluded files get no node.
+static int grep_expand_dir(const GrepOptions* opts, GrepNode* node) {
+    DIR* dir = opendir(node->path);
+    if (dir == NULL) {
+        return errno;
+    }
+
+    char** names = NULL;
+    size_t count = 0, capacity = 0;
+    struct dirent* entry;
+    int error = 0;
+
+    while ((entry = readdir(dir)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (count == capacity) {
+            capacity = capacity == 0 ? 32 : capacity * 2;
+            char** grown = (char**)realloc(names, capacity * sizeof(char*));
+            if (grown == NULL) {
+                error = ENOMEM;
+                break;
+            }
+            names = grown;
+        }
+        // Entries are stored as d_type followed by the name; sorting compares
+        // from the name on
+        names[count] = (char*)malloc(strlen(entry->d_name) + 2);
+        if (names[count] == NULL) {
+            error = ENOMEM;
+            break;
+        }
+        names[count][0] = (char)entry->d_type;
+        strcpy(names[count] + 1, entry->d_name);
+        count++;
+    }
+    closedir(dir);
+
+    if (error == 0) {
+        qsort(names, count, sizeof(char*), grep_compare_names);
+        node->children = (GrepNode**)calloc(count == 0 ? 1 : count, sizeof(GrepNode*));
+        if (node->children == NULL) {
+            error = ENOMEM;
+        }
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        char* path = error == 0 ? grep_join_path(node->path, names[i] + 1) : NULL;
+        unsigned char type = (unsigned char)names[i][0];
+        free(names[i]);
+        if (path == NULL) {
+            continue;
+        }
+        if (type == DT_UNKNOWN) {
+            struct stat st;
+            if (lstat(path, &st) != 0) {
+                free(path);
+                continue;
+            }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_LNK;
+        }
+        // The entry's name follows the last '/' that grep_join_path added
+        if ((type != DT_DIR && type != DT_REG) ||
+            (type == DT_REG && grep_walk_excluded(opts, strrchr(path, '/') + 1, path))) {
+            free(path);
+            continue;
+        }
+        GrepNode* child = grep_node_create(path, type == DT_DIR);
+        if (child != NULL) {
+            node->children[node->child_count++] = child;
+        }
+    }
+    free(names);
+    return error;
+}
+
+// Queue tasks on worker's own deque and wake idle workers
+static void grep_walk_push(GrepWorker* worker, GrepNode** nodes, size_t count) {
+    GrepWalk* walk = worker->walk;
+    size_t failed = 0;
+
+    // Count the tasks first: a thief may finish one before the loop ends,
+    // and pending must not reach zero while tasks are still being queued
+    pthread_mutex_lock(&walk->lock);
+    walk->queued += count;
+    walk->pending += count;
+    pthread_mutex_unlock(&walk->lock);
+
+    // Reverse order so the owner pops the first child next
+    for (size_t i = count; i-- > 0;) {
+        if (!grep_deque_push(&worker->deque, nodes[i])) {
+            nodes[i]->error = ENOMEM;
+            grep_node_finish(walk, nodes[i]);
+            failed++;
+        }
+    }
+
+    pthread_mutex_lock(&walk->lock);
+    walk->queued -= failed;
+    walk->pending -= failed;
+    pthread_cond_broadcast(&walk->work);
+    pthread_mutex_unlock(&walk->lock);
+}
+
+static GrepNode* grep_walk_take(GrepWorker* worker) {
+    GrepWalk* walk = worker->walk;
+
+    for (;;) {
+        GrepNode* node = grep_deque_pop(&worker->deque);
+        for (size_t i = 1; node == NULL && i < walk->worker_count; ++i) {
+            node = grep_deque_steal(&walk->workers[(worker->index + i) % walk->worker_count].deque);
+        }
+
+        pthread_mutex_lock(&walk->lock);
+        if (node != NULL) {
+            walk->queued--;
+            pthread_mutex_unlock(&walk->lock);
+            return node;
+        }
+        while (walk->queued == 0 && walk->pending > 0) {
+            pthread_cond_wait(&walk->work, &walk->lock);
+        }
+        bool finished = walk->pending == 0;
+        pthread_mutex_unlock(&walk->lock);
+        if (finished) {
+            return NULL;
+        }
+    }
+}
+
+// Take the file node for a worker, first waiting while GREP_WALK_AHEAD
+// results wait for the output stage. False if the output stage took the
+// file meanwhile, as it does with the file it waits on, so a full window
+// never stalls the walk.
+static bool grep_walk_claim(GrepWalk* walk, GrepNode* node) {
+    pthread_mutex_lock(&walk->done_lock);
+    while (walk->ahead >= GREP_WALK_AHEAD && !node->claimed &&
+           !atomic_load_explicit(&walk->stop, memory_order_relaxed)) {
+        pthread_cond_wait(&walk->done_cond, &walk->done_lock);
+    }
+    bool claimed = !node->claimed;
+    bool printed = false;
+    if (claimed) {
+        node->claimed = true;
+        node->ahead = true;
+        walk->ahead++;
+    } else {
+        node->dequeued = true;
+        printed = node->emitted;
+    }
+    pthread_mutex_unlock(&walk->done_lock);
+
+    // See grep_walk_free
+    if (printed) {
+        grep_node_destroy(node);
+    }
+    return claimed;
+}
+
+// Search a file node and publish its result
+static void grep_walk_search(GrepWalk* walk, GrepNode* node) {
+    errno = 0;
+    node->result = grep_search_file_threads(walk->opts, node->path, walk->file_threads);
+    if (node->result == NULL) {
+        node->error = errno != 0 ? errno : EIO;
+    } else if (walk->opts->quiet && node->result->count > 0) {
+        atomic_store_explicit(&walk->stop, true, memory_order_relaxed);
+    }
+    grep_node_finish(walk, node);
+}
+
+static void* grep_walk_worker(void* arg) {
+    GrepWorker* worker = (GrepWorker*)arg;
+    GrepWalk* walk = worker->walk;
+    GrepNode* node;
+
+    while ((node = grep_walk_take(worker)) != NULL) {
+        if (!node->is_dir && !grep_walk_claim(walk, node)) {
+            // The output stage searches this file itself
+        } else if (atomic_load_explicit(&walk->stop, memory_order_relaxed)) {
+            // Drain the remaining tasks without reading anything
+            grep_node_finish(walk, node);
+        } else if (node->is_dir) {
+            node->error = grep_expand_dir(walk->opts, node);
+            // The children are queued before the node is published: once it
+            // is, the output stage may search, print and free all of them
+            // itself
+            grep_walk_push(worker, node->children, node->child_count);
+            grep_node_finish(walk, node);
+        } else {
+            // With one worker nothing else keeps the disk busy while this
+            // file is scanned
+            if (walk->worker_count == 1) {
+                grep_deque_prefetch(&worker->deque);
+            }
+            grep_walk_search(walk, node);
+        }
+
+        pthread_mutex_lock(&walk->lock);
+        if (--walk->pending == 0) {
+            pthread_cond_broadcast(&walk->work);
+        }
+        pthread_mutex_unlock(&walk->lock);
+    }
+    return NULL;
+}
+
+// Where node's data starts on disk: the physical offset of its first extent
+// as FIEMAP reports it, and its inode number for file systems that report
+// no extents. Errors are left for the search to report.
+static void grep_walk_locate(GrepNode* node) {
+    node->extent = UINT64_MAX;
+    node->inode = 0;
+
+    int fd = open(node->path, O_RDONLY | O_CLOEXEC | O_NONBLOCK);
+    if (fd < 0) {
+        return;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == 0) {
+        node->inode = st.st_ino;
+    }
+
+    // Room for the request header and one extent
+    uint64_t request[(sizeof(struct fiemap) + sizeof(struct fiemap_extent)) / sizeof(uint64_t) + 1];
+    struct fiemap* map = (struct fiemap*)request;
+    memset(request, 0, sizeof(request));
+    map->fm_length = FIEMAP_MAX_OFFSET;
+    map->fm_extent_count = 1;
+    if (ioctl(fd, FS_IOC_FIEMAP, map) == 0 && map->fm_mapped_extents > 0 &&
+        (map->fm_extents[0].fe_flags & (FIEMAP_EXTENT_UNKNOWN | FIEMAP_EXTENT_DELALLOC)) == 0) {
+        node->extent = map->fm_extents[0].fe_physical;
+    }
+    close(fd);
+}
+
+static int grep_compare_location(const void* a, const void* b) {
+    const GrepNode* x = *(GrepNode* const*)a;
+    const GrepNode* y = *(GrepNode* const*)b;
+    if (x->extent != y->extent) {
+        return x->extent < y->extent ? -1 : 1;
+    }
+    return x->inode < y->inode ? -1 : x->inode > y->inode;
+}
+
+// Physical order: expand node's whole subtree on this thread, finishing its
+// directories and listing its files with their locations in walk->files
+static void grep_walk_collect(GrepWalk* walk, GrepNode* node) {
+    if (node->is_dir) {
+        node->error = grep_expand_dir(walk->opts, node);
+        node->done = true;
+        for (size_t i = 0; i < node->child_count; ++i) {
+            grep_walk_collect(walk, node->children[i]);
+        }
+        return;
+    }
+
+    if (walk->file_count == walk->file_capacity) {
+        size_t capacity = walk->file_capacity == 0 ? 256 : walk->file_capacity * 2;
+        GrepNode** files = (GrepNode**)realloc(walk->files, capacity * sizeof(GrepNode*));
+        if (files == NULL) {
+            node->error = ENOMEM;
+            node->done = true;
+            return;
+        }
+        walk->files = files;
+        walk->file_capacity = capacity;
+    }
+    grep_walk_locate(node);
+    walk->files[walk->file_count++] = node;
+}
+
+// Physical order: workers take the sorted files in turn, so together they
+// sweep across the disk once
+static void* grep_walk_sweep(void* arg) {
+    GrepWorker* worker = (GrepWorker*)arg;
+    GrepWalk* walk = worker->walk;
+    size_t i;
+
+    while ((i = atomic_fetch_add_explicit(&walk->next_file, 1, memory_order_relaxed)) < walk->file_count) {
+        GrepNode* node = walk->files[i];
+        if (!grep_walk_claim(walk, node)) {
+            continue;
+        }
+        if (atomic_load_explicit(&walk->stop, memory_order_relaxed)) {
+            grep_node_finish(walk, node);
+            continue;
+        }
+        if (walk->worker_count == 1 && i + 1 < walk->file_count) {
+            grep_prefetch_path(walk->files[i + 1]->path);
+        }
+        grep_walk_search(walk, node);
+    }
+    return NULL;
+}
+
+// Free a printed node. A file the output stage searched itself may still be
+// queued for a worker; the worker frees it when it takes it, instead.
+static void grep_walk_free(GrepWalk* walk, GrepNode* node) {
+    bool queued = false;
+    if (node->claimed && !node->ahead) {
+        pthread_mutex_lock(&walk->done_lock);
+        node->emitted = true;
+        queued = !node->dequeued;
+        pthread_mutex_unlock(&walk->done_lock);
+    }
+    if (!queued) {
+        grep_node_destroy(node);
+    }
+}
+
+// Emit node's results in sequential order, waiting for workers as needed
+static int grep_walk_emit(GrepWalk* walk, GrepNode* node, GrepResultCallback emit, void* ctx) {
+    int status = 0;
+
+    // A file no worker has taken yet is searched here: waiting for it could
+    // take forever with every worker blocked on a full window
+    pthread_mutex_lock(&walk->done_lock);
+    bool search = !node->is_dir && !node->claimed && !node->done;
+    if (search) {
+        node->claimed = true;
+        pthread_cond_broadcast(&walk->done_cond);
+    }
+    while (!search && !node->done) {
+        pthread_cond_wait(&walk->done_cond, &walk->done_lock);
+    }
+    pthread_mutex_unlock(&walk->done_lock);
+    if (search && atomic_load_explicit(&walk->stop, memory_order_relaxed)) {
+        node->done = true;
+    } else if (search) {
+        grep_walk_search(walk, node);
+    }
+
+    if (node->error != 0) {
+        fprintf(stderr, "grep: %s: %s\n", node->path, strerror(node->error));
+        status = -1;
+    }
+    if (node->result != NULL) {
+        walk->found = walk->found || node->result->count > 0;
+        if (emit != NULL) {
+            emit(node->result, ctx);
+        } else {
+            grep_writer_summary(grep_writer_stdout(), walk->opts, node->result);
+            grep_result_destroy(node->result);
+        }
+        node->result = NULL;
+    }
+    if (node->ahead) {
+        pthread_mutex_lock(&walk->done_lock);
+        walk->ahead--;
+        pthread_cond_broadcast(&walk->done_cond);
+        pthread_mutex_unlock(&walk->done_lock);
+    }
+    for (size_t i = 0; i < node->child_count; ++i) {
+        if (grep_walk_emit(walk, node->children[i], emit, ctx) != 0) {
+            status = -1;
+        }
+        // Release each subtree as soon as it is printed
+        grep_walk_free(walk, node->children[i]);
+        node->children[i] = NULL;
+    }
+    return status;
+}
+
+// Search every path in opts, descending into directories with -r
+int grep_search_paths(GrepOptions* opts, GrepResultCallback emit, void* ctx) {
+    if (opts == NULL || opts->paths == NULL || opts->path_count == 0) {
+        return 0;
+    }
+    // Compile once here; workers only read opts->compiled
+    if (grep_options_pattern(opts) == NULL) {
+        return -1;
+    }
+
+    int status = 0;
+    GrepNode** roots = (GrepNode**)calloc(opts->path_count, sizeof(GrepNode*));
+    if (roots == NULL) {
+        return -1;
+    }
+
+    size_t root_count = 0;
+    for (size_t i = 0; i < opts->path_count; ++i) {
+        struct stat st;
+        if (stat(opts->paths[i], &st) != 0) {
+            fprintf(stderr, "grep: %s: %s\n", opts->paths[i], strerror(errno));
+            status = -1;
+            continue;
+        }
+        if (S_ISDIR(st.st_mode) && !opts->recursive) {
+            fprintf(stderr, "grep: %s: Is a directory\n", opts->paths[i]);
+            status = -1;
+            continue;
+        }
+        char* path = strdup(opts->paths[i]);
+        GrepNode* node = path != NULL ? grep_node_create(path, S_ISDIR(st.st_mode)) : NULL;
+        if (node == NULL) {
+            status = -1;
+            continue;
+        }
+        roots[root_count++] = node;
+    }
+
+    GrepWalk walk;
+    walk.opts = opts;
+    // A lone file gets the threads; otherwise files already run in parallel
+    walk.file_threads = root_count == 1 && !roots[0]->is_dir ? opts->threads : 1;
+    atomic_init(&walk.stop, false);
+    walk.found = false;
+    walk.files = NULL;
+    walk.file_count = 0;
+    walk.file_capacity = 0;
+    atomic_init(&walk.next_file, 0);
+    walk.queued = 0;
+    walk.pending = 0;
+    walk.ahead = 0;
+    pthread_mutex_init(&walk.lock, NULL);
+    pthread_cond_init(&walk.work, NULL);
+    pthread_mutex_init(&walk.done_lock, NULL);
+    pthread_cond_init(&walk.done_cond, NULL);
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    walk.worker_count = opts->threads > 0 ? (size_t)opts->threads : cpus > 0 ? (size_t)cpus : 1;
+    walk.workers = (GrepWorker*)calloc(walk.worker_count, sizeof(GrepWorker));
+    if (walk.workers == NULL) {
+        walk.worker_count = 0;
+    }
+
+    for (size_t i = 0; i < walk.worker_count; ++i) {
+        walk.workers[i].walk = &walk;
+        walk.workers[i].index = i;
+        grep_deque_init(&walk.workers[i].deque);
+    }
+
+    // Physical order lists the whole tree before reading any file; the
+    // output stage then finds every directory done and waits only on files
+    if (opts->physical_order) {
+        for (size_t i = 0; i < root_count; ++i) {
+            grep_walk_collect(&walk, roots[i]);
+        }
+        qsort(walk.files, walk.file_count, sizeof(GrepNode*), grep_compare_location);
+    }
+
+    size_t started = 0;
+    if (walk.worker_count > 0) {
+        if (!opts->physical_order) {
+            grep_walk_push(&walk.workers[0], roots, root_count);
+        }
+        for (; started < walk.worker_count; ++started) {
+            if (pthread_create(&walk.workers[started].thread, NULL,
+                               opts->physical_order ? grep_walk_sweep : grep_walk_worker,
+                               &walk.workers[started]) != 0) {
+                break;
+            }
+        }
+    }
+
+    if (started == 0) {
+        // No workers: fail every root (or listed file) rather than wait forever
+        GrepNode** failed = opts->physical_order ? walk.files : roots;
+        size_t failed_count = opts->physical_order ? walk.file_count : root_count;
+        for (size_t i = 0; i < failed_count; ++i) {
+            failed[i]->error = EAGAIN;
+            failed[i]->done = true;
+        }
+    }
+
+    for (size_t i = 0; i < root_count; ++i) {
+        if (grep_walk_emit(&walk, roots[i], emit, ctx) != 0) {
+            status = -1;
+        }
+        grep_walk_free(&walk, roots[i]);
+    }
+
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(walk.workers[i].thread, NULL);
+    }
+    for (size_t i = 0; i < walk.worker_count; ++i) {
+        grep_deque_destroy(&walk.workers[i].deque);
+    }
+    free(walk.workers);
+    free(walk.files);
+    free(roots);
+    pthread_mutex_destroy(&walk.lock);
+    pthread_cond_destroy(&walk.work);
+    pthread_mutex_destroy(&walk.done_lock);
+    pthread_cond_destroy(&walk.done_cond);
+    if (emit == NULL) {
+        grep_writer_flush(grep_writer_stdout());
+    }
+    if (opts->quiet) {
+        return walk.found ? 0 : status != 0 ? -1 : 1;
+    }
+    return status;
+}
@@ -0,0 +1,392 @@
+#include "alloc.h"
+#include <stdlib.h>
+#include <string.h>
+
+/* Directory path -> allocation group */
+struct dir_group {
+	char *path;
+	int group;
+	struct dir_group *next;
+};
+
+#define DIR_HASH_SIZE 256
+
+static struct alloc_group *groups;
+static int num_groups, inodes_per_group, blocks_per_group;
+static int total_blocks;
+
+/* Block size classes; class 0 is the single data block and has no map */
+static int num_classes = 1;
+static int class_run[ALLOC_MAX_CLASSES] = { 1 };
+static int *run_used[ALLOC_MAX_CLASSES];    /* used blocks per aligned run */
+static int run_hint[ALLOC_MAX_CLASSES];     /* no free run below this */
+static struct dir_group *dirs[DIR_HASH_SIZE];
+static pthread_mutex_t dirs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int alloc_init(struct myfs_state *s, int ngroups)
+{
+	struct alloc_group *g;
+	int i, max_groups;
+
+	max_groups = s->NUM_INODES < s->NUM_DATA_BLOCKS ? s->NUM_INODES : s->NUM_DATA_BLOCKS;
+	if (ngroups > max_groups)
+		ngroups = max_groups;
+	if (ngroups < 1)
+		ngroups = 1;
+
+	groups = (struct alloc_group *)calloc((size_t)ngroups, sizeof(struct alloc_group));
+	if (!groups)
+		return -1;
+	num_groups = ngroups;
+	total_blocks = s->NUM_DATA_BLOCKS;
+	inodes_per_group = (s->NUM_INODES + ngroups - 1) / ngroups;
+	blocks_per_group = (s->NUM_DATA_BLOCKS + ngroups - 1) / ngroups;
+
+	for (i = 0; i < ngroups; i++) {
+		g = &groups[i];
+		pthread_mutex_init(&g->lock, NULL);
+		g->inode_start = i * inodes_per_group;
+		g->inode_count = s->NUM_INODES - g->inode_start;
+		if (g->inode_count > inodes_per_group)
+			g->inode_count = inodes_per_group;
+		if (g->inode_count < 0)
+			g->inode_count = 0;
+		g->block_start = i * blocks_per_group;
+		g->block_count = s->NUM_DATA_BLOCKS - g->block_start;
+		if (g->block_count > blocks_per_group)
+			g->block_count = blocks_per_group;
+		if (g->block_count < 0)
+			g->block_count = 0;
+		g->inode_bitmap = s->inode_bitmap + g->inode_start;
+		g->block_bitmap = s->data_block_bitmap + g->block_start;
+		g->free_inodes = g->inode_count;
+		g->free_blocks = g->block_count;
+	}
+	return 0;
+}
+
+void alloc_destroy(void)
+{
+	struct dir_group *d, *next;
+	int i;
+
+	for (i = 0; i < num_groups; i++)
+		pthread_mutex_destroy(&groups[i].lock);
+	for (i = 1; i < num_classes; i++) {
+		free(run_used[i]);
+		run_used[i] = NULL;
+	}
+	num_classes = 1;
+	free(groups);
+	groups = NULL;
+	num_groups = 0;
+	for (i = 0; i < DIR_HASH_SIZE; i++) {
+		for (d = dirs[i]; d; d = next) {
+			next = d->next;
+			free(d->path);
+			free(d);
+		}
+		dirs[i] = NULL;
+	}
+}
+
+static unsigned dir_hash(const char *path, size_t len)
+{
+	unsigned h = 5381;
+	size_t i;
+	for (i = 0; i < len; i++)
+		h = h * 33 + (unsigned char)path[i];
+	return h;
+}
+
+/* Group of the directory containing path; "/" and unknown directories that
+   existed on the mirror before mount are placed by hash */
+static int parent_group(const char *path)
+{
+	const char *slash = strrchr(path, '/');
+	size_t len = slash ? (size_t)(slash - path) : 0;
+	unsigned h = dir_hash(path, len);
+	struct dir_group *d;
+	int group;
+
+	if (len == 0 || num_groups == 1)
+		return 0;
+	pthread_mutex_lock(&dirs_lock);
+	for (d = dirs[h % DIR_HASH_SIZE]; d; d = d->next) {
+		if (strlen(d->path) == len && strncmp(d->path, path, len) == 0) {
+			group = d->group;
+			pthread_mutex_unlock(&dirs_lock);
+			return group;
+		}
+	}
+	pthread_mutex_unlock(&dirs_lock);
+	return (int)(h % (unsigned)num_groups);
+}
+
+void alloc_mkdir(const char *path)
+{
+	struct dir_group *d;
+	unsigned h;
+	int i, best = 0;
+
+	if (num_groups == 1)
+		return;
+	/* Spread directories: pick the group with the most free inodes. The
+	   counters are read without the group locks; this is only a hint. */
+	for (i = 1; i < num_groups; i++)
+		if (groups[i].free_inodes > groups[best].free_inodes)
+			best = i;
+
+	d = (struct dir_group *)malloc(sizeof(*d));
+	if (!d)
+		return;
+	d->path = strdup(path);
+	if (!d->path) {
+		free(d);
+		return;
+	}
+	d->group = best;
+	h = dir_hash(path, strlen(path)) % DIR_HASH_SIZE;
+	pthread_mutex_lock(&dirs_lock);
+	d->next = dirs[h];
+	dirs[h] = d;
+	pthread_mutex_unlock(&dirs_lock);
+}
+
+void alloc_rmdir(const char *path)
+{
+	struct dir_group **pp, *d;
+	unsigned h = dir_hash(path, strlen(path)) % DIR_HASH_SIZE;
+
+	pthread_mutex_lock(&dirs_lock);
+	for (pp = &dirs[h]; *pp; pp = &(*pp)->next) {
+		if (strcmp((*pp)->path, path) == 0) {
+			d = *pp;
+			*pp = d->next;
+			free(d->path);
+			free(d);
+			break;
+		}
+	}
+	pthread_mutex_unlock(&dirs_lock);
+}
+
+int alloc_set_classes(const int *runs, int n)
+{
+	int c, nruns;
+
+	if (n < 1 || n > ALLOC_MAX_CLASSES || runs[0] != 1)
+		return -1;
+	for (c = 1; c < n; c++)
+		if (runs[c] <= runs[c - 1] || (runs[c] & (runs[c] - 1)) != 0)
+			return -1;
+	for (c = 1; c < n; c++) {
+		nruns = (total_blocks + runs[c] - 1) / runs[c];
+		run_used[c] = (int *)calloc((size_t)nruns, sizeof(int));
+		if (!run_used[c]) {
+			while (--c > 0)
+				free(run_used[c]);
+			return -1;
+		}
+		/* the tail run is never whole: count its missing blocks as used */
+		run_used[c][nruns - 1] = nruns * runs[c] - total_blocks;
+		class_run[c] = runs[c];
+		run_hint[c] = 0;
+	}
+	num_classes = n;
+	return 0;
+}
+
+int alloc_num_classes(void)
+{
+	return num_classes;
+}
+
+int alloc_class_run(int c)
+{
+	return class_run[c];
+}
+
+/* Keep the class maps in step with a block changing state (delta +1 when
+   allocated, -1 when freed); runs may span groups, hence the atomics */
+static void runs_update(int block, int delta)
+{
+	int c, r;
+
+	for (c = 1; c < num_classes; c++) {
+		r = block / class_run[c];
+		if (__atomic_add_fetch(&run_used[c][r], delta, __ATOMIC_RELAXED) == 0 &&
+		    r < __atomic_load_n(&run_hint[c], __ATOMIC_RELAXED))
+			__atomic_store_n(&run_hint[c], r, __ATOMIC_RELAXED);
+	}
+}
+
+/* Lowest free index in bitmap[hint, count), or -1; caller holds the group lock */
+static int scan_free(const int *bitmap, int hint, int count)
+{
+	int i;
+	for (i = hint; i < count; i++)
+		if (!bitmap[i])
+			return i;
+	return -1;
+}
+
+int alloc_inode(const char *path)
+{
+	struct alloc_group *g;
+	int start = parent_group(path), k, i;
+
+	for (k = 0; k < num_groups; k++) {
+		g = &groups[(start + k) % num_groups];
+		pthread_mutex_lock(&g->lock);
+		if (g->free_inodes > 0) {
+			i = scan_free(g->inode_bitmap, g->inode_hint, g->inode_count);
+			g->inode_bitmap[i] = 1;
+			g->free_inodes--;
+			g->inode_hint = i + 1;
+			pthread_mutex_unlock(&g->lock);
+			return g->inode_start + i;
+		}
+		pthread_mutex_unlock(&g->lock);
+	}
+	return -1;
+}
+
+void alloc_free_inode(int ino)
+{
+	struct alloc_group *g = &groups[ino / inodes_per_group];
+	int i = ino - g->inode_start;
+
+	pthread_mutex_lock(&g->lock);
+	if (g->inode_bitmap[i]) {
+		g->inode_bitmap[i] = 0;
+		g->free_inodes++;
+		if (i < g->inode_hint)
+			g->inode_hint = i;
+	}
+	pthread_mutex_unlock(&g->lock);
+}
+
+void alloc_mark_inode(int ino)
+{
+	struct alloc_group *g = &groups[ino / inodes_per_group];
+	int i = ino - g->inode_start;
+
+	pthread_mutex_lock(&g->lock);
+	if (!g->inode_bitmap[i]) {
+		g->inode_bitmap[i] = 1;
+		g->free_inodes--;
+	}
+	pthread_mutex_unlock(&g->lock);
+}
+
+int alloc_free_blocks(void)
+{
+	int i, n = 0;
+	for (i = 0; i < num_groups; i++)
+		n += __atomic_load_n(&groups[i].free_blocks, __ATOMIC_RELAXED);
+	return n;
+}
+
+int alloc_blocks(int ino, int n, int *out)
+{
+	struct alloc_group *g;
+	int start = ino / inodes_per_group, got = 0, k, i;
+
+	if (n <= 0)
+		return 0;
+	if (alloc_free_blocks() < n)
+		return -1;
+	for (k = 0; k < num_groups && got < n; k++) {
+		g = &groups[(start + k) % num_groups];
+		pthread_mutex_lock(&g->lock);
+		while (got < n && g->free_blocks > 0) {
+			i = scan_free(g->block_bitmap, g->block_hint, g->block_count);
+			g->block_bitmap[i] = 1;
+			g->free_blocks--;
+			g->block_hint = i + 1;
+			out[got++] = g->block_start + i;
+			runs_update(g->block_start + i, 1);
+		}
+		pthread_mutex_unlock(&g->lock);
+	}
+	if (got < n) {
+		/* lost a race with a concurrent allocation */
+		while (got--)
+			alloc_free_block(out[got]);
+		return -1;
+	}
+	return 0;
+}
+
+void alloc_mark_block(int block)
+{
+	struct alloc_group *g = &groups[block / blocks_per_group];
+	int i = block - g->block_start;
+
+	pthread_mutex_lock(&g->lock);
+	if (!g->block_bitmap[i]) {
+		g->block_bitmap[i] = 1;
+		g->free_blocks--;
+		runs_update(block, 1);
+	}
+	pthread_mutex_unlock(&g->lock);
+}
+
+void alloc_free_block(int block)
+{
+	struct alloc_group *g = &groups[block / blocks_per_group];
+	int i = block - g->block_start;
+
+	pthread_mutex_lock(&g->lock);
+	if (g->block_bitmap[i]) {
+		g->block_bitmap[i] = 0;
+		g->free_blocks++;
+		if (i < g->block_hint)
+			g->block_hint = i;
+		runs_update(block, -1);
+	}
+	pthread_mutex_unlock(&g->lock);
+}
+
+int alloc_run(int ino, int c)
+{
+	struct alloc_group *g;
+	int run, start = ino / inodes_per_group, k, r, first, last, b, i, hint;
+
+	if (c < 1 || c >= num_classes)
+		return -1;
+	run = class_run[c];
+	for (k = 0; k < num_groups; k++) {
+		g = &groups[(start + k) % num_groups];
+		pthread_mutex_lock(&g->lock);
+		if (g->free_blocks < run) {
+			pthread_mutex_unlock(&g->lock);
+			continue;
+		}
+		/* whole runs inside the group only */
+		first = (g->block_start + run - 1) / run;
+		last = (g->block_start + g->block_count) / run;
+		hint = __atomic_load_n(&run_hint[c], __ATOMIC_RELAXED);
+		for (r = hint > first ? hint : first; r < last; r++) {
+			if (__atomic_load_n(&run_used[c][r], __ATOMIC_RELAXED) != 0)
+				continue;
+			/* scanned from the hint: runs [hint, r] are in this group and used */
+			if (hint >= first)
+				__atomic_compare_exchange_n(&run_hint[c], &hint, r + 1, 0,
+				                            __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+			for (b = r * run; b < (r + 1) * run; b++) {
+				i = b - g->block_start;
+				g->block_bitmap[i] = 1;
+				runs_update(b, 1);
+			}
+			g->free_blocks -= run;
+			if (g->block_hint >= r * run - g->block_start && g->block_hint < (r + 1) * run - g->block_start)
+				g->block_hint = (r + 1) * run - g->block_start;
+			pthread_mutex_unlock(&g->lock);
+			return r * run;
+		}
+		pthread_mutex_unlock(&g->lock);
+	}
+	return -1;
+}
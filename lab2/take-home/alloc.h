@@ -0,0 +1,76 @@
+#ifndef _ALLOC_H_
+#define _ALLOC_H_
+
+#include "params.h"
+#include <pthread.h>
+
+/*
+ * ext4-style allocation groups. The inode and data block ranges of myfs_state
+ * are split into contiguous groups; each group owns the slice of
+ * inode_bitmap/data_block_bitmap covering its range, keeps free counters and
+ * a lowest-possibly-free hint, and has its own lock. Within a group the
+ * lowest free index is always chosen, so with a single group allocation is
+ * identical to a plain scan from index 0.
+ *
+ * New directories go to the group with the most free inodes; files go to the
+ * group of their parent directory and take data blocks from the group of
+ * their inode first, so files in one directory end up physically close.
+ *
+ * Block size classes (--block-classes) are aligned runs of 2^k data blocks.
+ * Each class keeps its own occupancy map (used blocks per run), so a fully
+ * free run of any class is found without scanning the block bitmap.
+ */
+
+#define ALLOC_MAX_CLASSES 8
+
+struct alloc_group {
+	pthread_mutex_t lock;
+	int inode_start, inode_count;
+	int block_start, block_count;
+	int *inode_bitmap;      /* slice of myfs_state.inode_bitmap */
+	int *block_bitmap;      /* slice of myfs_state.data_block_bitmap */
+	int free_inodes, free_blocks;
+	int inode_hint, block_hint; /* no free entry below these (group-relative) */
+};
+
+/* Split s into ngroups groups (clamped to [1, min(NUM_INODES, NUM_DATA_BLOCKS)]) */
+int alloc_init(struct myfs_state *s, int ngroups);
+
+void alloc_destroy(void);
+
+/* Allocate the lowest free inode, preferring the group of path's parent
+   directory; returns -1 if all inodes are in use */
+int alloc_inode(const char *path);
+
+void alloc_free_inode(int ino);
+
+/* Total free data blocks (O(number of groups)) */
+int alloc_free_blocks(void);
+
+/* Allocate n data blocks for inode ino into out[]; all or nothing.
+   Returns 0 on success, -1 if fewer than n blocks are free. */
+int alloc_blocks(int ino, int n, int *out);
+
+void alloc_free_block(int block);
+
+/* Mark a specific inode/block as in use (applying replicated or
+   checkpointed state); no-op if it already is */
+void alloc_mark_inode(int ino);
+void alloc_mark_block(int block);
+
+/* Set the block size classes as run lengths in data blocks: ascending
+   powers of two starting at 1. Returns -1 if runs is not such a list. */
+int alloc_set_classes(const int *runs, int n);
+
+int alloc_num_classes(void);
+int alloc_class_run(int c);
+
+/* Allocate a free aligned run of alloc_class_run(c) blocks inside one group,
+   preferring the group of inode ino; returns its first block or -1 */
+int alloc_run(int ino, int c);
+
+/* Directory placement bookkeeping (called from mkdir/rmdir) */
+void alloc_mkdir(const char *path);
+void alloc_rmdir(const char *path);
+
+#endif
@@ -0,0 +1,693 @@
+#include "ckpt.h"
+#include "alloc.h"
+#include "mirror.h"
+#include "tier.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/stat.h>
+
+#define CKPT_MAGIC "MYFSCKP1"
+
+enum ckpt_kind {
+	CKPT_FULL = 1,
+	CKPT_DELTA = 2,
+};
+
+struct ckpt_hdr {
+	char magic[8];
+	uint32_t kind;
+	uint32_t n_inodes;      /* inode records in this checkpoint */
+	uint64_t seq;
+	int32_t num_inodes, num_blocks, block_size; /* volume geometry */
+	uint32_t n_blocks;      /* block records */
+	int32_t n_paths;        /* path records; -1 if the path map is unchanged */
+	uint32_t reserved;
+	uint64_t payload_len;
+};
+
+struct ckpt_trailer {
+	uint64_t seq;
+	uint64_t checksum;      /* FNV-1a of the payload */
+};
+
+struct ckpt_inode {
+	int32_t ino, used, num_blocks, pad;
+	int64_t size;
+	/* followed by num_blocks int32 block indices */
+};
+
+struct ckpt_block {
+	int32_t block, used;
+	/* followed by block_size bytes if used */
+};
+
+struct ckpt_path {
+	int32_t ino;    /* -1 for a directory on the mirror */
+	uint32_t len;
+	/* followed by len bytes of path */
+};
+
+struct ckpt_buf {
+	char *data;
+	size_t len, cap;
+};
+
+/* Path records written by put_paths */
+struct ckpt_walk {
+	struct ckpt_buf *b;
+	int count;
+};
+
+/* Compact once the deltas exceed twice the last full image plus this */
+#define CKPT_COMPACT_SLACK (1 << 20)
+
+static struct myfs_state *st;
+static off_t *lsize;
+static char *ckpt_file;
+static int ckpt_fd = -1, enabled, stopping, need_full;
+static unsigned interval;
+static uint64_t seq;
+static off_t file_bytes, full_bytes;
+static struct ckpt_buf loaded_dirs;     /* NUL-terminated paths, while loading */
+static pthread_t ckpt_thread;
+static pthread_rwlock_t freeze = PTHREAD_RWLOCK_INITIALIZER;
+static pthread_mutex_t stop_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stop_cond = PTHREAD_COND_INITIALIZER;
+
+/* Dirty sets: a flag per entry plus a list of the flagged entries, so a cut
+   costs time proportional to what changed */
+static char *block_dirty, *inode_dirty;
+static int *dirty_blocks, *dirty_inodes;
+static int n_dirty_blocks, n_dirty_inodes, paths_dirty;
+
+/* Block payloads of the cut being written: their space in *cut is laid out
+   during the freeze and filled afterwards, by the checkpoint thread or, for
+   a block about to change, by the operation changing it (cow_lock) */
+static pthread_mutex_t cow_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ckpt_buf *cut;
+static char *pending;           /* per block: still to be copied into *cut */
+static size_t *slot;            /* per pending block: offset of its payload */
+static int *cut_blocks, n_cut_blocks, cut_failed;
+
+static uint64_t fnv1a(const char *p, size_t len)
+{
+	uint64_t h = 1469598103934665603ull;
+	size_t i;
+	for (i = 0; i < len; i++) {
+		h ^= (unsigned char)p[i];
+		h *= 1099511628211ull;
+	}
+	return h;
+}
+
+static int buf_reserve(struct ckpt_buf *b, size_t len)
+{
+	size_t cap = b->cap ? b->cap : 65536;
+	char *n;
+
+	if (b->len + len > b->cap) {
+		while (cap < b->len + len)
+			cap *= 2;
+		n = (char *)realloc(b->data, cap);
+		if (!n)
+			return -1;
+		b->data = n;
+		b->cap = cap;
+	}
+	return 0;
+}
+
+static int buf_put(struct ckpt_buf *b, const void *p, size_t len)
+{
+	if (buf_reserve(b, len) != 0)
+		return -1;
+	memcpy(b->data + b->len, p, len);
+	b->len += len;
+	return 0;
+}
+
+/* --- dirty tracking --- */
+void ckpt_dirty_block(int block)
+{
+	if (enabled && !__atomic_exchange_n(&block_dirty[block], 1, __ATOMIC_RELAXED))
+		dirty_blocks[__atomic_fetch_add(&n_dirty_blocks, 1, __ATOMIC_RELAXED)] = block;
+}
+
+void ckpt_dirty_inode(int ino)
+{
+	if (enabled && !__atomic_exchange_n(&inode_dirty[ino], 1, __ATOMIC_RELAXED))
+		dirty_inodes[__atomic_fetch_add(&n_dirty_inodes, 1, __ATOMIC_RELAXED)] = ino;
+}
+
+void ckpt_dirty_paths(void)
+{
+	if (enabled)
+		__atomic_store_n(&paths_dirty, 1, __ATOMIC_RELAXED);
+}
+
+void ckpt_dirty_all(void)
+{
+	if (enabled)
+		__atomic_store_n(&need_full, 1, __ATOMIC_RELAXED);
+}
+
+void ckpt_enter(void)
+{
+	if (enabled)
+		pthread_rwlock_rdlock(&freeze);
+}
+
+void ckpt_exit(void)
+{
+	if (enabled)
+		pthread_rwlock_unlock(&freeze);
+}
+
+/* Copy block's payload into its slot of the cut unless that happened already */
+static void copy_block(int block)
+{
+	pthread_mutex_lock(&cow_lock);
+	if (pending[block]) {
+		if (tier_read(block, cut->data + slot[block]) != 0)
+			cut_failed = 1;
+		__atomic_store_n(&pending[block], 0, __ATOMIC_RELEASE);
+	}
+	pthread_mutex_unlock(&cow_lock);
+}
+
+void ckpt_preserve_block(int block)
+{
+	/* pending is only set while operations are frozen out */
+	if (enabled && __atomic_load_n(&pending[block], __ATOMIC_ACQUIRE))
+		copy_block(block);
+}
+
+/* --- serialization (caller holds the freeze lock for writing) --- */
+static int put_inode(struct ckpt_buf *b, int ino)
+{
+	struct inode *inode = st->inodes[ino];
+	struct ckpt_inode rec;
+
+	memset(&rec, 0, sizeof(rec));
+	rec.ino = ino;
+	rec.used = st->inode_bitmap[ino];
+	rec.num_blocks = rec.used ? inode->num_blocks : 0;
+	rec.size = rec.used ? (int64_t)lsize[ino] : 0;
+	if (buf_put(b, &rec, sizeof(rec)) != 0)
+		return -1;
+	return buf_put(b, inode->blocks, (size_t)rec.num_blocks * sizeof(int32_t));
+}
+
+static int put_block(struct ckpt_buf *b, int block)
+{
+	struct ckpt_block rec;
+
+	rec.block = block;
+	rec.used = st->data_block_bitmap[block];
+	if (buf_put(b, &rec, sizeof(rec)) != 0)
+		return -1;
+	if (!rec.used)
+		return 0;
+	/* only laid out here; copied after the freeze */
+	if (buf_reserve(b, (size_t)st->DATA_BLOCK_SIZE) != 0)
+		return -1;
+	slot[block] = b->len;
+	b->len += (size_t)st->DATA_BLOCK_SIZE;
+	cut_blocks[n_cut_blocks++] = block;
+	return 0;
+}
+
+static int put_path(struct ckpt_walk *w, const char *path, int ino)
+{
+	struct ckpt_path rec;
+
+	rec.ino = ino;
+	rec.len = (uint32_t)strlen(path);
+	if (buf_put(w->b, &rec, sizeof(rec)) != 0 || buf_put(w->b, path, rec.len) != 0)
+		return -1;
+	w->count++;
+	return 0;
+}
+
+static int put_dir(const char *path, void *arg)
+{
+	return put_path((struct ckpt_walk *)arg, path, -1);
+}
+
+/* Mirror directories (parents first) and the path map; returns the number
+   of records or -1 */
+static int put_paths(struct ckpt_buf *b)
+{
+	struct ckpt_walk w = { b, 0 };
+	int i;
+
+	if (mirror_walk_dirs(st->rootdir, put_dir, &w) != 0)
+		return -1;
+	for (i = 0; i < st->path_count; i++)
+		if (put_path(&w, st->path_to_inode[i].path, st->path_to_inode[i].inode) != 0)
+			return -1;
+	return w.count;
+}
+
+static void clear_dirty(void)
+{
+	int i;
+	for (i = 0; i < n_dirty_blocks; i++)
+		block_dirty[dirty_blocks[i]] = 0;
+	for (i = 0; i < n_dirty_inodes; i++)
+		inode_dirty[dirty_inodes[i]] = 0;
+	n_dirty_blocks = n_dirty_inodes = 0;
+	paths_dirty = 0;
+}
+
+/* Lay out one checkpoint (header and payload, block payloads left for
+   copy_block) in b; the blocks to copy are listed in cut_blocks */
+static int build(struct ckpt_buf *b, enum ckpt_kind kind)
+{
+	struct ckpt_hdr hdr;
+	struct inode *inode;
+	int i, j, n;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, CKPT_MAGIC, sizeof(hdr.magic));
+	hdr.kind = kind;
+	hdr.seq = ++seq;
+	hdr.num_inodes = st->NUM_INODES;
+	hdr.num_blocks = st->NUM_DATA_BLOCKS;
+	hdr.block_size = st->DATA_BLOCK_SIZE;
+	hdr.n_paths = -1;
+	b->len = 0;
+	n_cut_blocks = 0;
+	if (buf_put(b, &hdr, sizeof(hdr)) != 0)
+		return -1;
+
+	if (kind == CKPT_FULL) {
+		/* live data only: the used inodes and the blocks they own */
+		for (i = 0; i < st->NUM_INODES; i++) {
+			if (!st->inode_bitmap[i])
+				continue;
+			if (put_inode(b, i) != 0)
+				return -1;
+			hdr.n_inodes++;
+		}
+		for (i = 0; i < st->NUM_INODES; i++) {
+			if (!st->inode_bitmap[i])
+				continue;
+			inode = st->inodes[i];
+			for (j = 0; j < inode->num_blocks; j++) {
+				if (put_block(b, inode->blocks[j]) != 0)
+					return -1;
+				hdr.n_blocks++;
+			}
+		}
+	} else {
+		for (i = 0; i < n_dirty_inodes; i++)
+			if (put_inode(b, dirty_inodes[i]) != 0)
+				return -1;
+		for (i = 0; i < n_dirty_blocks; i++)
+			if (put_block(b, dirty_blocks[i]) != 0)
+				return -1;
+		hdr.n_inodes = (uint32_t)n_dirty_inodes;
+		hdr.n_blocks = (uint32_t)n_dirty_blocks;
+	}
+	if (kind == CKPT_FULL || paths_dirty) {
+		n = put_paths(b);
+		if (n < 0)
+			return -1;
+		hdr.n_paths = n;
+	}
+
+	hdr.payload_len = b->len - sizeof(hdr);
+	memcpy(b->data, &hdr, sizeof(hdr));
+	return 0;
+}
+
+/* Append the trailer once every payload of the cut is in b */
+static int finish(struct ckpt_buf *b)
+{
+	struct ckpt_hdr hdr;
+	struct ckpt_trailer tr;
+
+	memcpy(&hdr, b->data, sizeof(hdr));
+	tr.seq = hdr.seq;
+	tr.checksum = fnv1a(b->data + sizeof(hdr), hdr.payload_len);
+	return buf_put(b, &tr, sizeof(tr));
+}
+
+static int write_full_fd(int fd, const char *p, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = write(fd, p, len);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+/* Write a full image beside FILE and rename it into place */
+static int install_full(const struct ckpt_buf *b)
+{
+	char tmp[PATH_MAX];
+	int fd;
+
+	snprintf(tmp, sizeof(tmp), "%s.tmp", ckpt_file);
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd == -1)
+		return -1;
+	if (write_full_fd(fd, b->data, b->len) != 0 || fsync(fd) != 0 ||
+	    rename(tmp, ckpt_file) != 0) {
+		close(fd);
+		unlink(tmp);
+		return -1;
+	}
+	if (ckpt_fd != -1)
+		close(ckpt_fd);
+	ckpt_fd = fd;
+	lseek(ckpt_fd, 0, SEEK_END);
+	file_bytes = full_bytes = (off_t)b->len;
+	return 0;
+}
+
+static void checkpoint(struct ckpt_buf *b)
+{
+	enum ckpt_kind kind;
+	int res, i;
+
+	/* consistent cut: no operation runs while the dirty metadata is copied
+	   and the dirty blocks are marked for copy-on-write */
+	pthread_rwlock_wrlock(&freeze);
+	if (!need_full && n_dirty_blocks == 0 && n_dirty_inodes == 0 && !paths_dirty) {
+		pthread_rwlock_unlock(&freeze);
+		return;
+	}
+	kind = need_full ? CKPT_FULL : CKPT_DELTA;
+	cut = b;
+	res = build(b, kind);
+	if (res != 0)
+		n_cut_blocks = 0;
+	for (i = 0; i < n_cut_blocks; i++)
+		pending[cut_blocks[i]] = 1;
+	clear_dirty();
+	pthread_rwlock_unlock(&freeze);
+
+	/* payloads, while operations run; one they change first is copied then */
+	for (i = 0; i < n_cut_blocks; i++)
+		copy_block(cut_blocks[i]);
+	pthread_mutex_lock(&cow_lock);
+	if (cut_failed)
+		res = -1;
+	cut_failed = 0;
+	pthread_mutex_unlock(&cow_lock);
+	if (res == 0)
+		res = finish(b);
+
+	if (res == 0 && kind == CKPT_FULL) {
+		res = install_full(b);
+	} else if (res == 0) {
+		res = write_full_fd(ckpt_fd, b->data, b->len);
+		if (res == 0)
+			res = fdatasync(ckpt_fd);
+		if (res == 0)
+			file_bytes += (off_t)b->len;
+	}
+	/* anything lost from the cleared dirty sets is recovered by a full image */
+	need_full = res != 0 || file_bytes > 2 * full_bytes + CKPT_COMPACT_SLACK;
+	if (res != 0)
+		fprintf(stderr, "checkpoint to %s failed: %s\n", ckpt_file, strerror(errno));
+}
+
+static void *ckpt_main(void *arg)
+{
+	struct ckpt_buf b = { NULL, 0, 0 };
+	struct timespec ts;
+	int stop = 0;
+	(void)arg;
+
+	while (!stop) {
+		pthread_mutex_lock(&stop_lock);
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += (time_t)interval;
+		while (!stopping && pthread_cond_timedwait(&stop_cond, &stop_lock, &ts) != ETIMEDOUT)
+			;
+		stop = stopping;
+		pthread_mutex_unlock(&stop_lock);
+		checkpoint(&b);
+	}
+	free(b.data);
+	return NULL;
+}
+
+/* --- loading --- */
+static int read_exact(int fd, void *p, size_t len)
+{
+	ssize_t n;
+	char *c = (char *)p;
+
+	while (len > 0) {
+		n = read(fd, c, len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		c += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+static int apply(const struct ckpt_hdr *hdr, const char *p, const char *end)
+{
+	struct ckpt_inode ir;
+	struct ckpt_block br;
+	struct ckpt_path pr;
+	char path[PATH_MAX], *data;
+	uint32_t i;
+
+	for (i = 0; i < hdr->n_inodes; i++) {
+		if (p + sizeof(ir) > end)
+			return -1;
+		memcpy(&ir, p, sizeof(ir));
+		p += sizeof(ir);
+		if (ir.ino < 0 || ir.ino >= st->NUM_INODES || ir.num_blocks < 0 ||
+		    ir.num_blocks > st->NUM_DATA_BLOCKS ||
+		    p + (size_t)ir.num_blocks * sizeof(int32_t) > end ||
+		    inode_reserve_blocks(st->inodes[ir.ino], ir.num_blocks) != 0)
+			return -1;
+		if (ir.used)
+			alloc_mark_inode(ir.ino);
+		else
+			alloc_free_inode(ir.ino);
+		memcpy(st->inodes[ir.ino]->blocks, p, (size_t)ir.num_blocks * sizeof(int32_t));
+		st->inodes[ir.ino]->num_blocks = ir.num_blocks;
+		lsize[ir.ino] = (off_t)ir.size;
+		p += (size_t)ir.num_blocks * sizeof(int32_t);
+	}
+	for (i = 0; i < hdr->n_blocks; i++) {
+		if (p + sizeof(br) > end)
+			return -1;
+		memcpy(&br, p, sizeof(br));
+		p += sizeof(br);
+		if (br.block < 0 || br.block >= st->NUM_DATA_BLOCKS)
+			return -1;
+		if (br.used) {
+			if (p + st->DATA_BLOCK_SIZE > end)
+				return -1;
+			data = tier_get(br.block, 1);
+			if (!data)
+				return -1;
+			alloc_mark_block(br.block);
+			memcpy(data, p, (size_t)st->DATA_BLOCK_SIZE);
+			tier_put(br.block);
+			p += st->DATA_BLOCK_SIZE;
+		} else {
+			alloc_free_block(br.block);
+			tier_discard(br.block);
+		}
+	}
+	if (hdr->n_paths < 0)
+		return 0;
+	st->path_count = 0;
+	loaded_dirs.len = 0;
+	for (i = 0; i < (uint32_t)hdr->n_paths; i++) {
+		if (p + sizeof(pr) > end)
+			return -1;
+		memcpy(&pr, p, sizeof(pr));
+		p += sizeof(pr);
+		if (pr.len >= PATH_MAX || p + pr.len > end)
+			return -1;
+		memcpy(path, p, pr.len);
+		path[pr.len] = '\0';
+		p += pr.len;
+		if (pr.ino < 0) {
+			if (buf_put(&loaded_dirs, path, pr.len + 1) != 0)
+				return -1;
+			continue;
+		}
+		path_to_inode_add(st, path, pr.ino);
+	}
+	return 0;
+}
+
+int ckpt_load(const char *file, struct myfs_state *s, off_t *logical_size)
+{
+	struct ckpt_hdr hdr;
+	struct ckpt_trailer tr;
+	char *payload = NULL, *p, fpath[PATH_MAX];
+	off_t good = 0;
+	int fd, i, res = 0;
+
+	st = s;
+	lsize = logical_size;
+	fd = open(file, O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return errno == ENOENT ? 0 : -1;
+
+	while (read_exact(fd, &hdr, sizeof(hdr)) == 0) {
+		if (memcmp(hdr.magic, CKPT_MAGIC, sizeof(hdr.magic)) != 0)
+			break;
+		if (hdr.num_inodes != s->NUM_INODES || hdr.num_blocks != s->NUM_DATA_BLOCKS ||
+		    hdr.block_size != s->DATA_BLOCK_SIZE) {
+			fprintf(stderr, "checkpoint %s was taken with a different geometry\n", file);
+			res = -1;
+			break;
+		}
+		p = (char *)realloc(payload, hdr.payload_len ? hdr.payload_len : 1);
+		if (!p) {
+			res = -1;
+			break;
+		}
+		payload = p;
+		/* a torn or corrupt tail means the last checkpoint never completed */
+		if (read_exact(fd, payload, hdr.payload_len) != 0 ||
+		    read_exact(fd, &tr, sizeof(tr)) != 0 || tr.seq != hdr.seq ||
+		    tr.checksum != fnv1a(payload, hdr.payload_len) ||
+		    apply(&hdr, payload, payload + hdr.payload_len) != 0)
+			break;
+		seq = hdr.seq;
+		good += (off_t)(sizeof(hdr) + hdr.payload_len + sizeof(tr));
+		if (hdr.kind == CKPT_FULL)
+			full_bytes = good;
+	}
+	free(payload);
+	close(fd);
+	file_bytes = good;
+
+	/* directories first (parents come before children), so that nested
+	   mirror files can be created */
+	for (p = loaded_dirs.data; p && p < loaded_dirs.data + loaded_dirs.len; p += strlen(p) + 1) {
+		snprintf(fpath, sizeof(fpath), "%s%s", s->rootdir, p);
+		mkdir(fpath, 0755);
+		alloc_mkdir(p);
+	}
+	free(loaded_dirs.data);
+	memset(&loaded_dirs, 0, sizeof(loaded_dirs));
+
+	/* the mirror files only have to exist; contents are served from memory */
+	for (i = 0; i < s->path_count; i++) {
+		snprintf(fpath, sizeof(fpath), "%s%s", s->rootdir, s->path_to_inode[i].path);
+		fd = open(fpath, O_CREAT | O_WRONLY | O_CLOEXEC, 0644);
+		if (fd != -1)
+			close(fd);
+	}
+	if (res == 0 && good > 0 && truncate(file, good) != 0)
+		res = -1;
+	return res;
+}
+
+int ckpt_start(const char *file, struct myfs_state *s, off_t *logical_size,
+               unsigned interval_sec)
+{
+	pthread_rwlockattr_t attr;
+
+	st = s;
+	lsize = logical_size;
+	interval = interval_sec ? interval_sec : 1;
+	ckpt_file = strdup(file);
+	block_dirty = (char *)calloc((size_t)s->NUM_DATA_BLOCKS, 1);
+	inode_dirty = (char *)calloc((size_t)s->NUM_INODES, 1);
+	dirty_blocks = (int *)malloc((size_t)s->NUM_DATA_BLOCKS * sizeof(int));
+	dirty_inodes = (int *)malloc((size_t)s->NUM_INODES * sizeof(int));
+	pending = (char *)calloc((size_t)s->NUM_DATA_BLOCKS, 1);
+	slot = (size_t *)malloc((size_t)s->NUM_DATA_BLOCKS * sizeof(size_t));
+	cut_blocks = (int *)malloc((size_t)s->NUM_DATA_BLOCKS * sizeof(int));
+	if (!ckpt_file || !block_dirty || !inode_dirty || !dirty_blocks || !dirty_inodes ||
+	    !pending || !slot || !cut_blocks)
+		goto fail;
+
+	/* glibc prefers readers by default: under steady load the checkpoint
+	   thread would never get the freeze */
+	pthread_rwlockattr_init(&attr);
+	pthread_rwlockattr_setkind_np(&attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+	pthread_rwlock_destroy(&freeze);
+	pthread_rwlock_init(&freeze, &attr);
+	pthread_rwlockattr_destroy(&attr);
+
+	/* an empty or missing file starts with a full image */
+	need_full = file_bytes == 0;
+	ckpt_fd = open(file, O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC, 0644);
+	if (ckpt_fd == -1)
+		goto fail;
+	enabled = 1;
+	if (pthread_create(&ckpt_thread, NULL, ckpt_main, NULL) != 0) {
+		enabled = 0;
+		close(ckpt_fd);
+		ckpt_fd = -1;
+		goto fail;
+	}
+	return 0;
+
+fail:
+	free(ckpt_file);
+	free(block_dirty);
+	free(inode_dirty);
+	free(dirty_blocks);
+	free(dirty_inodes);
+	free(pending);
+	free(slot);
+	free(cut_blocks);
+	ckpt_file = NULL;
+	block_dirty = inode_dirty = pending = NULL;
+	dirty_blocks = dirty_inodes = cut_blocks = NULL;
+	slot = NULL;
+	return -1;
+}
+
+void ckpt_stop(void)
+{
+	if (!enabled)
+		return;
+	pthread_mutex_lock(&stop_lock);
+	stopping = 1;
+	pthread_cond_signal(&stop_cond);
+	pthread_mutex_unlock(&stop_lock);
+	pthread_join(ckpt_thread, NULL);
+	enabled = 0;
+	close(ckpt_fd);
+	ckpt_fd = -1;
+	free(ckpt_file);
+	free(block_dirty);
+	free(inode_dirty);
+	free(dirty_blocks);
+	free(dirty_inodes);
+	free(pending);
+	free(slot);
+	free(cut_blocks);
+	ckpt_file = NULL;
+	block_dirty = inode_dirty = pending = NULL;
+	dirty_blocks = dirty_inodes = cut_blocks = NULL;
+	slot = NULL;
+}
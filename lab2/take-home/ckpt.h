@@ -0,0 +1,55 @@
+#ifndef _CKPT_H_
+#define _CKPT_H_
+
+#include "params.h"
+#include <sys/types.h>
+
+/*
+ * Background incremental checkpointing (--checkpoint=FILE).
+ *
+ * Mutations mark data blocks, inodes and the path map dirty. Every interval
+ * a checkpoint thread takes a consistent cut by briefly excluding FUSE
+ * operations (they hold the freeze lock shared through ckpt_enter/ckpt_exit,
+ * which prefers the checkpoint thread once it waits): it copies the dirty
+ * metadata, notes which block payloads belong to the cut and clears the dirty
+ * sets. The payloads are copied after the freeze; an operation about to
+ * change one that is not copied yet copies it first (copy-on-write). The cut
+ * is appended to FILE as a delta.
+ *
+ * FILE is a full image of the live inodes, blocks, paths and mirror
+ * directories followed by deltas. When the deltas outgrow the live data the
+ * file is compacted into a fresh full image (written aside and renamed into
+ * place), so loading it at mount costs time proportional to live data rather
+ * than NUM_DATA_BLOCKS.
+ * A torn delta at the end of the file (crash while writing) is ignored.
+ */
+
+/* Load FILE (if it exists) into s; called from myfs_init before any
+   operation runs. Returns -1 if FILE exists but does not match s. */
+int ckpt_load(const char *file, struct myfs_state *s, off_t *logical_size);
+
+/* Start the checkpoint thread */
+int ckpt_start(const char *file, struct myfs_state *s, off_t *logical_size,
+               unsigned interval_sec);
+
+/* Write a final checkpoint and stop the thread */
+void ckpt_stop(void);
+
+/* Bracket every mutating FUSE operation */
+void ckpt_enter(void);
+void ckpt_exit(void);
+
+/* Dirty tracking (no-ops unless checkpointing is on) */
+void ckpt_dirty_block(int block);
+void ckpt_dirty_inode(int ino);
+void ckpt_dirty_paths(void);     /* also for directories */
+
+/* block's payload is about to change: if the cut being written still needs
+   its old contents, copy them now (called by tier_get and tier_discard) */
+void ckpt_preserve_block(int block);
+
+/* Everything changed (a replication snapshot replaced the state); the next
+   checkpoint is a full image */
+void ckpt_dirty_all(void);
+
+#endif
@@ -0,0 +1,547 @@
+#define _GNU_SOURCE
+
+#include "mirror.h"
+#include "prof.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include <pthread.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+/* --- synchronous backend --- */
+static ssize_t sync_pwrite(int fd, const char *buf, size_t size, off_t offset)
+{
+	uint64_t prof = prof_begin();
+	size_t done = 0;
+	ssize_t res;
+
+	while (done < size) {
+		res = pwrite(fd, buf + done, size - done, offset + (off_t)done);
+		if (res == -1) {
+			if (errno == EINTR)
+				continue;
+			res = -errno;
+			prof_end("mirror_pwrite", prof, (int64_t)done);
+			return res;
+		}
+		done += (size_t)res;
+	}
+	prof_end("mirror_pwrite", prof, (int64_t)size);
+	return (ssize_t)size;
+}
+
+static int sync_unlink(const char *fpath)
+{
+	uint64_t prof = prof_begin();
+	int res = unlink(fpath) == -1 ? -errno : 0;
+	prof_end("mirror_unlink", prof, -1);
+	return res;
+}
+
+#ifdef MYFS_HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/* --- io_uring ring (raw syscalls, no liburing dependency) --- */
+struct uring {
+	int fd;
+	unsigned entries;
+	void *sq_ptr, *cq_ptr;
+	size_t sq_len, cq_len;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	unsigned sq_local_tail;
+};
+
+static int uring_setup(struct uring *r, unsigned entries)
+{
+	struct io_uring_params p;
+	char *sq, *cq;
+
+	memset(&p, 0, sizeof(p));
+	memset(r, 0, sizeof(*r));
+	r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+	if (r->fd < 0)
+		return -1;
+	r->entries = p.sq_entries;
+
+	r->sq_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	r->cq_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (r->cq_len > r->sq_len)
+			r->sq_len = r->cq_len;
+		r->cq_len = r->sq_len;
+	}
+	r->sq_ptr = mmap(NULL, r->sq_len, PROT_READ | PROT_WRITE,
+	                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+	if (r->sq_ptr == MAP_FAILED)
+		goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		r->cq_ptr = r->sq_ptr;
+	} else {
+		r->cq_ptr = mmap(NULL, r->cq_len, PROT_READ | PROT_WRITE,
+		                 MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+		if (r->cq_ptr == MAP_FAILED)
+			goto fail_sq;
+	}
+	r->sqes = (struct io_uring_sqe *)mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+	                                      PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+	                                      r->fd, IORING_OFF_SQES);
+	if (r->sqes == MAP_FAILED)
+		goto fail_cq;
+
+	sq = (char *)r->sq_ptr;
+	cq = (char *)r->cq_ptr;
+	r->sq_head = (unsigned *)(sq + p.sq_off.head);
+	r->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	r->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	r->sq_array = (unsigned *)(sq + p.sq_off.array);
+	r->cq_head = (unsigned *)(cq + p.cq_off.head);
+	r->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	r->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	r->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+	r->sq_local_tail = *r->sq_tail;
+	return 0;
+
+fail_cq:
+	if (r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_len);
+fail_sq:
+	munmap(r->sq_ptr, r->sq_len);
+fail:
+	close(r->fd);
+	return -1;
+}
+
+static void uring_teardown(struct uring *r)
+{
+	munmap(r->sqes, r->entries * sizeof(struct io_uring_sqe));
+	if (r->cq_ptr != r->sq_ptr)
+		munmap(r->cq_ptr, r->cq_len);
+	munmap(r->sq_ptr, r->sq_len);
+	close(r->fd);
+}
+
+static struct io_uring_sqe *uring_get_sqe(struct uring *r)
+{
+	unsigned tail = r->sq_local_tail;
+	unsigned idx = tail & *r->sq_mask;
+	struct io_uring_sqe *sqe = &r->sqes[idx];
+
+	memset(sqe, 0, sizeof(*sqe));
+	r->sq_array[idx] = idx;
+	r->sq_local_tail = tail + 1;
+	return sqe;
+}
+
+/* Publish queued SQEs and wait for at least wait_nr completions */
+static int uring_enter(struct uring *r, unsigned wait_nr)
+{
+	unsigned to_submit;
+	int res;
+
+	__atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+	for (;;) {
+		to_submit = r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+		res = (int)syscall(__NR_io_uring_enter, r->fd, to_submit, wait_nr,
+		                   wait_nr ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+		if (res >= 0 || (errno != EINTR && errno != EAGAIN && errno != EBUSY))
+			return res;
+	}
+}
+
+/* --- per-path ordering --- */
+struct mirror_file;
+
+struct mirror_req {
+	unsigned char op;           /* IORING_OP_WRITE or IORING_OP_UNLINKAT */
+	int fd;
+	char *buf;
+	size_t size, done;
+	off_t offset;
+	char *fpath;
+	struct mirror_file *file;
+	struct mirror_req *next;        /* next op on the same path */
+	struct mirror_req *ready_next;  /* next op waiting for submission */
+};
+
+struct mirror_file {
+	char *path;
+	struct mirror_req *head, *tail; /* head is in flight or on the ready list */
+	struct mirror_file *next;
+};
+
+#define MIRROR_HASH_SIZE 1024
+
+static struct uring ring;
+static pthread_t reaper;
+static pthread_mutex_t mirror_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static struct mirror_file *files[MIRROR_HASH_SIZE];
+static struct mirror_req *ready_head, *ready_tail;
+static unsigned inflight, queued;
+static int stopping;
+static void (*report_failed)(const char *path, int unlinked, int err);
+
+static unsigned path_hash(const char *path)
+{
+	unsigned h = 5381;
+	while (*path)
+		h = h * 33 + (unsigned char)*path++;
+	return h & (MIRROR_HASH_SIZE - 1);
+}
+
+static struct mirror_file *file_lookup(const char *path, int create)
+{
+	unsigned h = path_hash(path);
+	struct mirror_file *f;
+
+	for (f = files[h]; f; f = f->next)
+		if (strcmp(f->path, path) == 0)
+			return f;
+	if (!create)
+		return NULL;
+	f = (struct mirror_file *)calloc(1, sizeof(*f));
+	if (!f)
+		return NULL;
+	f->path = strdup(path);
+	if (!f->path) {
+		free(f);
+		return NULL;
+	}
+	f->next = files[h];
+	files[h] = f;
+	return f;
+}
+
+static void file_release(struct mirror_file *f)
+{
+	struct mirror_file **pp;
+
+	if (f->head)
+		return;
+	for (pp = &files[path_hash(f->path)]; *pp; pp = &(*pp)->next) {
+		if (*pp == f) {
+			*pp = f->next;
+			free(f->path);
+			free(f);
+			return;
+		}
+	}
+}
+
+static void ready_push(struct mirror_req *req)
+{
+	req->ready_next = NULL;
+	if (ready_tail)
+		ready_tail->ready_next = req;
+	else
+		ready_head = req;
+	ready_tail = req;
+}
+
+static void req_prep(struct mirror_req *req)
+{
+	struct io_uring_sqe *sqe = uring_get_sqe(&ring);
+
+	sqe->opcode = req->op;
+	sqe->user_data = (unsigned long long)(uintptr_t)req;
+	if (req->op == IORING_OP_WRITE) {
+		sqe->fd = req->fd;
+		sqe->addr = (unsigned long long)(uintptr_t)(req->buf + req->done);
+		sqe->len = (unsigned)(req->size - req->done);
+		sqe->off = (unsigned long long)(req->offset + (off_t)req->done);
+	} else {
+		sqe->fd = AT_FDCWD;
+		sqe->addr = (unsigned long long)(uintptr_t)req->fpath;
+	}
+}
+
+/* Called with mirror_lock held */
+static void req_complete(struct mirror_req *req, int res)
+{
+	struct mirror_file *f = req->file;
+
+	if (req->op == IORING_OP_WRITE && res > 0 && req->done + (size_t)res < req->size) {
+		/* short write: issue the remainder before anything else on this path */
+		req->done += (size_t)res;
+		ready_push(req);
+		return;
+	}
+	/* kernels before 5.11 lack IORING_OP_UNLINKAT */
+	if (req->op == IORING_OP_UNLINKAT && res == -EINVAL)
+		res = sync_unlink(req->fpath);
+	if (req->op == IORING_OP_WRITE && res == 0 && req->size > 0)
+		res = -EIO;
+	if (res < 0 && report_failed)
+		report_failed(f->path, req->op == IORING_OP_UNLINKAT, res);
+
+	f->head = req->next;
+	if (!f->head)
+		f->tail = NULL;
+	else
+		ready_push(f->head);
+	queued--;
+	free(req->buf);
+	free(req->fpath);
+	free(req);
+	file_release(f);
+}
+
+static void *reaper_main(void *arg)
+{
+	struct mirror_req *req;
+	struct io_uring_cqe *cqe;
+	unsigned head, tail, n;
+	(void)arg;
+
+	pthread_mutex_lock(&mirror_lock);
+	for (;;) {
+		while (!ready_head && inflight == 0 && !stopping)
+			pthread_cond_wait(&work_cond, &mirror_lock);
+		if (!ready_head && inflight == 0 && stopping)
+			break;
+
+		/* everything that became ready since the last round goes in one batch */
+		for (n = 0; ready_head && inflight + n < ring.entries; n++) {
+			req = ready_head;
+			ready_head = req->ready_next;
+			if (!ready_head)
+				ready_tail = NULL;
+			req_prep(req);
+		}
+		inflight += n;
+		pthread_mutex_unlock(&mirror_lock);
+
+		uring_enter(&ring, 1);
+
+		pthread_mutex_lock(&mirror_lock);
+		head = *ring.cq_head;
+		tail = __atomic_load_n(ring.cq_tail, __ATOMIC_ACQUIRE);
+		for (; head != tail; head++) {
+			cqe = &ring.cqes[head & *ring.cq_mask];
+			inflight--;
+			req_complete((struct mirror_req *)(uintptr_t)cqe->user_data, cqe->res);
+		}
+		__atomic_store_n(ring.cq_head, head, __ATOMIC_RELEASE);
+		pthread_cond_broadcast(&done_cond);
+	}
+	pthread_mutex_unlock(&mirror_lock);
+	return NULL;
+}
+
+static int mirror_enqueue(struct mirror_req *req, const char *path)
+{
+	struct mirror_file *f;
+	uint64_t prof = prof_begin();
+	int64_t bytes = (int64_t)req->size;  /* req may complete once queued */
+
+	pthread_mutex_lock(&mirror_lock);
+	f = file_lookup(path, 1);
+	if (!f) {
+		pthread_mutex_unlock(&mirror_lock);
+		return -ENOMEM;
+	}
+	req->file = f;
+	req->next = NULL;
+	if (f->tail) {
+		f->tail->next = req;
+	} else {
+		f->head = req;
+		ready_push(req);
+	}
+	f->tail = req;
+	queued++;
+	pthread_cond_signal(&work_cond);
+	pthread_mutex_unlock(&mirror_lock);
+	prof_end("mirror_enqueue", prof, bytes);
+	return 0;
+}
+
+#endif /* MYFS_HAVE_IO_URING */
+
+static enum mirror_mode mode = MIRROR_SYNC;
+
+enum mirror_mode mirror_init(enum mirror_mode want, unsigned entries,
+                             void (*failed)(const char *path, int unlinked, int err))
+{
+	mode = MIRROR_SYNC;
+#ifdef MYFS_HAVE_IO_URING
+	report_failed = failed;
+	if (want == MIRROR_URING && uring_setup(&ring, entries) == 0) {
+		stopping = 0;
+		if (pthread_create(&reaper, NULL, reaper_main, NULL) == 0)
+			mode = MIRROR_URING;
+		else
+			uring_teardown(&ring);
+	}
+#else
+	(void)want;
+	(void)entries;
+	(void)failed;
+#endif
+	return mode;
+}
+
+void mirror_shutdown(void)
+{
+#ifdef MYFS_HAVE_IO_URING
+	if (mode != MIRROR_URING)
+		return;
+	pthread_mutex_lock(&mirror_lock);
+	stopping = 1;
+	pthread_cond_signal(&work_cond);
+	pthread_mutex_unlock(&mirror_lock);
+	pthread_join(reaper, NULL);
+	uring_teardown(&ring);
+	mode = MIRROR_SYNC;
+#endif
+}
+
+ssize_t mirror_pwrite(const char *path, int fd, const void *buf, size_t size, off_t offset)
+{
+#ifdef MYFS_HAVE_IO_URING
+	struct mirror_req *req;
+
+	if (mode == MIRROR_URING) {
+		req = (struct mirror_req *)calloc(1, sizeof(*req));
+		if (!req)
+			return -ENOMEM;
+		req->buf = (char *)malloc(size ? size : 1);
+		if (!req->buf) {
+			free(req);
+			return -ENOMEM;
+		}
+		memcpy(req->buf, buf, size);
+		req->op = IORING_OP_WRITE;
+		req->fd = fd;
+		req->size = size;
+		req->offset = offset;
+		if (mirror_enqueue(req, path) != 0) {
+			free(req->buf);
+			free(req);
+			return -ENOMEM;
+		}
+		return (ssize_t)size;
+	}
+#else
+	(void)path;
+#endif
+	return sync_pwrite(fd, (const char *)buf, size, offset);
+}
+
+int mirror_unlink(const char *path, const char *fpath)
+{
+#ifdef MYFS_HAVE_IO_URING
+	struct mirror_req *req;
+
+	if (mode == MIRROR_URING) {
+		req = (struct mirror_req *)calloc(1, sizeof(*req));
+		if (!req)
+			return -ENOMEM;
+		req->fpath = strdup(fpath);
+		if (!req->fpath) {
+			free(req);
+			return -ENOMEM;
+		}
+		req->op = IORING_OP_UNLINKAT;
+		if (mirror_enqueue(req, path) != 0) {
+			free(req->fpath);
+			free(req);
+			return -ENOMEM;
+		}
+		return 0;
+	}
+#else
+	(void)path;
+#endif
+	return sync_unlink(fpath);
+}
+
+void mirror_sync_path(const char *path)
+{
+#ifdef MYFS_HAVE_IO_URING
+	uint64_t prof;
+
+	if (mode != MIRROR_URING)
+		return;
+	prof = prof_begin();
+	pthread_mutex_lock(&mirror_lock);
+	while (file_lookup(path, 0) != NULL)
+		pthread_cond_wait(&done_cond, &mirror_lock);
+	pthread_mutex_unlock(&mirror_lock);
+	prof_end("mirror_wait", prof, -1);
+#else
+	(void)path;
+#endif
+}
+
+void mirror_sync_all(void)
+{
+#ifdef MYFS_HAVE_IO_URING
+	uint64_t prof;
+
+	if (mode != MIRROR_URING)
+		return;
+	prof = prof_begin();
+	pthread_mutex_lock(&mirror_lock);
+	while (queued > 0)
+		pthread_cond_wait(&done_cond, &mirror_lock);
+	pthread_mutex_unlock(&mirror_lock);
+	prof_end("mirror_wait", prof, -1);
+#endif
+}
+
+/* --- directory walk --- */
+static int walk_dirs(char fpath[PATH_MAX], size_t root_len, size_t len,
+                     int (*fn)(const char *path, void *arg), void *arg)
+{
+	struct dirent *de;
+	struct stat sb;
+	size_t n;
+	int res = 0;
+	DIR *dp = opendir(fpath);
+
+	if (!dp)
+		return -errno;
+	while (res == 0 && (de = readdir(dp)) != NULL) {
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+		n = strlen(de->d_name);
+		if (len + 1 + n >= PATH_MAX)
+			continue;
+		fpath[len] = '/';
+		memcpy(fpath + len + 1, de->d_name, n + 1);
+		if (de->d_type == DT_DIR ||
+		    (de->d_type == DT_UNKNOWN && lstat(fpath, &sb) == 0 && S_ISDIR(sb.st_mode))) {
+			res = fn(fpath + root_len, arg);
+			if (res == 0)
+				res = walk_dirs(fpath, root_len, len + 1 + n, fn, arg);
+		}
+	}
+	fpath[len] = '\0';
+	closedir(dp);
+	return res;
+}
+
+int mirror_walk_dirs(const char *rootdir, int (*fn)(const char *path, void *arg), void *arg)
+{
+	char fpath[PATH_MAX];
+	size_t len = strlen(rootdir);
+
+	if (len >= PATH_MAX)
+		return -ENAMETOOLONG;
+	memcpy(fpath, rootdir, len + 1);
+	return walk_dirs(fpath, len, len, fn, arg);
+}
@@ -0,0 +1,50 @@
+#ifndef _MIRROR_H_
+#define _MIRROR_H_
+
+#include <sys/types.h>
+
+/*
+ * Backend for the rootdir mirror. By default (MIRROR_SYNC) every call is a
+ * plain blocking syscall. With io_uring (--mirror=uring), writes and unlinks
+ * are queued and completed by a background thread; operations on the same
+ * path are issued strictly in order, different paths proceed in parallel.
+ *
+ * Errors of queued operations cannot be returned to the FUSE callback that
+ * queued them, and no later operation should inherit them; they are handed
+ * to the failed callback as they are reaped.
+ */
+
+enum mirror_mode {
+	MIRROR_SYNC,
+	MIRROR_URING,
+};
+
+/* Start the backend; falls back to MIRROR_SYNC if io_uring is unavailable.
+   Must be called after fuse_main has daemonized (i.e. from myfs_init).
+   failed(path, unlinked, err) runs on the completion thread for every queued
+   write (unlinked == 0) or unlink that failed with -errno err. */
+enum mirror_mode mirror_init(enum mirror_mode want, unsigned entries,
+                             void (*failed)(const char *path, int unlinked, int err));
+
+/* Wait for every queued operation and stop the backend */
+void mirror_shutdown(void);
+
+/* pwrite(fd, ...) ordered behind earlier ops on path; buf is copied */
+ssize_t mirror_pwrite(const char *path, int fd, const void *buf, size_t size, off_t offset);
+
+/* unlink(fpath) ordered behind earlier ops on path */
+int mirror_unlink(const char *path, const char *fpath);
+
+/* Wait until every queued op on path has completed */
+void mirror_sync_path(const char *path);
+
+/* Wait until every queued op has completed */
+void mirror_sync_all(void);
+
+/* Call fn(path, arg) for every directory under rootdir, each before the
+   directories inside it; path is relative to rootdir ("/a", "/a/b"). Stops
+   at the first nonzero result of fn and returns it, or -errno if a
+   directory cannot be read. */
+int mirror_walk_dirs(const char *rootdir, int (*fn)(const char *path, void *arg), void *arg);
+
+#endif
@@ -8,6 +8,13 @@
 */
 
 #include "params.h"
+#include "trace.h"
+#include "mirror.h"
+#include "alloc.h"
+#include "repl.h"
+#include "ckpt.h"
+#include "tier.h"
+#include "prof.h"
 #include <fuse3/fuse.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,9 +31,8 @@
 /* --- data_block init/free --- */
 void data_block_init(struct data_block *b, int size)
 {
-	b->data = (char *)malloc((size_t)size);
-	if (b->data)
-		memset(b->data, 0, (size_t)size);
+	/* calloc leaves untouched pages unmapped until a block is written */
+	b->data = (char *)calloc(1, (size_t)size);
 }
 
 void data_block_free(struct data_block *b)
@@ -63,12 +69,43 @@ void path_to_inode_remove(struct myfs_state *s, const char *path)
 
 int path_to_inode_lookup(struct myfs_state *s, const char *path)
 {
-	int i;
+	uint64_t prof = prof_begin();
+	int i, ino = -1;
 	for (i = 0; i < s->path_count; i++) {
-		if (strcmp(s->path_to_inode[i].path, path) == 0)
-			return s->path_to_inode[i].inode;
+		if (strcmp(s->path_to_inode[i].path, path) == 0) {
+			ino = s->path_to_inode[i].inode;
+			break;
+		}
 	}
-	return -1;
+	prof_end("lookup", prof, -1);
+	return ino;
+}
+
+/* --- inode block lists --- */
+/* Block lists grow geometrically, so an inode costs memory proportional to
+   its size rather than NUM_DATA_BLOCKS; inode->blocks is always allocated for
+   at least block_list_cap(num_blocks) entries. */
+#define INODE_MIN_BLOCKS 8
+
+static size_t block_list_cap(int n)
+{
+	size_t cap = INODE_MIN_BLOCKS;
+	while (cap < (size_t)n)
+		cap *= 2;
+	return cap;
+}
+
+int inode_reserve_blocks(struct inode *inode, int n)
+{
+	int *blocks;
+
+	if (n > 0 && (size_t)n <= block_list_cap(inode->num_blocks))
+		return 0;
+	blocks = (int *)realloc(inode->blocks, block_list_cap(n) * sizeof(int));
+	if (!blocks)
+		return -1;
+	inode->blocks = blocks;
+	return 0;
 }
 
 /* --- myfs_state create/destroy --- */
@@ -142,7 +179,7 @@ struct myfs_state *myfs_state_create(FILE *log, const char *root, int num_inodes
 			return NULL;
 		}
 		s->inodes[i]->num_blocks = 0;
-		s->inodes[i]->blocks = (int *)malloc((size_t)num_data_blocks * sizeof(int));
+		s->inodes[i]->blocks = (int *)malloc(INODE_MIN_BLOCKS * sizeof(int));
 		if (!s->inodes[i]->blocks) {
 			free(s->inodes[i]);
 			while (i--)
@@ -299,6 +336,18 @@ void log_msg(const char *format, ...)
 }
 
 /* --- FUSE operations --- */
+/* log_fuse_context reads payloads in place through data_blocks[b]->data;
+   no block may be evicted or faulted in meanwhile */
+static void log_context(void)
+{
+	uint64_t prof = prof_begin();
+
+	tier_freeze();
+	log_fuse_context();
+	tier_thaw();
+	prof_end("log_fuse_context", prof, -1);
+}
+
 static void myfs_fullpath(char fpath[PATH_MAX], const char *path)
 {
 	strcpy(fpath, MYFS_DATA->rootdir);
@@ -306,63 +355,260 @@ static void myfs_fullpath(char fpath[PATH_MAX], const char *path)
 	fpath[PATH_MAX - 1] = '\0';
 }
 
-	/* TODO: Implement find_free_inode, find_free_data_block, count_free_data_blocks, allocate_blocks_for_append, and g_inode_logical_size. */
+/* --- inode and data block allocation --- */
+
+/* Logical size of each file, tracked independently of the mirror */
+static off_t *g_inode_logical_size;
+
+/* Mirror backend requested on the command line (--mirror=sync|uring) */
+static enum mirror_mode g_mirror_mode = MIRROR_SYNC;
+
+/* Log of the mounted state, for mirror failures reported off FUSE threads */
+static FILE *g_mirror_log;
+
+/* Replication role and peer address (--replicate=ADDR / --standby=ADDR) */
+static enum repl_mode g_repl_mode = REPL_OFF;
+static const char *g_repl_addr;
+
+/* Checkpoint file and interval (--checkpoint=FILE, --checkpoint-interval=SEC) */
+static const char *g_ckpt_file;
+static unsigned g_ckpt_interval = 5;
+
+/* Allocate at least n blocks for inode ino, which holds have, into out[]
+   (room for n plus a run of the largest class); all or nothing. A file that
+   already holds a class's run length grows by whole aligned runs of the
+   largest such class, so the last run may extend past what the append
+   needs: those blocks belong to the file like the others and take its next
+   appends. Returns the number of blocks allocated, or -1. */
+static int take_blocks(int ino, int have, int n, int *out)
+{
+	int got = 0, c, first, i;
+
+	while (got < n) {
+		for (c = alloc_num_classes() - 1; c > 0 && alloc_class_run(c) > have + got; c--)
+			;
+		first = c > 0 ? alloc_run(ino, c) : -1;
+		if (first < 0)
+			break;
+		for (i = 0; i < alloc_class_run(c); i++)
+			out[got++] = first + i;
+	}
+	if (got < n) {
+		if (alloc_blocks(ino, n - got, out + got) != 0) {
+			while (got--)
+				alloc_free_block(out[got]);
+			return -1;
+		}
+		got = n;
+	}
+	return got;
+}
+
+/* Grow inode ino to hold end bytes; returns -1 (allocating nothing) if there
+   are not enough free blocks */
+static int allocate_blocks_for_append(struct myfs_state *s, int ino, off_t end)
+{
+	struct inode *inode = s->inodes[ino];
+	off_t total = (end + s->DATA_BLOCK_SIZE - 1) / s->DATA_BLOCK_SIZE;
+	int needed, got, j;
+
+	/* computed in off_t: a far offset must not wrap to a small block count */
+	if (total > s->NUM_DATA_BLOCKS)
+		return -1;
+	needed = (int)total - inode->num_blocks;
+	if (needed <= 0)
+		return 0;
+	if (inode_reserve_blocks(inode, (int)total + alloc_class_run(alloc_num_classes() - 1) - 1) != 0)
+		return -1;
+	got = take_blocks(ino, inode->num_blocks, needed, inode->blocks + inode->num_blocks);
+	if (got < 0)
+		return -1;
+	for (j = 0; j < got; j++) {
+		repl_block_bitmap(inode->blocks[inode->num_blocks + j], 1);
+		ckpt_dirty_block(inode->blocks[inode->num_blocks + j]);
+	}
+	repl_inode_blocks(ino, inode->num_blocks, got, inode->blocks + inode->num_blocks);
+	ckpt_dirty_inode(ino);
+	inode->num_blocks += got;
+	return 0;
+}
+
+static void free_inode_blocks(struct myfs_state *s, int ino)
+{
+	struct inode *inode = s->inodes[ino];
+	int j, b;
+	for (j = 0; j < inode->num_blocks; j++) {
+		b = inode->blocks[j];
+		tier_discard(b);
+		alloc_free_block(b);
+		repl_block_bitmap(b, 0);
+		ckpt_dirty_block(b);
+	}
+	inode->num_blocks = 0;
+	inode_reserve_blocks(inode, 0);
+	repl_inode_blocks(ino, 0, 0, NULL);
+	ckpt_dirty_inode(ino);
+}
 
 static int myfs_unlink(const char *path)
 {
-	int res;
+	struct myfs_state *s = MYFS_DATA;
+	int res, ino;
 	char fpath[PATH_MAX];
 	myfs_fullpath(fpath, path);
 
 	log_msg("DELETE %s\n", path);
 
-	/* TODO: Lookup inode, free its data blocks, clear inode and path map, reset logical size. */
+	ino = path_to_inode_lookup(s, path);
+	if (ino >= 0) {
+		free_inode_blocks(s, ino);
+		alloc_free_inode(ino);
+		path_to_inode_remove(s, path);
+		g_inode_logical_size[ino] = 0;
+		repl_inode_bitmap(ino, 0);
+		repl_path_remove(path);
+		repl_size(ino, 0);
+		ckpt_dirty_inode(ino);
+		ckpt_dirty_paths();
+	}
 
-	res = unlink(fpath);
-	if (res == -1) {
+	res = mirror_unlink(path, fpath);
+	if (res < 0) {
 		log_msg("ERROR: DELETE %s\n", path);
-		log_fuse_context();
-		return -errno;
+		log_context();
+		return res;
 	}
 
-	log_fuse_context();
+	log_context();
 	return 0;
 }
 
 static int myfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
-	int res;
+	struct myfs_state *s = MYFS_DATA;
+	int res, ino, added = 0;
+	uint64_t prof;
 	char fpath[PATH_MAX];
 	myfs_fullpath(fpath, path);
 
 	log_msg("CREATE %s\n", path);
 
-	/* TODO: Find free inode (fail with INODES FULL if none), set bitmap/path map/logical size. */
+	ino = path_to_inode_lookup(s, path);
+	if (ino < 0) {
+		prof = prof_begin();
+		ino = alloc_inode(path);
+		prof_end("alloc", prof, -1);
+		if (ino < 0) {
+			log_msg("ERROR: INODES FULL\n");
+			log_context();
+			return -1;
+		}
+		path_to_inode_add(s, path, ino);
+		g_inode_logical_size[ino] = 0;
+		repl_inode_bitmap(ino, 1);
+		repl_path_add(path, ino);
+		repl_size(ino, 0);
+		ckpt_dirty_inode(ino);
+		ckpt_dirty_paths();
+		added = 1;
+	}
 
+	/* a queued unlink of an earlier file at this path must land first */
+	mirror_sync_path(path);
+	prof = prof_begin();
 	res = open(fpath, fi->flags, mode);
+	prof_end("mirror_open", prof, -1);
 	if (res == -1) {
+		res = -errno;
+		/* a file that was already tracked keeps its inode */
+		if (added) {
+			alloc_free_inode(ino);
+			path_to_inode_remove(s, path);
+			repl_inode_bitmap(ino, 0);
+			repl_path_remove(path);
+			ckpt_dirty_inode(ino);
+			ckpt_dirty_paths();
+		}
 		log_msg("ERROR: CREATE %s\n", path);
-		log_fuse_context();
-		return -errno;
+		log_context();
+		return res;
 	}
 
 	fi->fh = (uint64_t)(unsigned long)res;
-	log_fuse_context();
+	log_context();
 	return 0;
 }
 
+/* Number of blocks from the file's j-th on, up to the one holding byte end - 1,
+   whose payloads follow each other in memory and can be copied as one */
+static int contiguous_run(struct myfs_state *s, struct inode *inode, int j, off_t end)
+{
+	int n = 1;
+
+	if (!tier_contiguous())
+		return 1;
+	while (j + n < inode->num_blocks && (off_t)(j + n) * s->DATA_BLOCK_SIZE < end &&
+	       inode->blocks[j + n] == inode->blocks[j] + n)
+		n++;
+	return n;
+}
+
 static int myfs_read(const char *path, char *buf, size_t size, off_t offset,
                      struct fuse_file_info *fi)
 {
-	int fd;
+	struct myfs_state *s = MYFS_DATA;
+	struct inode *inode;
+	int fd, ino, j, b, run;
 	ssize_t res;
+	off_t total_size, pos, end;
+	size_t in_block, n, k;
+	char *data;
+	uint64_t prof;
 	char fpath[PATH_MAX];
 	myfs_fullpath(fpath, path);
 
 	log_msg("READ %s\n", path);
 
-	/* TODO: Lookup inode, use logical size for total_size, log each block, copy from data blocks to buf. */
+	ino = path_to_inode_lookup(s, path);
+	if (ino >= 0) {
+		inode = s->inodes[ino];
+		total_size = g_inode_logical_size[ino];
+		end = offset + (off_t)size;
+		if (end > total_size)
+			end = total_size;
+		prof = prof_begin();
+		for (pos = offset; pos < end; pos += (off_t)n) {
+			j = (int)(pos / s->DATA_BLOCK_SIZE);
+			in_block = (size_t)(pos % s->DATA_BLOCK_SIZE);
+			run = contiguous_run(s, inode, j, end);
+			n = (size_t)run * (size_t)s->DATA_BLOCK_SIZE - in_block;
+			if ((off_t)n > end - pos)
+				n = (size_t)(end - pos);
+			b = inode->blocks[j];
+			data = tier_get_run(b, run, 0);
+			if (!data) {
+				log_msg("ERROR: READ %s\n", path);
+				log_context();
+				return -EIO;
+			}
+			/* logged block by block */
+			for (k = 0; k < n; k++) {
+				if (k == 0 || (in_block + k) % (size_t)s->DATA_BLOCK_SIZE == 0)
+					log_msg("%sDATA BLOCK %d: ", k == 0 ? "" : "\n",
+					        b + (int)((in_block + k) / (size_t)s->DATA_BLOCK_SIZE));
+				log_char(data[in_block + k]);
+			}
+			log_msg("\n");
+			memcpy(buf + (pos - offset), data + in_block, n);
+			tier_put_run(b, run);
+		}
+		prof_end("block_copy", prof, pos > offset ? pos - offset : 0);
+		log_context();
+		return pos > offset ? (int)(pos - offset) : 0;
+	}
 
+	/* not tracked in memory: serve from the mirror once queued writes land */
+	mirror_sync_path(path);
 	if (fi == NULL)
 		fd = open(fpath, O_RDONLY);
 	else
@@ -370,7 +616,7 @@ static int myfs_read(const char *path, char *buf, size_t size, off_t offset,
 
 	if (fd == -1) {
 		log_msg("ERROR: READ %s\n", path);
-		log_fuse_context();
+		log_context();
 		return -errno;
 	}
 
@@ -385,23 +631,74 @@ static int myfs_read(const char *path, char *buf, size_t size, off_t offset,
 	if (fi == NULL)
 		close(fd);
 
-	log_fuse_context();
+	log_context();
 	return (int)res;
 }
 
 static int myfs_write(const char *path, const char *buf, size_t size,
                       off_t offset, struct fuse_file_info *fi)
 {
-	int fd;
+	struct myfs_state *s = MYFS_DATA;
+	struct inode *inode;
+	int fd, ino, j, b, run;
 	ssize_t res;
+	off_t pos, end;
+	size_t in_block, n, k, m;
+	char *data;
+	uint64_t prof;
 	char fpath[PATH_MAX];
 	myfs_fullpath(fpath, path);
 
 	log_msg("WRITE %s\n", path);
 
-	/* TODO: Lookup inode; pack (fill last block first), allocate blocks, copy data, update logical size, pwrite. */
+	ino = path_to_inode_lookup(s, path);
+	if (ino >= 0) {
+		inode = s->inodes[ino];
+		end = offset + (off_t)size;
+		prof = prof_begin();
+		res = allocate_blocks_for_append(s, ino, end);
+		prof_end("alloc", prof, -1);
+		if (res != 0) {
+			log_msg("ERROR: NOT ENOUGH DATA BLOCKS\n");
+			log_context();
+			return -1;
+		}
+		prof = prof_begin();
+		for (pos = offset; pos < end; pos += (off_t)n) {
+			j = (int)(pos / s->DATA_BLOCK_SIZE);
+			in_block = (size_t)(pos % s->DATA_BLOCK_SIZE);
+			run = contiguous_run(s, inode, j, end);
+			n = (size_t)run * (size_t)s->DATA_BLOCK_SIZE - in_block;
+			if ((off_t)n > end - pos)
+				n = (size_t)(end - pos);
+			b = inode->blocks[j];
+			data = tier_get_run(b, run, 1);
+			if (!data) {
+				log_msg("ERROR: WRITE %s\n", path);
+				log_context();
+				return -EIO;
+			}
+			memcpy(data + in_block, buf + (pos - offset), n);
+			tier_put_run(b, run);
+			/* replicated and checkpointed block by block */
+			for (k = 0; k < n; k += m) {
+				b = inode->blocks[(pos + (off_t)k) / s->DATA_BLOCK_SIZE];
+				in_block = (size_t)((pos + (off_t)k) % s->DATA_BLOCK_SIZE);
+				m = (size_t)s->DATA_BLOCK_SIZE - in_block;
+				if (m > n - k)
+					m = n - k;
+				repl_block_data(b, (int)in_block, buf + (pos - offset) + k, (int)m);
+				ckpt_dirty_block(b);
+			}
+		}
+		prof_end("block_copy", prof, (int64_t)size);
+		if (end > g_inode_logical_size[ino]) {
+			g_inode_logical_size[ino] = end;
+			repl_size(ino, end);
+			ckpt_dirty_inode(ino);
+		}
+	}
 
-	(void)fi;
 	if (fi == NULL)
 		fd = open(fpath, O_WRONLY);
 	else
@@ -409,47 +706,94 @@ static int myfs_write(const char *path, const char *buf, size_t size,
 
 	if (fd == -1) {
 		log_msg("ERROR: WRITE %s\n", path);
-		log_fuse_context();
+		log_context();
 		return -errno;
 	}
 
-	res = pwrite(fd, buf, size, offset);
-	if (res == -1) {
+	/* the in-memory blocks are authoritative; the mirror copy may complete
+	   after we reply (with io_uring) */
+	if (fi == NULL) {
+		res = mirror_pwrite(path, fd, buf, size, offset);
+		/* the queued write still uses fd */
+		mirror_sync_path(path);
+		close(fd);
+	} else {
+		res = mirror_pwrite(path, fd, buf, size, offset);
+	}
+	if (res < 0) {
 		log_msg("ERROR: WRITE %s\n", path);
-		log_fuse_context();
-		if (fi == NULL)
-			close(fd);
-		return -errno;
+		log_context();
+		return (int)res;
 	}
 
-	if (fi == NULL)
-		close(fd);
-
-	log_fuse_context();
+	log_context();
 	return (int)res;
 }
 
+/* A queued mirror write or unlink failed after its operation replied; it is
+   logged as that operation's error rather than returned by a later one.
+   Runs on the mirror's completion thread, outside any FUSE context. */
+static void myfs_mirror_failed(const char *path, int unlinked, int err)
+{
+	(void)err;
+	fprintf(g_mirror_log, "ERROR: %s %s\n", unlinked ? "DELETE" : "WRITE", path);
+}
+
 static void *myfs_init(struct fuse_conn_info *conn, struct fuse_config *cfg)
 {
+	struct myfs_state *s = MYFS_DATA;
 	(void)conn;
 	cfg->use_ino = 1;
 	cfg->entry_timeout = 0;
 	cfg->attr_timeout = 0;
 	cfg->negative_timeout = 0;
-	/* TODO: Set direct_io and allocate g_inode_logical_size for NUM_INODES. */
-	return MYFS_DATA;
+	cfg->direct_io = 1;
+	/* runs after fuse_main has daemonized, so the reaper thread survives */
+	g_mirror_log = s->logfile;
+	mirror_init(g_mirror_mode, 256, myfs_mirror_failed);
+	if (g_ckpt_file) {
+		/* nothing is served yet, so the image is loaded in place; a
+		   primary then snapshots the loaded state to its standby */
+		if (ckpt_load(g_ckpt_file, s, g_inode_logical_size) != 0 ||
+		    ckpt_start(g_ckpt_file, s, g_inode_logical_size, g_ckpt_interval) != 0)
+			fprintf(stderr, "checkpointing to %s disabled\n", g_ckpt_file);
+	}
+	if (g_repl_mode != REPL_OFF &&
+	    repl_start(g_repl_mode, g_repl_addr, s, g_inode_logical_size) != 0)
+		fprintf(stderr, "replication to %s could not be started\n", g_repl_addr);
+	return s;
+}
+
+static void myfs_destroy(void *private_data)
+{
+	(void)private_data;
+	repl_stop();
+	ckpt_stop();
+	mirror_shutdown();
 }
 
 static int myfs_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
 {
-	int res;
+	int res, ino;
 	char fpath[PATH_MAX];
 	(void)fi;
 	myfs_fullpath(fpath, path);
 
+	/* Tracked files exist on the mirror and their size is known in memory,
+	   so only untracked paths (e.g. one with an unlink in flight) wait */
+	repl_begin_read();
+	ino = path_to_inode_lookup(MYFS_DATA, path);
+	if (ino < 0)
+		mirror_sync_path(path);
 	res = lstat(fpath, stbuf);
-	if (res == -1)
-		return -errno;
+	if (res == -1) {
+		res = -errno;
+		repl_end_read();
+		return res;
+	}
+	if (ino >= 0 && S_ISREG(stbuf->st_mode))
+		stbuf->st_size = g_inode_logical_size[ino];
+	repl_end_read();
 	return 0;
 }
 
@@ -466,6 +810,7 @@ static int myfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
 	(void)flags;
 	myfs_fullpath(fpath, path);
 
+	mirror_sync_all();
 	dp = opendir(fpath);
 	if (dp == NULL)
 		return -errno;
@@ -492,6 +837,9 @@ static int myfs_mkdir(const char *path, mode_t mode)
 	res = mkdir(fpath, mode);
 	if (res == -1)
 		return -errno;
+	alloc_mkdir(path);
+	repl_mkdir(path);
+	ckpt_dirty_paths();
 	return 0;
 }
 
@@ -501,9 +849,14 @@ static int myfs_rmdir(const char *path)
 	char fpath[PATH_MAX];
 	myfs_fullpath(fpath, path);
 
+	/* unlinks of the directory's files may still be queued */
+	mirror_sync_all();
 	res = rmdir(fpath);
 	if (res == -1)
 		return -errno;
+	alloc_rmdir(path);
+	repl_rmdir(path);
+	ckpt_dirty_paths();
 	return 0;
 }
 
@@ -513,6 +866,7 @@ static int myfs_open(const char *path, struct fuse_file_info *fi)
 	char fpath[PATH_MAX];
 	myfs_fullpath(fpath, path);
 
+	mirror_sync_path(path);
 	res = open(fpath, fi->flags);
 	if (res == -1)
 		return -errno;
@@ -522,36 +876,241 @@ static int myfs_open(const char *path, struct fuse_file_info *fi)
 
 static int myfs_release(const char *path, struct fuse_file_info *fi)
 {
-	(void)path;
+	/* queued writes still reference fh */
+	mirror_sync_path(path);
 	close((int)(unsigned long)fi->fh);
 	return 0;
 }
 
+/*
+ * --- operation wrappers ---
+ * Each traced operation is recorded with --trace=FILE. With replication on,
+ * mutating operations, and read (whose log sorts the path map), are
+ * serialized and the records they emit are committed as one batch; an
+ * unpromoted standby refuses to mutate its replicated state.
+ * Mutating operations, and read (whose log sorts the path map), also hold
+ * off a checkpoint cut while they run.
+ * Every callback is a span in the --profile=FILE trace.
+ */
+static int myfs_op_unlink(const char *path)
+{
+	int traced = trace_enabled();
+	uint64_t start = traced ? trace_now() : 0;
+	uint64_t prof = prof_begin();
+	int res;
+
+	if (repl_readonly())
+		return -EROFS;
+	ckpt_enter();
+	repl_begin();
+	res = myfs_unlink(path);
+	repl_commit();
+	ckpt_exit();
+	if (traced)
+		trace_op(TRACE_UNLINK, path, 0, 0, res, start);
+	prof_end("myfs_unlink", prof, -1);
+	return res;
+}
+
+static int myfs_op_create(const char *path, mode_t mode, struct fuse_file_info *fi)
+{
+	int traced = trace_enabled();
+	uint64_t start = traced ? trace_now() : 0;
+	uint64_t prof = prof_begin();
+	int res;
+
+	if (repl_readonly())
+		return -EROFS;
+	ckpt_enter();
+	repl_begin();
+	res = myfs_create(path, mode, fi);
+	repl_commit();
+	ckpt_exit();
+	if (traced)
+		trace_op(TRACE_CREATE, path, 0, 0, res, start);
+	prof_end("myfs_create", prof, -1);
+	return res;
+}
+
+static int myfs_op_read(const char *path, char *buf, size_t size, off_t offset,
+                        struct fuse_file_info *fi)
+{
+	int traced = trace_enabled();
+	uint64_t start = traced ? trace_now() : 0;
+	uint64_t prof = prof_begin();
+	int res;
+
+	ckpt_enter();
+	repl_begin();
+	res = myfs_read(path, buf, size, offset, fi);
+	repl_commit();
+	ckpt_exit();
+	if (traced)
+		trace_op(TRACE_READ, path, offset, size, res, start);
+	prof_end("myfs_read", prof, (int64_t)size);
+	return res;
+}
+
+static int myfs_op_write(const char *path, const char *buf, size_t size,
+                         off_t offset, struct fuse_file_info *fi)
+{
+	int traced = trace_enabled();
+	uint64_t start = traced ? trace_now() : 0;
+	uint64_t prof = prof_begin();
+	int res;
+
+	if (repl_readonly())
+		return -EROFS;
+	ckpt_enter();
+	repl_begin();
+	res = myfs_write(path, buf, size, offset, fi);
+	repl_commit();
+	ckpt_exit();
+	if (traced)
+		trace_op(TRACE_WRITE, path, offset, size, res, start);
+	prof_end("myfs_write", prof, (int64_t)size);
+	return res;
+}
+
+static int myfs_op_mkdir(const char *path, mode_t mode)
+{
+	int traced = trace_enabled();
+	uint64_t start = traced ? trace_now() : 0;
+	uint64_t prof = prof_begin();
+	int res;
+
+	if (repl_readonly())
+		return -EROFS;
+	ckpt_enter();
+	repl_begin();
+	res = myfs_mkdir(path, mode);
+	repl_commit();
+	ckpt_exit();
+	if (traced)
+		trace_op(TRACE_MKDIR, path, 0, 0, res, start);
+	prof_end("myfs_mkdir", prof, -1);
+	return res;
+}
+
+static int myfs_op_rmdir(const char *path)
+{
+	int traced = trace_enabled();
+	uint64_t start = traced ? trace_now() : 0;
+	uint64_t prof = prof_begin();
+	int res;
+
+	if (repl_readonly())
+		return -EROFS;
+	ckpt_enter();
+	repl_begin();
+	res = myfs_rmdir(path);
+	repl_commit();
+	ckpt_exit();
+	if (traced)
+		trace_op(TRACE_RMDIR, path, 0, 0, res, start);
+	prof_end("myfs_rmdir", prof, -1);
+	return res;
+}
+
+/* Callbacks below are only profiled */
+static int myfs_op_getattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi)
+{
+	uint64_t prof = prof_begin();
+	int res = myfs_getattr(path, stbuf, fi);
+	prof_end("myfs_getattr", prof, -1);
+	return res;
+}
+
+static int myfs_op_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
+                           off_t offset, struct fuse_file_info *fi,
+                           enum fuse_readdir_flags flags)
+{
+	uint64_t prof = prof_begin();
+	int res = myfs_readdir(path, buf, filler, offset, fi, flags);
+	prof_end("myfs_readdir", prof, -1);
+	return res;
+}
+
+static int myfs_op_open(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t prof = prof_begin();
+	int res = myfs_open(path, fi);
+	prof_end("myfs_open", prof, -1);
+	return res;
+}
+
+static int myfs_op_release(const char *path, struct fuse_file_info *fi)
+{
+	uint64_t prof = prof_begin();
+	int res = myfs_release(path, fi);
+	prof_end("myfs_release", prof, -1);
+	return res;
+}
+
 static const struct fuse_operations myfs_oper = {
-	.getattr  = myfs_getattr,
-	.mkdir    = myfs_mkdir,
-	.unlink   = myfs_unlink,
-	.rmdir    = myfs_rmdir,
-	.open     = myfs_open,
-	.read     = myfs_read,
-	.write    = myfs_write,
-	.release  = myfs_release,
-	.readdir  = myfs_readdir,
+	.getattr  = myfs_op_getattr,
+	.mkdir    = myfs_op_mkdir,
+	.unlink   = myfs_op_unlink,
+	.rmdir    = myfs_op_rmdir,
+	.open     = myfs_op_open,
+	.read     = myfs_op_read,
+	.write    = myfs_op_write,
+	.release  = myfs_op_release,
+	.readdir  = myfs_op_readdir,
 	.init     = myfs_init,
-	.create   = myfs_create,
+	.destroy  = myfs_destroy,
+	.create   = myfs_op_create,
 };
 
 void myfs_usage(void)
 {
-	fprintf(stderr, "usage:  myfs [FUSE and mount options] mount_point log_file root_dir num_inodes num_data_blocks data_block_size\n");
+	fprintf(stderr, "usage:  myfs [--trace=FILE] [--mirror=sync|uring] [--groups=N] [--replicate=ADDR|--standby=ADDR] [--checkpoint=FILE [--checkpoint-interval=SEC]] [--backing=FILE [--resident=N]] [--block-classes=SIZE,...] [--profile=FILE] [FUSE and mount options] mount_point log_file root_dir num_inodes num_data_blocks data_block_size\n");
 	abort();
 }
 
+/* Remove the first "name=value" argument from argv and return its value */
+static const char *myfs_take_opt(int *argc, char *argv[], const char *name)
+{
+	size_t len = strlen(name);
+	const char *val;
+	int i;
+
+	for (i = 1; i < *argc; i++) {
+		if (strncmp(argv[i], name, len) == 0 && argv[i][len] == '=') {
+			val = argv[i] + len + 1;
+			memmove(&argv[i], &argv[i + 1], (size_t)(*argc - i) * sizeof(char *));
+			(*argc)--;
+			return val;
+		}
+	}
+	return NULL;
+}
+
+/* Positive int argument; atoi would silently wrap or accept garbage */
+static int myfs_parse_count(const char *arg)
+{
+	char *end;
+	long long v;
+
+	errno = 0;
+	v = strtoll(arg, &end, 10);
+	if (errno != 0 || end == arg || *end != '\0' || v <= 0 || v > INT_MAX)
+		myfs_usage();
+	return (int)v;
+}
+
 int main(int argc, char *argv[])
 {
-	int fuse_stat;
+	int fuse_stat, num_inodes, num_data_blocks, data_block_size;
 	struct myfs_state *myfs_data;
 	FILE *logf;
+	const char *trace_path, *mirror_opt, *groups_opt, *interval_opt;
+	const char *backing_path, *resident_opt, *classes_opt, *profile_path;
+	const char *p;
+	char *end;
+	long class_size[ALLOC_MAX_CLASSES];
+	int runs[ALLOC_MAX_CLASSES], nruns = 0, i;
+	int groups = 1, resident = 1024;
 
 	if ((getuid() == 0) || (geteuid() == 0)) {
 		fprintf(stderr, "Running BBFS as root opens unnacceptable security holes\n");
@@ -560,24 +1119,119 @@ int main(int argc, char *argv[])
 
 	fprintf(stderr, "Fuse library version %d.%d\n", FUSE_MAJOR_VERSION, FUSE_MINOR_VERSION);
 
+	trace_path = myfs_take_opt(&argc, argv, "--trace");
+	profile_path = myfs_take_opt(&argc, argv, "--profile");
+	mirror_opt = myfs_take_opt(&argc, argv, "--mirror");
+	if (mirror_opt && strcmp(mirror_opt, "uring") == 0)
+		g_mirror_mode = MIRROR_URING;
+	else if (mirror_opt && strcmp(mirror_opt, "sync") != 0)
+		myfs_usage();
+	groups_opt = myfs_take_opt(&argc, argv, "--groups");
+	if (groups_opt)
+		groups = myfs_parse_count(groups_opt);
+	if ((g_repl_addr = myfs_take_opt(&argc, argv, "--replicate")) != NULL)
+		g_repl_mode = REPL_PRIMARY;
+	else if ((g_repl_addr = myfs_take_opt(&argc, argv, "--standby")) != NULL)
+		g_repl_mode = REPL_STANDBY;
+	g_ckpt_file = myfs_take_opt(&argc, argv, "--checkpoint");
+	interval_opt = myfs_take_opt(&argc, argv, "--checkpoint-interval");
+	if (interval_opt)
+		g_ckpt_interval = (unsigned)myfs_parse_count(interval_opt);
+	backing_path = myfs_take_opt(&argc, argv, "--backing");
+	resident_opt = myfs_take_opt(&argc, argv, "--resident");
+	if (resident_opt)
+		resident = myfs_parse_count(resident_opt);
+	classes_opt = myfs_take_opt(&argc, argv, "--block-classes");
+	for (p = classes_opt; p && nruns < ALLOC_MAX_CLASSES; p = *end == ',' ? end + 1 : NULL) {
+		class_size[nruns++] = strtol(p, &end, 10);
+		if (end == p || (*end != ',' && *end != '\0'))
+			myfs_usage();
+	}
+	if (p)
+		myfs_usage();
+
 	if ((argc < 6) || (argv[argc - 6][0] == '-') || (argv[argc - 5][0] == '-') || (argv[argc - 4][0] == '-'))
 		myfs_usage();
+	num_inodes = myfs_parse_count(argv[argc - 3]);
+	num_data_blocks = myfs_parse_count(argv[argc - 2]);
+	data_block_size = myfs_parse_count(argv[argc - 1]);
 
 	logf = log_open(argv[argc - 5]);
 	myfs_data = myfs_state_create(logf, argv[argc - 4],
-	                              atoi(argv[argc - 3]), atoi(argv[argc - 2]), atoi(argv[argc - 1]));
+	                              num_inodes, num_data_blocks, data_block_size);
 	if (!myfs_data) {
 		fclose(logf);
 		fprintf(stderr, "myfs_state_create failed\n");
 		return 1;
 	}
 
+	/* allocated here rather than in myfs_init, which cannot fail */
+	g_inode_logical_size = (off_t *)calloc((size_t)num_inodes, sizeof(off_t));
+	if (!g_inode_logical_size) {
+		myfs_state_destroy(myfs_data);
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	if (alloc_init(myfs_data, groups) != 0) {
+		free(g_inode_logical_size);
+		myfs_state_destroy(myfs_data);
+		fprintf(stderr, "alloc_init failed\n");
+		return 1;
+	}
+
+	/* class sizes are given in bytes; the allocator works in data blocks */
+	for (i = 0; i < nruns; i++)
+		runs[i] = class_size[i] % data_block_size == 0 ? (int)(class_size[i] / data_block_size) : 0;
+	if (nruns > 0 && alloc_set_classes(runs, nruns) != 0) {
+		alloc_destroy();
+		free(g_inode_logical_size);
+		myfs_state_destroy(myfs_data);
+		fprintf(stderr, "--block-classes must start at data_block_size and be ascending power-of-two multiples of it\n");
+		return 1;
+	}
+
+	if (tier_init(myfs_data, backing_path, resident, nruns > 1) != 0) {
+		alloc_destroy();
+		free(g_inode_logical_size);
+		myfs_state_destroy(myfs_data);
+		if (backing_path)
+			fprintf(stderr, "cannot open backing file %s\n", backing_path);
+		else
+			fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+
+	if (trace_path && trace_open(trace_path) != 0) {
+		tier_shutdown();
+		alloc_destroy();
+		free(g_inode_logical_size);
+		myfs_state_destroy(myfs_data);
+		fprintf(stderr, "cannot open trace file %s\n", trace_path);
+		return 1;
+	}
+
+	if (profile_path && prof_open(profile_path) != 0) {
+		trace_close();
+		tier_shutdown();
+		alloc_destroy();
+		free(g_inode_logical_size);
+		myfs_state_destroy(myfs_data);
+		fprintf(stderr, "cannot open profile %s\n", profile_path);
+		return 1;
+	}
+
 	argc -= 5;
 
 	fprintf(stderr, "about to call fuse_main\n");
 	fuse_stat = fuse_main(argc, argv, &myfs_oper, myfs_data);
 	fprintf(stderr, "fuse_main returned %d\n", fuse_stat);
 
+	prof_close();
+	trace_close();
+	tier_shutdown();
+	alloc_destroy();
+	free(g_inode_logical_size);
 	myfs_state_destroy(myfs_data);
 	return fuse_stat;
 }
@@ -0,0 +1,175 @@
+/*
+  Replays a trace recorded with `myfs --trace=FILE` against a mounted myfs.
+
+  usage:  myfs_replay [--paced] trace_file mount_point
+
+  By default operations are issued back to back; with --paced each one is
+  delayed until its recorded offset from the start of the trace. Write
+  payloads are not stored in the trace, so a deterministic byte pattern
+  derived from the file offset is written instead.
+*/
+
+#define _GNU_SOURCE
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+static char *io_buf;
+static size_t io_buf_size;
+
+static int ensure_buf(size_t size)
+{
+	char *p;
+
+	if (size <= io_buf_size)
+		return 0;
+	p = (char *)realloc(io_buf, size);
+	if (!p)
+		return -1;
+	io_buf = p;
+	io_buf_size = size;
+	return 0;
+}
+
+static void fill_pattern(char *buf, size_t size, uint64_t offset)
+{
+	size_t i;
+	for (i = 0; i < size; i++)
+		buf[i] = (char)('a' + (offset + i) % 26);
+}
+
+static void sleep_until(uint64_t deadline_ns)
+{
+	struct timespec ts;
+	uint64_t now = trace_now();
+
+	if (now >= deadline_ns)
+		return;
+	ts.tv_sec = (time_t)((deadline_ns - now) / 1000000000ull);
+	ts.tv_nsec = (long)((deadline_ns - now) % 1000000000ull);
+	nanosleep(&ts, NULL);
+}
+
+static int replay_one(const struct trace_rec *rec, const char *fpath)
+{
+	int fd, res = 0;
+
+	switch (rec->op) {
+	case TRACE_CREATE:
+		fd = open(fpath, O_CREAT | O_WRONLY, 0644);
+		if (fd == -1)
+			return -errno;
+		close(fd);
+		break;
+	case TRACE_READ:
+		if (ensure_buf(rec->size) == -1)
+			return -ENOMEM;
+		fd = open(fpath, O_RDONLY);
+		if (fd == -1)
+			return -errno;
+		if (pread(fd, io_buf, rec->size, (off_t)rec->offset) == -1)
+			res = -errno;
+		close(fd);
+		break;
+	case TRACE_WRITE:
+		if (ensure_buf(rec->size) == -1)
+			return -ENOMEM;
+		fill_pattern(io_buf, rec->size, rec->offset);
+		fd = open(fpath, O_WRONLY);
+		if (fd == -1)
+			return -errno;
+		if (pwrite(fd, io_buf, rec->size, (off_t)rec->offset) == -1)
+			res = -errno;
+		close(fd);
+		break;
+	case TRACE_UNLINK:
+		if (unlink(fpath) == -1)
+			return -errno;
+		break;
+	case TRACE_MKDIR:
+		if (mkdir(fpath, 0755) == -1)
+			return -errno;
+		break;
+	case TRACE_RMDIR:
+		if (rmdir(fpath) == -1)
+			return -errno;
+		break;
+	default:
+		return -EINVAL;
+	}
+	return res;
+}
+
+static void replay_usage(void)
+{
+	fprintf(stderr, "usage:  myfs_replay [--paced] trace_file mount_point\n");
+	exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[])
+{
+	FILE *f;
+	struct trace_rec rec;
+	char path[PATH_MAX];
+	char fpath[PATH_MAX];
+	int paced = 0, argi = 1, res;
+	unsigned long ops = 0, mismatched = 0;
+	uint64_t start, elapsed;
+
+	if (argc > 1 && strcmp(argv[1], "--paced") == 0) {
+		paced = 1;
+		argi++;
+	}
+	if (argc - argi != 2)
+		replay_usage();
+
+	f = fopen(argv[argi], "rb");
+	if (!f) {
+		perror("trace");
+		return 1;
+	}
+	if (trace_read_header(f) != 0) {
+		fprintf(stderr, "%s: not a myfs trace\n", argv[argi]);
+		fclose(f);
+		return 1;
+	}
+
+	start = trace_now();
+	while ((res = trace_read_rec(f, &rec, path)) == 1) {
+		snprintf(fpath, sizeof(fpath), "%s%s", argv[argi + 1], path);
+		if (paced)
+			sleep_until(start + rec.ts_ns);
+		/* A replayed op failing where the original succeeded (or vice
+		   versa) means the replay diverged from the recorded run */
+		if ((replay_one(&rec, fpath) < 0) != (rec.result < 0))
+			mismatched++;
+		ops++;
+	}
+	elapsed = trace_now() - start;
+	fclose(f);
+	free(io_buf);
+
+	if (res == -1) {
+		fprintf(stderr, "truncated or malformed trace after %lu ops\n", ops);
+		return 1;
+	}
+
+	printf("ops: %lu\n", ops);
+	printf("mismatched: %lu\n", mismatched);
+	printf("elapsed: %.3f ms\n", (double)elapsed / 1e6);
+	if (elapsed > 0)
+		printf("throughput: %.0f ops/s\n", (double)ops * 1e9 / (double)elapsed);
+	return mismatched ? 2 : 0;
+}
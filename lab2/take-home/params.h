@@ -72,6 +72,10 @@ void path_to_inode_remove(struct myfs_state *s, const char *path);
 /* Lookup inode index for path; returns -1 if not found */
 int path_to_inode_lookup(struct myfs_state *s, const char *path);
 
+/* Make room for n entries in inode->blocks; returns -1 if out of memory.
+   n == 0 shrinks the list back to its initial size. */
+int inode_reserve_blocks(struct inode *inode, int n);
+
 #define MYFS_DATA ((struct myfs_state *) fuse_get_context()->private_data)
 
 #endif
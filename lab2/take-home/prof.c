@@ -0,0 +1,173 @@
+#define _GNU_SOURCE
+
+#include "prof.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+
+#define PROF_CHUNK 4096
+/* per thread; later spans are counted but not kept */
+#define PROF_MAX_EVENTS (1 << 20)
+
+struct prof_event {
+	const char *name;
+	uint64_t ts, dur;
+	int64_t bytes;
+};
+
+struct prof_chunk {
+	struct prof_chunk *next;
+	int n;
+	struct prof_event ev[PROF_CHUNK];
+};
+
+struct prof_thread {
+	struct prof_thread *next;
+	long tid;
+	struct prof_chunk *head, *tail;
+	uint64_t events, dropped;
+};
+
+static int enabled;
+static char *prof_file;
+static uint64_t epoch;
+static struct prof_thread *threads;
+static pthread_mutex_t threads_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct prof_thread *self;
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int prof_open(const char *file)
+{
+	FILE *f;
+
+	/* fail at mount rather than losing the profile at unmount */
+	f = fopen(file, "w");
+	if (!f) {
+		perror("profile");
+		return -1;
+	}
+	fclose(f);
+	prof_file = strdup(file);
+	if (!prof_file)
+		return -1;
+	epoch = now_ns();
+	enabled = 1;
+	return 0;
+}
+
+uint64_t prof_begin(void)
+{
+	return enabled ? now_ns() : 0;
+}
+
+static struct prof_thread *thread_buf(void)
+{
+	struct prof_thread *t = (struct prof_thread *)calloc(1, sizeof(*t));
+
+	if (!t)
+		return NULL;
+	t->tid = (long)syscall(SYS_gettid);
+	pthread_mutex_lock(&threads_lock);
+	t->next = threads;
+	threads = t;
+	pthread_mutex_unlock(&threads_lock);
+	return t;
+}
+
+void prof_end(const char *name, uint64_t start, int64_t bytes)
+{
+	struct prof_thread *t = self;
+	struct prof_chunk *c;
+	struct prof_event *e;
+	uint64_t end;
+
+	if (!start)
+		return;
+	end = now_ns();
+	if (!t && !(t = self = thread_buf()))
+		return;
+	if (t->events >= PROF_MAX_EVENTS) {
+		t->dropped++;
+		return;
+	}
+	c = t->tail;
+	if (!c || c->n == PROF_CHUNK) {
+		c = (struct prof_chunk *)malloc(sizeof(*c));
+		if (!c) {
+			t->dropped++;
+			return;
+		}
+		c->next = NULL;
+		c->n = 0;
+		if (t->tail)
+			t->tail->next = c;
+		else
+			t->head = c;
+		t->tail = c;
+	}
+	e = &c->ev[c->n++];
+	e->name = name;
+	e->ts = start - epoch;
+	e->dur = end - start;
+	e->bytes = bytes;
+	t->events++;
+}
+
+void prof_close(void)
+{
+	struct prof_thread *t, *tn;
+	struct prof_chunk *c, *cn;
+	struct prof_event *e;
+	FILE *f;
+	int i, first = 1;
+
+	if (!enabled)
+		return;
+	enabled = 0;
+	f = fopen(prof_file, "w");
+	if (!f)
+		perror("profile");
+	if (f)
+		fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+	for (t = threads; t; t = tn) {
+		tn = t->next;
+		if (f) {
+			fprintf(f, "%s\n{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%ld,"
+			        "\"args\":{\"name\":\"myfs %ld\",\"dropped\":%llu}}",
+			        first ? "" : ",", (int)getpid(), t->tid, t->tid,
+			        (unsigned long long)t->dropped);
+			first = 0;
+		}
+		for (c = t->head; c; c = cn) {
+			cn = c->next;
+			for (i = 0; f && i < c->n; i++) {
+				e = &c->ev[i];
+				fprintf(f, ",\n{\"ph\":\"X\",\"name\":\"%s\",\"pid\":%d,\"tid\":%ld,"
+				        "\"ts\":%.3f,\"dur\":%.3f",
+				        e->name, (int)getpid(), t->tid, e->ts / 1000.0, e->dur / 1000.0);
+				if (e->bytes >= 0)
+					fprintf(f, ",\"args\":{\"bytes\":%lld}", (long long)e->bytes);
+				fputc('}', f);
+			}
+			free(c);
+		}
+		free(t);
+	}
+	threads = NULL;
+	if (f) {
+		fprintf(f, "\n]}\n");
+		fclose(f);
+	}
+	free(prof_file);
+	prof_file = NULL;
+}
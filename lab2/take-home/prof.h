@@ -0,0 +1,33 @@
+#ifndef _PROF_H_
+#define _PROF_H_
+
+#include <stdint.h>
+
+/*
+ * Per-operation profiling (--profile=FILE).
+ *
+ * Each FUSE callback and the phases inside it (path lookup, allocation,
+ * block copy, mirror syscalls, log_fuse_context) are recorded as spans.
+ * Spans go into a buffer owned by the recording thread, so recording takes
+ * no lock; at unmount all buffers are written to FILE as Chrome trace-event
+ * JSON ("X" events, microseconds), which chrome://tracing and Perfetto load.
+ *
+ * Usage:
+ *     uint64_t t = prof_begin();
+ *     ...
+ *     prof_end("myfs_write", t, size);
+ * prof_begin returns 0 when profiling is off and prof_end ignores 0, so a
+ * disabled span costs one load and a branch.
+ */
+
+int prof_open(const char *file);
+
+/* Write every thread's spans to the file and free the buffers */
+void prof_close(void);
+
+uint64_t prof_begin(void);
+
+/* name must be a string literal; bytes < 0 means no byte count */
+void prof_end(const char *name, uint64_t start, int64_t bytes);
+
+#endif
@@ -0,0 +1,848 @@
+#include "repl.h"
+#include "alloc.h"
+#include "ckpt.h"
+#include "mirror.h"
+#include "tier.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/time.h>
+
+#define REPL_MAGIC 0x4d595250u /* "MYRP" */
+#define REPL_BYE   0x4d594259u /* "MYBY": the primary is shutting down */
+
+enum repl_rec_type {
+	REC_CONFIG = 1,  /* a=NUM_INODES b=NUM_DATA_BLOCKS, payload: int32 DATA_BLOCK_SIZE */
+	REC_INODE_BITMAP,
+	REC_BLOCK_BITMAP,
+	REC_INODE_BLOCKS, /* a=ino b=start, payload: int32 blocks; num_blocks = start + count */
+	REC_BLOCK_DATA,   /* a=block b=offset in block, payload: bytes */
+	REC_SIZE,
+	REC_PATH_ADD,     /* a=ino, payload: path */
+	REC_PATH_REMOVE,
+	REC_MKDIR,
+	REC_RMDIR,
+};
+
+struct repl_frame {
+	uint32_t magic;
+	uint32_t nrec;
+	uint64_t seq;
+	uint64_t len;
+};
+
+struct repl_rec {
+	uint8_t type;
+	uint8_t pad[3];
+	int32_t a;
+	int64_t b;
+	uint32_t len;
+	uint32_t pad2;
+};
+
+struct repl_batch {
+	uint64_t seq;
+	uint32_t nrec;
+	int failed;     /* a record could not be stored */
+	char *data;
+	size_t len, cap;
+	struct repl_batch *next;
+};
+
+static enum repl_mode mode = REPL_OFF;
+static struct myfs_state *st;
+static off_t *lsize;
+static char *repl_addr;
+
+/* Held for the whole of each mutating FUSE operation, snapshot and applied
+   batch, and on a standby for read-only operations too */
+static pthread_mutex_t op_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct repl_batch cur;
+/* A batch was lost; the next commit sends the full state instead (op_lock) */
+static int resync;
+
+/* Send queue and connection state */
+static pthread_mutex_t q_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ack_cond = PTHREAD_COND_INITIALIZER;
+static struct repl_batch *q_head, *q_tail;
+static uint64_t next_seq, acked_seq;
+static int connected, stopping, readonly;
+static int wake_pipe[2] = { -1, -1 };
+static pthread_t repl_thread;
+
+/* --- addresses --- */
+static int repl_socket(const char *addr, int listening)
+{
+	struct sockaddr_un un;
+	struct addrinfo hints, *res, *ai;
+	char host[256], *port;
+	int fd = -1, one = 1;
+
+	if (strncmp(addr, "unix:", 5) == 0) {
+		memset(&un, 0, sizeof(un));
+		un.sun_family = AF_UNIX;
+		strncpy(un.sun_path, addr + 5, sizeof(un.sun_path) - 1);
+		fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd == -1)
+			return -1;
+		if (listening) {
+			unlink(un.sun_path);
+			if (bind(fd, (struct sockaddr *)&un, sizeof(un)) == 0 && listen(fd, 1) == 0)
+				return fd;
+		} else if (connect(fd, (struct sockaddr *)&un, sizeof(un)) == 0) {
+			return fd;
+		}
+		close(fd);
+		return -1;
+	}
+
+	if (strncmp(addr, "tcp:", 4) != 0)
+		return -1;
+	strncpy(host, addr + 4, sizeof(host) - 1);
+	host[sizeof(host) - 1] = '\0';
+	port = strrchr(host, ':');
+	if (!port)
+		return -1;
+	*port++ = '\0';
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	hints.ai_flags = listening ? AI_PASSIVE : 0;
+	if (getaddrinfo(host[0] ? host : NULL, port, &hints, &res) != 0)
+		return -1;
+	for (ai = res; ai; ai = ai->ai_next) {
+		fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+		if (fd == -1)
+			continue;
+		if (listening) {
+			setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+			if (bind(fd, ai->ai_addr, ai->ai_addrlen) == 0 && listen(fd, 1) == 0)
+				break;
+		} else if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+			break;
+		}
+		close(fd);
+		fd = -1;
+	}
+	freeaddrinfo(res);
+	return fd;
+}
+
+static int write_full(int fd, const void *buf, size_t len)
+{
+	const char *p = (const char *)buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = send(fd, p, len, MSG_NOSIGNAL);
+		if (n == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+static int read_full(int fd, void *buf, size_t len)
+{
+	char *p = (char *)buf;
+	ssize_t n;
+
+	while (len > 0) {
+		n = read(fd, p, len);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		p += n;
+		len -= (size_t)n;
+	}
+	return 0;
+}
+
+/* --- record encoding (primary) --- */
+static int batch_reserve(struct repl_batch *b, size_t more)
+{
+	size_t cap = b->cap ? b->cap : 4096;
+	char *p;
+
+	if (b->len + more <= b->cap)
+		return 0;
+	while (cap < b->len + more)
+		cap *= 2;
+	p = (char *)realloc(b->data, cap);
+	if (!p)
+		return -1;
+	b->data = p;
+	b->cap = cap;
+	return 0;
+}
+
+static void batch_add(struct repl_batch *b, int type, int32_t a, int64_t v,
+                      const void *payload, uint32_t len)
+{
+	struct repl_rec rec;
+
+	if (b->failed)
+		return;
+	if (batch_reserve(b, sizeof(rec) + len) != 0) {
+		b->failed = 1;
+		return;
+	}
+	memset(&rec, 0, sizeof(rec));
+	rec.type = (uint8_t)type;
+	rec.a = a;
+	rec.b = v;
+	rec.len = len;
+	memcpy(b->data + b->len, &rec, sizeof(rec));
+	if (len)
+		memcpy(b->data + b->len + sizeof(rec), payload, len);
+	b->len += sizeof(rec) + len;
+	b->nrec++;
+}
+
+static int recording(void)
+{
+	return mode == REPL_PRIMARY && __atomic_load_n(&connected, __ATOMIC_ACQUIRE);
+}
+
+void repl_inode_bitmap(int ino, int val)
+{
+	if (recording())
+		batch_add(&cur, REC_INODE_BITMAP, ino, val, NULL, 0);
+}
+
+void repl_block_bitmap(int block, int val)
+{
+	if (recording())
+		batch_add(&cur, REC_BLOCK_BITMAP, block, val, NULL, 0);
+}
+
+void repl_inode_blocks(int ino, int start, int count, const int *blocks)
+{
+	if (recording())
+		batch_add(&cur, REC_INODE_BLOCKS, ino, start, blocks,
+		          (uint32_t)count * (uint32_t)sizeof(int32_t));
+}
+
+void repl_block_data(int block, int offset, const char *data, int len)
+{
+	if (recording())
+		batch_add(&cur, REC_BLOCK_DATA, block, offset, data, (uint32_t)len);
+}
+
+void repl_size(int ino, off_t size)
+{
+	if (recording())
+		batch_add(&cur, REC_SIZE, ino, (int64_t)size, NULL, 0);
+}
+
+void repl_path_add(const char *path, int ino)
+{
+	if (recording())
+		batch_add(&cur, REC_PATH_ADD, ino, 0, path, (uint32_t)strlen(path));
+}
+
+void repl_path_remove(const char *path)
+{
+	if (recording())
+		batch_add(&cur, REC_PATH_REMOVE, 0, 0, path, (uint32_t)strlen(path));
+}
+
+void repl_mkdir(const char *path)
+{
+	if (recording())
+		batch_add(&cur, REC_MKDIR, 0, 0, path, (uint32_t)strlen(path));
+}
+
+void repl_rmdir(const char *path)
+{
+	if (recording())
+		batch_add(&cur, REC_RMDIR, 0, 0, path, (uint32_t)strlen(path));
+}
+
+static int snapshot_dir(const char *path, void *arg)
+{
+	batch_add((struct repl_batch *)arg, REC_MKDIR, 0, 0, path, (uint32_t)strlen(path));
+	return 0;
+}
+
+/* Full state as one batch; caller holds op_lock. b->failed is set if it is
+   incomplete. */
+static void snapshot(struct repl_batch *b)
+{
+	int32_t bs = st->DATA_BLOCK_SIZE;
+	struct inode *ino;
+	char *data = (char *)malloc((size_t)bs);
+	int i, j, blk;
+
+	batch_add(b, REC_CONFIG, st->NUM_INODES, st->NUM_DATA_BLOCKS, &bs, sizeof(bs));
+	for (i = 0; i < st->NUM_INODES; i++) {
+		if (!st->inode_bitmap[i])
+			continue;
+		ino = st->inodes[i];
+		/* blocks owned by files only: local reservations are not replicated */
+		for (j = 0; j < ino->num_blocks; j++) {
+			blk = ino->blocks[j];
+			batch_add(b, REC_BLOCK_BITMAP, blk, 1, NULL, 0);
+			/* copied out so that cold blocks stay in the backing file */
+			if (!data || tier_read(blk, data) != 0)
+				b->failed = 1;
+			else
+				batch_add(b, REC_BLOCK_DATA, blk, 0, data, (uint32_t)bs);
+		}
+		batch_add(b, REC_INODE_BITMAP, i, 1, NULL, 0);
+		batch_add(b, REC_INODE_BLOCKS, i, 0, ino->blocks,
+		          (uint32_t)ino->num_blocks * (uint32_t)sizeof(int32_t));
+		batch_add(b, REC_SIZE, i, (int64_t)lsize[i], NULL, 0);
+	}
+	free(data);
+	/* the mirror files of nested paths need their directories first */
+	if (mirror_walk_dirs(st->rootdir, snapshot_dir, b) != 0)
+		b->failed = 1;
+	for (i = 0; i < st->path_count; i++)
+		batch_add(b, REC_PATH_ADD, st->path_to_inode[i].inode, 0, st->path_to_inode[i].path,
+		          (uint32_t)strlen(st->path_to_inode[i].path));
+}
+
+static void wake(void)
+{
+	char c = 0;
+	if (write(wake_pipe[1], &c, 1) == -1 && errno != EAGAIN)
+		perror("repl wake");
+}
+
+/* Caller holds q_lock; returns -1 (keeping b) if it could not be queued */
+static int enqueue(struct repl_batch *b)
+{
+	struct repl_batch *copy = (struct repl_batch *)malloc(sizeof(*copy));
+
+	if (!copy)
+		return -1;
+	*copy = *b;
+	copy->seq = ++next_seq;
+	copy->next = NULL;
+	if (q_tail)
+		q_tail->next = copy;
+	else
+		q_head = copy;
+	q_tail = copy;
+	memset(b, 0, sizeof(*b));
+	wake();
+	return 0;
+}
+
+/* Caller holds q_lock */
+static void drop_queue(void)
+{
+	struct repl_batch *b, *next;
+
+	for (b = q_head; b; b = next) {
+		next = b->next;
+		free(b->data);
+		free(b);
+	}
+	q_head = q_tail = NULL;
+}
+
+void repl_begin(void)
+{
+	if (mode != REPL_OFF)
+		pthread_mutex_lock(&op_lock);
+}
+
+void repl_commit(void)
+{
+	if (mode == REPL_OFF)
+		return;
+	if (mode == REPL_PRIMARY && (cur.nrec > 0 || cur.failed || resync)) {
+		if (cur.failed || resync) {
+			/* the standby would miss records: send the whole state, which
+			   it applies in place of its own */
+			cur.len = 0;
+			cur.nrec = 0;
+			cur.failed = 0;
+			if (recording())
+				snapshot(&cur);
+			resync = cur.failed;
+		}
+		pthread_mutex_lock(&q_lock);
+		if (connected && !cur.failed) {
+			if (enqueue(&cur) != 0)
+				resync = 1;
+			/* pipelined, but never more than REPL_WINDOW batches ahead */
+			while (connected && next_seq - acked_seq > REPL_WINDOW)
+				pthread_cond_wait(&ack_cond, &q_lock);
+		}
+		pthread_mutex_unlock(&q_lock);
+		cur.len = 0;
+		cur.nrec = 0;
+		cur.failed = 0;
+	}
+	pthread_mutex_unlock(&op_lock);
+}
+
+void repl_begin_read(void)
+{
+	if (mode == REPL_STANDBY)
+		pthread_mutex_lock(&op_lock);
+}
+
+void repl_end_read(void)
+{
+	if (mode == REPL_STANDBY)
+		pthread_mutex_unlock(&op_lock);
+}
+
+int repl_readonly(void)
+{
+	return __atomic_load_n(&readonly, __ATOMIC_ACQUIRE);
+}
+
+/* --- primary: sender/ack thread --- */
+static void disconnect(int *fd)
+{
+	close(*fd);
+	*fd = -1;
+	pthread_mutex_lock(&q_lock);
+	__atomic_store_n(&connected, 0, __ATOMIC_RELEASE);
+	drop_queue();
+	acked_seq = next_seq;
+	pthread_cond_broadcast(&ack_cond);
+	pthread_mutex_unlock(&q_lock);
+	fprintf(stderr, "repl: lost standby %s\n", repl_addr);
+}
+
+static void *primary_main(void *arg)
+{
+	struct pollfd pfd[2];
+	struct repl_batch *b, snap;
+	struct repl_frame fr;
+	uint64_t acks[64];
+	ssize_t n;
+	int fd = -1, i, pending;
+	(void)arg;
+
+	for (;;) {
+		pthread_mutex_lock(&q_lock);
+		pending = q_head != NULL;
+		if (stopping && (!pending || fd == -1)) {
+			pthread_mutex_unlock(&q_lock);
+			break;
+		}
+		pthread_mutex_unlock(&q_lock);
+
+		if (fd == -1) {
+			fd = repl_socket(repl_addr, 0);
+			if (fd == -1) {
+				poll(NULL, 0, 1000);
+				continue;
+			}
+			/* consistent cut: no operation runs while the snapshot is taken */
+			memset(&snap, 0, sizeof(snap));
+			pthread_mutex_lock(&op_lock);
+			snapshot(&snap);
+			pthread_mutex_lock(&q_lock);
+			drop_queue();
+			acked_seq = next_seq;
+			if (snap.failed || enqueue(&snap) != 0) {
+				/* try again later rather than start from a partial state */
+				pthread_mutex_unlock(&q_lock);
+				pthread_mutex_unlock(&op_lock);
+				free(snap.data);
+				close(fd);
+				fd = -1;
+				poll(NULL, 0, 1000);
+				continue;
+			}
+			resync = 0;
+			__atomic_store_n(&connected, 1, __ATOMIC_RELEASE);
+			pthread_mutex_unlock(&q_lock);
+			pthread_mutex_unlock(&op_lock);
+			fprintf(stderr, "repl: streaming to standby %s\n", repl_addr);
+			pending = 1;
+		}
+
+		pfd[0].fd = fd;
+		pfd[0].events = POLLIN | (pending ? POLLOUT : 0);
+		pfd[1].fd = wake_pipe[0];
+		pfd[1].events = POLLIN;
+		n = poll(pfd, 2, 1000);
+		if (n == -1)
+			continue;
+		if (n == 0) {
+			/* idle: an empty frame tells the standby we are still here */
+			memset(&fr, 0, sizeof(fr));
+			fr.magic = REPL_MAGIC;
+			if (write_full(fd, &fr, sizeof(fr)) != 0)
+				disconnect(&fd);
+			continue;
+		}
+
+		if (pfd[1].revents & POLLIN)
+			while (read(wake_pipe[0], acks, sizeof(acks)) > 0)
+				;
+
+		if (pfd[0].revents & (POLLIN | POLLERR | POLLHUP)) {
+			n = read(fd, acks, sizeof(acks));
+			if (n <= 0) {
+				disconnect(&fd);
+				continue;
+			}
+			/* acks are 8-byte sequence numbers; only the newest matters */
+			pthread_mutex_lock(&q_lock);
+			for (i = 0; i < (int)(n / (ssize_t)sizeof(uint64_t)); i++)
+				if (acks[i] > acked_seq)
+					acked_seq = acks[i];
+			pthread_cond_broadcast(&ack_cond);
+			pthread_mutex_unlock(&q_lock);
+		}
+
+		if (pfd[0].revents & POLLOUT) {
+			pthread_mutex_lock(&q_lock);
+			b = q_head;
+			if (b) {
+				q_head = b->next;
+				if (!q_head)
+					q_tail = NULL;
+			}
+			pthread_mutex_unlock(&q_lock);
+			if (!b)
+				continue;
+			fr.magic = REPL_MAGIC;
+			fr.nrec = b->nrec;
+			fr.seq = b->seq;
+			fr.len = b->len;
+			i = write_full(fd, &fr, sizeof(fr)) == 0 && write_full(fd, b->data, b->len) == 0;
+			free(b->data);
+			free(b);
+			if (!i)
+				disconnect(&fd);
+		}
+	}
+	if (fd != -1) {
+		/* a clean shutdown, not a lost connection: the standby takes over */
+		memset(&fr, 0, sizeof(fr));
+		fr.magic = REPL_BYE;
+		write_full(fd, &fr, sizeof(fr));
+		close(fd);
+	}
+	return NULL;
+}
+
+/* --- standby: apply batches --- */
+static void mirror_path(char fpath[PATH_MAX], const char *path)
+{
+	snprintf(fpath, PATH_MAX, "%s%s", st->rootdir, path);
+}
+
+static void free_blocks_of(int ino)
+{
+	struct inode *inode = st->inodes[ino];
+	int j;
+
+	for (j = 0; j < inode->num_blocks; j++) {
+		tier_discard(inode->blocks[j]);
+		alloc_free_block(inode->blocks[j]);
+	}
+	inode->num_blocks = 0;
+}
+
+/* Drop all state before a snapshot is applied */
+static void reset_state(void)
+{
+	char fpath[PATH_MAX];
+	int i;
+
+	for (i = 0; i < st->path_count; i++) {
+		mirror_path(fpath, st->path_to_inode[i].path);
+		unlink(fpath);
+	}
+	st->path_count = 0;
+	for (i = 0; i < st->NUM_INODES; i++) {
+		free_blocks_of(i);
+		alloc_free_inode(i);
+		lsize[i] = 0;
+	}
+	for (i = 0; i < st->NUM_DATA_BLOCKS; i++) {
+		tier_discard(i);
+		alloc_free_block(i);
+	}
+}
+
+static int apply_rec(const struct repl_rec *rec, const char *payload)
+{
+	char path[PATH_MAX], fpath[PATH_MAX], *data;
+	int fd, count;
+
+	switch (rec->type) {
+	case REC_PATH_ADD:
+	case REC_PATH_REMOVE:
+	case REC_MKDIR:
+	case REC_RMDIR:
+		if (rec->len >= PATH_MAX)
+			return -1;
+		memcpy(path, payload, rec->len);
+		path[rec->len] = '\0';
+		mirror_path(fpath, path);
+		break;
+	}
+
+	switch (rec->type) {
+	case REC_CONFIG:
+		if (rec->a != st->NUM_INODES || rec->b != st->NUM_DATA_BLOCKS ||
+		    rec->len != sizeof(int32_t) || *(const int32_t *)payload != st->DATA_BLOCK_SIZE) {
+			fprintf(stderr, "repl: primary geometry does not match this standby\n");
+			return -1;
+		}
+		reset_state();
+		ckpt_dirty_all();
+		return 0;
+	case REC_INODE_BITMAP:
+		if (rec->a < 0 || rec->a >= st->NUM_INODES)
+			return -1;
+		if (rec->b)
+			alloc_mark_inode(rec->a);
+		else
+			alloc_free_inode(rec->a);
+		ckpt_dirty_inode(rec->a);
+		return 0;
+	case REC_BLOCK_BITMAP:
+		if (rec->a < 0 || rec->a >= st->NUM_DATA_BLOCKS)
+			return -1;
+		if (rec->b) {
+			alloc_mark_block(rec->a);
+		} else {
+			tier_discard(rec->a);
+			alloc_free_block(rec->a);
+		}
+		ckpt_dirty_block(rec->a);
+		return 0;
+	case REC_INODE_BLOCKS:
+		count = (int)(rec->len / sizeof(int32_t));
+		if (rec->a < 0 || rec->a >= st->NUM_INODES || rec->b < 0 ||
+		    rec->b + count > st->NUM_DATA_BLOCKS ||
+		    inode_reserve_blocks(st->inodes[rec->a], (int)rec->b + count) != 0)
+			return -1;
+		memcpy(st->inodes[rec->a]->blocks + rec->b, payload, rec->len);
+		st->inodes[rec->a]->num_blocks = (int)rec->b + count;
+		ckpt_dirty_inode(rec->a);
+		return 0;
+	case REC_BLOCK_DATA:
+		if (rec->a < 0 || rec->a >= st->NUM_DATA_BLOCKS || rec->b < 0 ||
+		    rec->b + (int64_t)rec->len > st->DATA_BLOCK_SIZE)
+			return -1;
+		data = tier_get(rec->a, 1);
+		if (!data)
+			return -1;
+		memcpy(data + rec->b, payload, rec->len);
+		tier_put(rec->a);
+		ckpt_dirty_block(rec->a);
+		return 0;
+	case REC_SIZE:
+		if (rec->a < 0 || rec->a >= st->NUM_INODES)
+			return -1;
+		lsize[rec->a] = (off_t)rec->b;
+		ckpt_dirty_inode(rec->a);
+		return 0;
+	case REC_PATH_ADD:
+		if (rec->a < 0 || rec->a >= st->NUM_INODES)
+			return -1;
+		path_to_inode_add(st, path, rec->a);
+		ckpt_dirty_paths();
+		/* the mirror only has to exist; contents are served from memory */
+		fd = open(fpath, O_CREAT | O_WRONLY, 0644);
+		if (fd != -1)
+			close(fd);
+		return 0;
+	case REC_PATH_REMOVE:
+		path_to_inode_remove(st, path);
+		ckpt_dirty_paths();
+		unlink(fpath);
+		return 0;
+	case REC_MKDIR:
+		/* a snapshot repeats directories this mirror may already have */
+		if (mkdir(fpath, 0755) == 0)
+			alloc_mkdir(path);
+		ckpt_dirty_paths();
+		return 0;
+	case REC_RMDIR:
+		rmdir(fpath);
+		alloc_rmdir(path);
+		ckpt_dirty_paths();
+		return 0;
+	}
+	return -1;
+}
+
+static int apply_batch(const char *data, size_t len, uint32_t nrec)
+{
+	struct repl_rec rec;
+	size_t pos = 0;
+	uint32_t i;
+	int res = 0;
+
+	ckpt_enter();
+	pthread_mutex_lock(&op_lock);
+	for (i = 0; i < nrec && res == 0; i++) {
+		if (pos + sizeof(rec) > len) {
+			res = -1;
+			break;
+		}
+		memcpy(&rec, data + pos, sizeof(rec));
+		pos += sizeof(rec);
+		if (pos + rec.len > len) {
+			res = -1;
+			break;
+		}
+		res = apply_rec(&rec, data + pos);
+		pos += rec.len;
+	}
+	pthread_mutex_unlock(&op_lock);
+	ckpt_exit();
+	return res;
+}
+
+static void *standby_main(void *arg)
+{
+	struct repl_frame fr;
+	struct repl_rec first;
+	struct pollfd pfd[2];
+	struct timeval tv = { REPL_TIMEOUT_SEC, 0 };
+	char *buf = NULL;
+	size_t cap = 0;
+	int lfd = (int)(intptr_t)arg, fd, n, synced = 0, bye = 0;
+
+	/* synced: the state is a snapshot plus whole batches applied after it,
+	   i.e. a consistent cut of the primary's; only then may we take over */
+	for (;;) {
+		pfd[0].fd = lfd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = wake_pipe[0];
+		pfd[1].events = POLLIN;
+		n = poll(pfd, 2, synced ? REPL_TIMEOUT_SEC * 1000 : -1);
+		if (n == -1)
+			continue;
+		if (n == 0 || (pfd[1].revents & POLLIN))
+			break;
+		fd = accept(lfd, NULL, NULL);
+		if (fd == -1)
+			continue;
+		setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+		fprintf(stderr, "repl: primary connected\n");
+
+		while (!__atomic_load_n(&stopping, __ATOMIC_RELAXED) &&
+		       read_full(fd, &fr, sizeof(fr)) == 0) {
+			if (fr.magic == REPL_BYE) {
+				bye = 1;
+				break;
+			}
+			if (fr.magic != REPL_MAGIC)
+				break;
+			if (fr.nrec == 0)
+				continue;   /* heartbeat */
+			if (fr.len > cap) {
+				free(buf);
+				cap = fr.len;
+				buf = (char *)malloc(cap);
+				if (!buf) {
+					cap = 0;
+					break;
+				}
+			}
+			/* a torn frame was never applied: the state is still whole */
+			if (read_full(fd, buf, fr.len) != 0)
+				break;
+			if (apply_batch(buf, fr.len, fr.nrec) != 0) {
+				/* partly applied; wait for the snapshot of the next connection */
+				synced = 0;
+				break;
+			}
+			memcpy(&first, buf, sizeof(first));
+			if (first.type == REC_CONFIG)
+				synced = 1;
+			if (write_full(fd, &fr.seq, sizeof(fr.seq)) != 0)
+				break;
+		}
+		close(fd);
+		if (bye && synced)
+			break;
+		bye = 0;
+		/* the primary may be back within REPL_TIMEOUT_SEC after a transient error */
+		fprintf(stderr, "repl: primary disconnected\n");
+	}
+	close(lfd);
+	free(buf);
+
+	/* The primary said goodbye or stayed away after giving us its state */
+	if (synced && !__atomic_load_n(&stopping, __ATOMIC_RELAXED)) {
+		__atomic_store_n(&readonly, 0, __ATOMIC_RELEASE);
+		fprintf(stderr, "repl: primary lost, standby promoted\n");
+	}
+	return NULL;
+}
+
+int repl_start(enum repl_mode m, const char *addr, struct myfs_state *s, off_t *logical_size)
+{
+	int lfd = -1;
+
+	if (m == REPL_OFF)
+		return 0;
+	st = s;
+	lsize = logical_size;
+	repl_addr = strdup(addr);
+	if (!repl_addr || pipe2(wake_pipe, O_CLOEXEC | O_NONBLOCK) == -1)
+		return -1;
+	if (m == REPL_STANDBY) {
+		lfd = repl_socket(addr, 1);
+		if (lfd == -1) {
+			fprintf(stderr, "repl: cannot listen on %s\n", addr);
+			return -1;
+		}
+		readonly = 1;
+	}
+	mode = m;
+	if (pthread_create(&repl_thread, NULL, m == REPL_PRIMARY ? primary_main : standby_main,
+	                   (void *)(intptr_t)lfd) != 0) {
+		mode = REPL_OFF;
+		readonly = 0;
+		if (lfd != -1)
+			close(lfd);
+		return -1;
+	}
+	return 0;
+}
+
+void repl_stop(void)
+{
+	if (mode == REPL_OFF)
+		return;
+	pthread_mutex_lock(&q_lock);
+	stopping = 1;
+	pthread_mutex_unlock(&q_lock);
+	wake();
+	pthread_join(repl_thread, NULL);
+	pthread_mutex_lock(&q_lock);
+	drop_queue();
+	pthread_mutex_unlock(&q_lock);
+	free(cur.data);
+	memset(&cur, 0, sizeof(cur));
+	close(wake_pipe[0]);
+	close(wake_pipe[1]);
+	free(repl_addr);
+	repl_addr = NULL;
+	mode = REPL_OFF;
+}
@@ -0,0 +1,74 @@
+#ifndef _REPL_H_
+#define _REPL_H_
+
+#include "params.h"
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * Replication of myfs_state to a standby myfs process.
+ *
+ * The primary (--replicate=ADDR) turns every state mutation into a record:
+ * bitmap changes, inode block list changes, block payload writes, logical
+ * sizes and path map changes. The records produced by one FUSE operation
+ * form a batch; batches are numbered, streamed by a sender thread and
+ * acknowledged by the standby, with at most REPL_WINDOW batches unacked
+ * before new operations wait. On (re)connect the primary first sends a full
+ * snapshot, so a standby can be started or restarted at any time.
+ *
+ * The standby (--standby=ADDR) applies batches to its own state and rejects
+ * mutating operations with EROFS. It keeps listening when the connection
+ * drops, so a primary can reconnect and resend its state. It promotes itself
+ * and serves reads and writes from the warm state only when the primary
+ * says goodbye at unmount, or when it hears nothing from it (batches, or the
+ * heartbeat sent every second while idle) for REPL_TIMEOUT_SEC; never while
+ * a batch is only partly applied.
+ *
+ * ADDR is unix:/path/to/socket or tcp:host:port (tcp::port to listen on all
+ * addresses).
+ */
+
+enum repl_mode {
+	REPL_OFF,
+	REPL_PRIMARY,
+	REPL_STANDBY,
+};
+
+/* Batches in flight before operations block waiting for acknowledgements */
+#define REPL_WINDOW 64
+
+/* Silence from the primary after which a standby takes over */
+#define REPL_TIMEOUT_SEC 5
+
+/* Start replication; called from myfs_init once fuse_main has daemonized.
+   logical_size is the per-inode logical size array (NUM_INODES entries). */
+int repl_start(enum repl_mode mode, const char *addr, struct myfs_state *s,
+               off_t *logical_size);
+
+void repl_stop(void);
+
+/* Nonzero while this process is an unpromoted standby */
+int repl_readonly(void);
+
+/* Bracket one mutating FUSE operation; records emitted in between form one
+   batch. Mutating operations are serialized while replication is on. */
+void repl_begin(void);
+void repl_commit(void);
+
+/* Bracket a read-only operation: it waits out a batch being applied on a
+   standby, and is not serialized at all on a primary */
+void repl_begin_read(void);
+void repl_end_read(void);
+
+/* Mutation records (no-ops unless this is a connected primary) */
+void repl_inode_bitmap(int ino, int val);
+void repl_block_bitmap(int block, int val);
+void repl_inode_blocks(int ino, int start, int count, const int *blocks);
+void repl_block_data(int block, int offset, const char *data, int len);
+void repl_size(int ino, off_t size);
+void repl_path_add(const char *path, int ino);
+void repl_path_remove(const char *path);
+void repl_mkdir(const char *path);
+void repl_rmdir(const char *path);
+
+#endif
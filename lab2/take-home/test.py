@@ -2,6 +2,7 @@ import json
 import os
 import unittest
 import subprocess
+import time
 import shutil
 
 scores = {"scores": {}}
@@ -291,6 +292,135 @@ class TestMyFS(unittest.TestCase):
         additional_args = ["3", "20", "8"]
         self.run_test_case(operations, 11, 80, additional_args)
 
+    # --- Replication (not scored) ---
+
+    def _wait_for(self, path, timeout=10.0):
+        """Poll until path exists; replication is asynchronous."""
+        deadline = time.time() + timeout
+        while not os.path.exists(path) and time.time() < deadline:
+            time.sleep(0.1)
+        return os.path.exists(path)
+
+    def test_case12(self):
+        """A nested file reaches a standby that connects after its directory was created."""
+        primary, standby = 12, 13
+        addr = "--{}=unix:" + os.path.abspath('repl_tc12.sock')
+        geometry = ["4", "8", "16"]
+        try:
+            self.run_myfs(primary, [addr.format("replicate")] + geometry)
+            os.mkdir(os.path.join(self.mount_dir_template.format(primary), 'dir'))
+            self._create_file(primary, 'dir/nested.txt')
+            self._write_file(primary, 'dir/nested.txt', 'Nested!')
+
+            # the standby's initial snapshot has to create dir before the file
+            self.run_myfs(standby, [addr.format("standby")] + geometry)
+            self.assertTrue(self._wait_for(os.path.join(self.root_dir_template.format(standby), 'dir', 'nested.txt')))
+            with open(os.path.join(self.mount_dir_template.format(standby), 'dir', 'nested.txt')) as f:
+                self.assertEqual(f.read(), 'Nested!')
+
+            # once connected, directories are streamed as they are made
+            os.mkdir(os.path.join(self.mount_dir_template.format(primary), 'dir', 'sub'))
+            self._create_file(primary, 'dir/sub/deep.txt')
+            self.assertTrue(self._wait_for(os.path.join(self.root_dir_template.format(standby), 'dir', 'sub', 'deep.txt')))
+        finally:
+            for tc in (standby, primary):
+                subprocess.run(["fusermount", "-u", self.mount_dir_template.format(tc)])
+
+    # --- Checkpoints, tiering and block classes (not scored) ---
+
+    def _unmount(self, testcase_number, timeout=10.0):
+        """Unmount and wait for myfs to exit, so its last checkpoint is written."""
+        mount_dir = self.mount_dir_template.format(testcase_number)
+        subprocess.run(["fusermount", "-u", mount_dir])
+        deadline = time.time() + timeout
+        while time.time() < deadline:
+            if subprocess.run(["pgrep", "-f", "myfs " + mount_dir + " "], stdout=subprocess.DEVNULL).returncode != 0:
+                return
+            time.sleep(0.1)
+
+    def _read_all(self, testcase_number, name):
+        with open(os.path.join(self.mount_dir_template.format(testcase_number), name)) as f:
+            return f.read()
+
+    def _served_from_memory(self, testcase_number):
+        """Reads of a tracked file log its data blocks; the mirror's do not."""
+        with open(self.log_file_template.format(testcase_number)) as log:
+            return "DATA BLOCK" in log.read()
+
+    def test_case14(self):
+        """Files written before an unmount are loaded from the checkpoint at the next mount."""
+        tc = 14
+        ckpt = os.path.abspath('ckpt_tc14.img')
+        if os.path.exists(ckpt):
+            os.remove(ckpt)
+        args = ["--checkpoint=" + ckpt, "--checkpoint-interval=1", "4", "8", "16"]
+        try:
+            self.run_myfs(tc, args)
+            self._create_file(tc, 'saved.txt')
+            self._write_file(tc, 'saved.txt', 'Saved in a checkpoint!')
+            self._create_file(tc, 'gone.txt')
+            self._write_file(tc, 'gone.txt', 'Deleted')
+            self._delete_file(tc, 'gone.txt')
+            self._unmount(tc)
+
+            self.run_myfs(tc, args)
+            self.assertEqual(self._read_all(tc, 'saved.txt'), 'Saved in a checkpoint!')
+            self.assertTrue(self._served_from_memory(tc))
+            self.assertFalse(os.path.exists(os.path.join(self.mount_dir_template.format(tc), 'gone.txt')))
+        finally:
+            self._unmount(tc)
+
+    def test_case15(self):
+        """Files larger than --resident blocks are evicted to the backing file and read back intact."""
+        tc = 15
+        backing = os.path.abspath('backing_tc15.img')
+        args = ["--backing=" + backing, "--resident=2", "4", "32", "16"]
+        first = ''.join(chr(ord('a') + i % 26) for i in range(200))
+        second = ''.join(chr(ord('A') + i % 26) for i in range(150))
+        try:
+            self.run_myfs(tc, args)
+            self._create_file(tc, 'first.txt')
+            self._create_file(tc, 'second.txt')
+            # interleaved appends, so each file's blocks are evicted by the other's
+            for i in range(0, 200, 20):
+                self._write_file(tc, 'first.txt', first[i:i + 20])
+                if i < 150:
+                    self._write_file(tc, 'second.txt', second[i:i + 20])
+            self.assertEqual(self._read_all(tc, 'first.txt'), first)
+            self.assertEqual(self._read_all(tc, 'second.txt'), second)
+            self.assertTrue(self._served_from_memory(tc))
+        finally:
+            self._unmount(tc)
+        self.assertFalse(os.path.exists(backing))
+
+    def test_case16(self):
+        """Files grow by class runs, and survive a restart without leaking blocks."""
+        tc = 16
+        ckpt = os.path.abspath('ckpt_tc16.img')
+        if os.path.exists(ckpt):
+            os.remove(ckpt)
+        args = ["--block-classes=16,64,256", "--checkpoint=" + ckpt, "4", "64", "16"]
+        content = ''.join(chr(ord('a') + i % 26) for i in range(400))
+        try:
+            self.run_myfs(tc, args)
+            self._create_file(tc, 'runs.txt')
+            for i in range(0, 400, 10):
+                self._write_file(tc, 'runs.txt', content[i:i + 10])
+            self.assertEqual(self._read_all(tc, 'runs.txt'), content)
+            self._unmount(tc)
+
+            self.run_myfs(tc, args)
+            self.assertEqual(self._read_all(tc, 'runs.txt'), content)
+            self.assertTrue(self._served_from_memory(tc))
+            # every block is free again: a file can fill the whole volume
+            self._delete_file(tc, 'runs.txt')
+            self._create_file(tc, 'full.txt')
+            for i in range(64):
+                self._write_file(tc, 'full.txt', chr(ord('a') + i % 26) * 16)
+            self.assertEqual(os.path.getsize(os.path.join(self.mount_dir_template.format(tc), 'full.txt')), 64 * 16)
+        finally:
+            self._unmount(tc)
+
 if __name__ == "__main__":
     unittest.main(exit=False)
 
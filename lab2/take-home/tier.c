@@ -0,0 +1,354 @@
+#include "tier.h"
+#include "ckpt.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+
+struct frame {
+	int block;      /* -1 if free */
+	int pins;
+	char ref;       /* CLOCK reference bit */
+	char dirty;     /* differs from the backing file */
+};
+
+static struct myfs_state *st;
+static int enabled, backing_fd = -1, nframes, hand, pinned;
+static char *backing_path, *arena;
+static char *flat;              /* every payload, in block order (no backing file) */
+static char *cold;              /* read-only view of the backing file */
+static size_t cold_len;
+static struct frame *frames;
+static int *frame_of;           /* block -> frame, or -1 */
+static char *zero;              /* block reads as zeroes (never written back) */
+static pthread_mutex_t tier_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t unpinned = PTHREAD_COND_INITIALIZER;
+
+int tier_init(struct myfs_state *s, const char *backing, int resident, int contiguous)
+{
+	int i;
+
+	st = s;
+	if (!backing && contiguous) {
+		flat = (char *)calloc((size_t)s->NUM_DATA_BLOCKS, (size_t)s->DATA_BLOCK_SIZE);
+		if (!flat)
+			return -1;
+		for (i = 0; i < s->NUM_DATA_BLOCKS; i++) {
+			data_block_free(s->data_blocks[i]);
+			s->data_blocks[i]->data = flat + (size_t)i * (size_t)s->DATA_BLOCK_SIZE;
+		}
+		return 0;
+	}
+	if (!backing)
+		return 0;
+	if (resident > s->NUM_DATA_BLOCKS)
+		resident = s->NUM_DATA_BLOCKS;
+	if (resident < 1)
+		resident = 1;
+
+	backing_fd = open(backing, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (backing_fd == -1)
+		return -1;
+	/* sparse: cold blocks that were never written read as zeroes */
+	cold_len = (size_t)s->NUM_DATA_BLOCKS * (size_t)s->DATA_BLOCK_SIZE;
+	if (ftruncate(backing_fd, (off_t)cold_len) == 0)
+		cold = (char *)mmap(NULL, cold_len, PROT_READ, MAP_SHARED, backing_fd, 0);
+	if (cold == MAP_FAILED)
+		cold = NULL;
+	backing_path = strdup(backing);
+	arena = (char *)malloc((size_t)resident * (size_t)s->DATA_BLOCK_SIZE);
+	frames = (struct frame *)calloc((size_t)resident, sizeof(struct frame));
+	frame_of = (int *)malloc((size_t)s->NUM_DATA_BLOCKS * sizeof(int));
+	zero = (char *)malloc((size_t)s->NUM_DATA_BLOCKS);
+	if (!cold || !backing_path || !arena || !frames || !frame_of || !zero) {
+		if (cold)
+			munmap(cold, cold_len);
+		cold = NULL;
+		close(backing_fd);
+		unlink(backing);
+		backing_fd = -1;
+		free(backing_path);
+		free(arena);
+		free(frames);
+		free(frame_of);
+		free(zero);
+		return -1;
+	}
+	nframes = resident;
+	for (i = 0; i < nframes; i++)
+		frames[i].block = -1;
+	memset(zero, 1, (size_t)s->NUM_DATA_BLOCKS);
+	/* the payloads myfs_state_create allocated are all zero; drop them */
+	for (i = 0; i < s->NUM_DATA_BLOCKS; i++) {
+		frame_of[i] = -1;
+		data_block_free(s->data_blocks[i]);
+		s->data_blocks[i]->data = cold + (size_t)i * (size_t)s->DATA_BLOCK_SIZE;
+	}
+	enabled = 1;
+	return 0;
+}
+
+void tier_shutdown(void)
+{
+	int i;
+
+	if (flat) {
+		for (i = 0; i < st->NUM_DATA_BLOCKS; i++)
+			st->data_blocks[i]->data = NULL;
+		free(flat);
+		flat = NULL;
+		return;
+	}
+	if (!enabled)
+		return;
+	enabled = 0;
+	/* neither the arena nor the backing file view is owned by the blocks */
+	for (i = 0; i < st->NUM_DATA_BLOCKS; i++)
+		st->data_blocks[i]->data = NULL;
+	munmap(cold, cold_len);
+	cold = NULL;
+	close(backing_fd);
+	unlink(backing_path);
+	backing_fd = -1;
+	free(backing_path);
+	free(arena);
+	free(frames);
+	free(frame_of);
+	free(zero);
+	backing_path = arena = zero = NULL;
+	frames = NULL;
+	frame_of = NULL;
+}
+
+static int pread_full(char *dst, size_t len, off_t off)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pread(backing_fd, dst, len, off);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n == -1)
+			return -1;
+		if (n == 0) {
+			/* past the end of a sparse file */
+			memset(dst, 0, len);
+			return 0;
+		}
+		dst += n;
+		len -= (size_t)n;
+		off += n;
+	}
+	return 0;
+}
+
+static int pwrite_full(const char *src, size_t len, off_t off)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		n = pwrite(backing_fd, src, len, off);
+		if (n == -1 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		src += n;
+		len -= (size_t)n;
+		off += n;
+	}
+	return 0;
+}
+
+static off_t block_offset(int block)
+{
+	return (off_t)block * st->DATA_BLOCK_SIZE;
+}
+
+/* Zero block's range of the backing file, so its view reads as zeroes */
+static void backing_clear(int block)
+{
+	char *buf;
+
+	if (fallocate(backing_fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, block_offset(block),
+	              (off_t)st->DATA_BLOCK_SIZE) == 0)
+		return;
+	buf = (char *)calloc(1, (size_t)st->DATA_BLOCK_SIZE);
+	if (!buf || pwrite_full(buf, (size_t)st->DATA_BLOCK_SIZE, block_offset(block)) != 0)
+		perror("tier discard");
+	free(buf);
+}
+
+/* Free a frame for reuse (CLOCK); caller holds tier_lock. Returns -1 if
+   every frame is pinned or failed to write back. */
+static int evict(void)
+{
+	struct frame *f;
+	int scanned, b;
+
+	/* two sweeps: the first may only clear reference bits */
+	for (scanned = 0; scanned < 2 * nframes; scanned++) {
+		f = &frames[hand];
+		b = hand;
+		hand = (hand + 1) % nframes;
+		if (f->block < 0)
+			return b;
+		if (f->pins > 0)
+			continue;
+		if (f->ref) {
+			f->ref = 0;
+			continue;
+		}
+		if (f->dirty) {
+			if (pwrite_full(arena + (size_t)b * (size_t)st->DATA_BLOCK_SIZE,
+			                (size_t)st->DATA_BLOCK_SIZE, block_offset(f->block)) != 0) {
+				perror("tier write-back");
+				continue;
+			}
+			zero[f->block] = 0;
+		}
+		st->data_blocks[f->block]->data = cold + (size_t)block_offset(f->block);
+		frame_of[f->block] = -1;
+		f->block = -1;
+		return b;
+	}
+	return -1;
+}
+
+char *tier_get(int block, int dirty)
+{
+	struct frame *f;
+	char *data;
+	int i;
+
+	if (dirty)
+		ckpt_preserve_block(block);
+	if (!enabled)
+		return st->data_blocks[block]->data;
+
+	pthread_mutex_lock(&tier_lock);
+	i = frame_of[block];
+	if (i < 0) {
+		while ((i = evict()) < 0) {
+			/* nothing pinned means write-back is failing; otherwise wait
+			   for a concurrent operation to unpin a frame */
+			if (pinned == 0) {
+				pthread_mutex_unlock(&tier_lock);
+				return NULL;
+			}
+			pthread_cond_wait(&unpinned, &tier_lock);
+		}
+		data = arena + (size_t)i * (size_t)st->DATA_BLOCK_SIZE;
+		if (zero[block]) {
+			memset(data, 0, (size_t)st->DATA_BLOCK_SIZE);
+		} else if (pread_full(data, (size_t)st->DATA_BLOCK_SIZE, block_offset(block)) != 0) {
+			perror("tier fault");
+			pthread_mutex_unlock(&tier_lock);
+			return NULL;
+		}
+		f = &frames[i];
+		f->block = block;
+		f->dirty = 0;
+		frame_of[block] = i;
+		st->data_blocks[block]->data = data;
+	}
+	f = &frames[i];
+	f->ref = 1;
+	f->pins++;
+	pinned++;
+	if (dirty)
+		f->dirty = 1;
+	data = st->data_blocks[block]->data;
+	pthread_mutex_unlock(&tier_lock);
+	return data;
+}
+
+void tier_put(int block)
+{
+	if (!enabled)
+		return;
+	pthread_mutex_lock(&tier_lock);
+	pinned--;
+	if (--frames[frame_of[block]].pins == 0)
+		pthread_cond_signal(&unpinned);
+	pthread_mutex_unlock(&tier_lock);
+}
+
+int tier_contiguous(void)
+{
+	return flat != NULL;
+}
+
+char *tier_get_run(int block, int n, int dirty)
+{
+	int i;
+
+	if (n == 1)
+		return tier_get(block, dirty);
+	/* only with the flat array: nothing to fault in or pin */
+	for (i = 0; dirty && i < n; i++)
+		ckpt_preserve_block(block + i);
+	return st->data_blocks[block]->data;
+}
+
+void tier_put_run(int block, int n)
+{
+	if (n == 1)
+		tier_put(block);
+}
+
+int tier_read(int block, char *dst)
+{
+	int i, res = 0;
+
+	if (!enabled) {
+		memcpy(dst, st->data_blocks[block]->data, (size_t)st->DATA_BLOCK_SIZE);
+		return 0;
+	}
+	pthread_mutex_lock(&tier_lock);
+	i = frame_of[block];
+	if (i >= 0)
+		memcpy(dst, st->data_blocks[block]->data, (size_t)st->DATA_BLOCK_SIZE);
+	else if (zero[block])
+		memset(dst, 0, (size_t)st->DATA_BLOCK_SIZE);
+	else
+		res = pread_full(dst, (size_t)st->DATA_BLOCK_SIZE, block_offset(block));
+	pthread_mutex_unlock(&tier_lock);
+	return res;
+}
+
+void tier_discard(int block)
+{
+	int i;
+
+	ckpt_preserve_block(block);
+	if (!enabled) {
+		memset(st->data_blocks[block]->data, 0, (size_t)st->DATA_BLOCK_SIZE);
+		return;
+	}
+	pthread_mutex_lock(&tier_lock);
+	if (!zero[block])
+		backing_clear(block);
+	zero[block] = 1;
+	i = frame_of[block];
+	if (i >= 0) {
+		memset(st->data_blocks[block]->data, 0, (size_t)st->DATA_BLOCK_SIZE);
+		frames[i].dirty = 0;
+	}
+	pthread_mutex_unlock(&tier_lock);
+}
+
+void tier_freeze(void)
+{
+	if (enabled)
+		pthread_mutex_lock(&tier_lock);
+}
+
+void tier_thaw(void)
+{
+	if (enabled)
+		pthread_mutex_unlock(&tier_lock);
+}
@@ -0,0 +1,53 @@
+#ifndef _TIER_H_
+#define _TIER_H_
+
+#include "params.h"
+
+/*
+ * Two-tier block store (--backing=FILE, --resident=N).
+ *
+ * Without a backing file every block payload stays in RAM, as allocated by
+ * myfs_state_create or, when contiguous is set, in one array indexed by
+ * block, so that consecutive blocks can be copied with one memcpy. With one,
+ * at most N payloads are resident in a fixed arena of frames;
+ * data_blocks[b]->data points into the arena while b is resident and into a
+ * read-only mapping of FILE otherwise, so a payload can always be read in
+ * place. A cold block is picked by CLOCK (second chance), written to FILE at b * DATA_BLOCK_SIZE if it was
+ * modified, and read back on its next access. Freed blocks are remembered as
+ * all-zero and never read from FILE.
+ *
+ * Accessors that make a block resident pin it; a pinned block is never
+ * evicted. Every tier_get must be paired with a tier_put.
+ */
+
+/* backing == NULL keeps every block in RAM */
+int tier_init(struct myfs_state *s, const char *backing, int resident, int contiguous);
+
+void tier_shutdown(void);
+
+/* Payload of block, made resident and pinned; dirty marks it modified (and
+   first lets a checkpoint in progress copy the old contents).
+   Returns NULL if no frame could be freed (write-back failed). */
+char *tier_get(int block, int dirty);
+void tier_put(int block);
+
+/* Nonzero if the payloads of consecutive blocks are adjacent in memory */
+int tier_contiguous(void);
+
+/* tier_get/tier_put for the n blocks from block on, whose payloads are
+   returned as one; n > 1 requires tier_contiguous() */
+char *tier_get_run(int block, int n, int dirty);
+void tier_put_run(int block, int n);
+
+/* Copy block's payload into dst without making it resident */
+int tier_read(int block, char *dst);
+
+/* block was freed: its payload reads as zeroes from now on */
+void tier_discard(int block);
+
+/* Hold every payload where data_blocks[b]->data points (no block is faulted
+   in or evicted) until tier_thaw, for reading payloads in place */
+void tier_freeze(void);
+void tier_thaw(void);
+
+#endif
@@ -0,0 +1,122 @@
+#define _GNU_SOURCE
+
+#include "trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <pthread.h>
+
+#ifndef PATH_MAX
+#define PATH_MAX 4096
+#endif
+
+/* Records are small; a large stdio buffer keeps write(2) off the FUSE path */
+#define TRACE_BUF_SIZE (1 << 20)
+
+static FILE *trace_file;
+static char *trace_buf;
+static uint64_t trace_epoch;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+
+uint64_t trace_now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+int trace_open(const char *file)
+{
+	struct trace_header h;
+
+	trace_file = fopen(file, "wb");
+	if (!trace_file) {
+		perror("trace");
+		return -1;
+	}
+	trace_buf = (char *)malloc(TRACE_BUF_SIZE);
+	if (trace_buf)
+		setvbuf(trace_file, trace_buf, _IOFBF, TRACE_BUF_SIZE);
+
+	memset(&h, 0, sizeof(h));
+	memcpy(h.magic, TRACE_MAGIC, sizeof(h.magic));
+	h.version = TRACE_VERSION;
+	if (fwrite(&h, sizeof(h), 1, trace_file) != 1) {
+		trace_close();
+		return -1;
+	}
+	trace_epoch = trace_now();
+	return 0;
+}
+
+void trace_close(void)
+{
+	pthread_mutex_lock(&trace_lock);
+	if (trace_file) {
+		fclose(trace_file);
+		trace_file = NULL;
+	}
+	free(trace_buf);
+	trace_buf = NULL;
+	pthread_mutex_unlock(&trace_lock);
+}
+
+int trace_enabled(void)
+{
+	return trace_file != NULL;
+}
+
+void trace_op(enum trace_op op, const char *path, off_t offset, size_t size,
+              int result, uint64_t start_ns)
+{
+	struct trace_rec rec;
+	size_t len;
+	uint64_t end_ns;
+
+	if (!trace_file)
+		return;
+
+	end_ns = trace_now();
+	len = strnlen(path, PATH_MAX - 1);
+
+	memset(&rec, 0, sizeof(rec));
+	rec.ts_ns = start_ns - trace_epoch;
+	rec.offset = (uint64_t)offset;
+	rec.size = (uint32_t)size;
+	rec.result = result;
+	rec.op = (uint8_t)op;
+	rec.path_len = (uint16_t)len;
+	rec.dur_us = (uint32_t)((end_ns - start_ns) / 1000);
+
+	pthread_mutex_lock(&trace_lock);
+	if (trace_file) {
+		fwrite(&rec, sizeof(rec), 1, trace_file);
+		fwrite(path, 1, len, trace_file);
+	}
+	pthread_mutex_unlock(&trace_lock);
+}
+
+int trace_read_header(FILE *f)
+{
+	struct trace_header h;
+
+	if (fread(&h, sizeof(h), 1, f) != 1)
+		return -1;
+	if (memcmp(h.magic, TRACE_MAGIC, sizeof(h.magic)) != 0 || h.version != TRACE_VERSION)
+		return -1;
+	return 0;
+}
+
+int trace_read_rec(FILE *f, struct trace_rec *rec, char *path)
+{
+	if (fread(rec, sizeof(*rec), 1, f) != 1)
+		return 0;
+	if (rec->path_len >= PATH_MAX)
+		return -1;
+	if (fread(path, 1, rec->path_len, f) != rec->path_len)
+		return -1;
+	path[rec->path_len] = '\0';
+	return 1;
+}
@@ -0,0 +1,68 @@
+#ifndef _TRACE_H_
+#define _TRACE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/*
+ * Binary workload trace written by `myfs --trace=FILE` and consumed by
+ * myfs_replay. The file is a struct trace_header followed by records, each a
+ * struct trace_rec immediately followed by path_len bytes of path (no NUL).
+ * All fields are host-endian; traces are meant to be replayed on the box
+ * that recorded them.
+ */
+
+#define TRACE_MAGIC   "MYFSTRC1"
+#define TRACE_VERSION 1
+
+enum trace_op {
+	TRACE_CREATE = 1,
+	TRACE_READ   = 2,
+	TRACE_WRITE  = 3,
+	TRACE_UNLINK = 4,
+	TRACE_MKDIR  = 5,
+	TRACE_RMDIR  = 6,
+};
+
+struct trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t reserved;
+};
+
+struct trace_rec {
+	uint64_t ts_ns;     /* start of the operation, relative to mount */
+	uint64_t offset;
+	uint32_t size;
+	int32_t result;     /* value returned to FUSE */
+	uint8_t op;         /* enum trace_op */
+	uint8_t flags;
+	uint16_t path_len;
+	uint32_t dur_us;    /* time spent in the callback */
+};
+
+/* Open a trace for writing; returns 0 on success, -1 on failure */
+int trace_open(const char *file);
+
+/* Flush and close the trace (no-op if tracing is off) */
+void trace_close(void);
+
+/* Nonzero if a trace is being recorded */
+int trace_enabled(void);
+
+/* Monotonic timestamp in ns; pass the value taken at callback entry to trace_op */
+uint64_t trace_now(void);
+
+/* Append one record; safe to call from concurrent FUSE threads */
+void trace_op(enum trace_op op, const char *path, off_t offset, size_t size,
+              int result, uint64_t start_ns);
+
+/* Read the next record from a trace; path must hold PATH_MAX bytes.
+   Returns 1 on success, 0 at end of trace, -1 on a malformed record. */
+int trace_read_rec(FILE *f, struct trace_rec *rec, char *path);
+
+/* Validate the header at the start of f; returns 0 if it is a myfs trace */
+int trace_read_header(FILE *f);
+
+#endif